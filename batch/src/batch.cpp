@@ -0,0 +1,173 @@
+#include "knn.h"
+#include "knn-io.h"
+#include "distances.h"
+#include "feature-set.h"
+#include "files.h"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+namespace {
+    /**
+     * Command line options of the batch classifier.
+     */
+    struct Options {
+        std::string classified;
+        std::string unclassified;
+        int k;
+        std::string output;             // The output files are named <output>_<metric>.txt
+        std::vector<bool> metrics;      // Whether every metric of distances::metric_names is classified
+        unsigned int threads;           // 0 for one per CPU
+
+        Options() : k(5), metrics(distances::num_metrics, true), threads(0) { }
+    };
+
+    void usage(const char* name) {
+        std::cerr << "\e[31;1mUsage:\e[0m " << name << " <classified file> <unclassified file> <k> <output prefix>"
+                  << " [--metrics EUC,MAN,CHE,COS,DOT] [--threads n]" << std::endl;
+        std::exit(1);
+    }
+
+    /**
+     * Parses a comma separated list of metric names.
+     * @throws std::invalid_argument if a name isn't a metric's.
+     */
+    std::vector<bool> parse_metrics(const std::string& list) {
+        std::vector<bool> metrics(distances::num_metrics, false);
+        std::stringstream names(list);
+        std::string name;
+        while (std::getline(names, name, ',')) {
+            size_t m = distances::metric_index(name);
+            if (m == distances::num_metrics) throw std::invalid_argument("unknown metric " + name);
+            metrics[m] = true;
+        }
+        return metrics;
+    }
+
+    double stod(std::string s) { return std::stod(s); }
+
+    /**
+     * Classifies a file of points relative to several metrics at once, writing the classes relative to every metric
+     * to its own file (numbered lines, as results are downloaded).
+     * Both files are parsed once, and the points are classified in parallel through a Feature Set, so the norms of
+     * the Data Points are computed once and every point is a single pass over the Data Set computing every metric.
+     * The votes are counted per metric as the server counts them (see FeatureSet::metric_vote).
+     * @param output_names      For every metric of distances::metric_names, the name of the file its classes are
+     *                          written to ("" to skip the metric).
+     * @param threads           The number of threads classifying points (0 for one per CPU).
+     * @throws                  std::ios_base::failure if a file can't be read or written, std::invalid_argument
+     *                          if a point can't be parsed or classified.
+     */
+    void classify(const std::string& classified, const std::string& unclassified, int k,
+            const std::vector<std::string>& output_names, unsigned int threads) {
+        streams::MappedFile file;
+        streams::LineView line;
+        auto getline = [&file, &line](std::string& s) -> std::string {
+            if (file.read_line(line)) s.assign(line.data, line.length);
+            else s.clear();
+            return s;
+        };
+
+        file.open(classified);
+        std::unique_ptr<knn::FeatureSet> set{knn::make_feature_set(knn::initialize_dataset<double>(getline, stod))};
+
+        /* The unclassified points are parsed once, and classified relative to every metric */
+        file.open(unclassified);
+        std::vector<std::unique_ptr<knn::CartDataPoint<double>>> points;
+        knn::CartDataPoint<double>* p;
+        while ((p = knn::read_point<double>(getline, stod, false)) != nullptr) points.emplace_back(p);
+        file.close();
+
+        std::vector<std::vector<std::string>> classes(distances::num_metrics, std::vector<std::string>(points.size()));
+
+        /* Every thread takes the next block of points, and scans the Data Set once per point for all of the metrics */
+        const size_t block = 64;
+        std::atomic<size_t> next{0};
+        std::mutex error_mutex;
+        std::exception_ptr error;
+        auto worker = [&]() {
+            /* The threads already split the points, so each scan runs on its own thread */
+            parallel::Serial serial{threads > 1};
+            try {
+                for (size_t start = next.fetch_add(block); start < points.size(); start = next.fetch_add(block)) {
+                    for (size_t i = start; i < std::min(start + block, points.size()); i++) {
+                        std::vector<std::vector<int>> nearest = set->get_k_nearest_indices(k, points[i].get());
+                        for (size_t m = 0; m < distances::num_metrics; m++) {
+                            if (output_names[m] != "") classes[m][i] = set->metric_vote(nearest[m], k, m);
+                        }
+                    }
+                }
+            } catch (...) {
+                std::lock_guard<std::mutex> lock{error_mutex};
+                if (!error) error = std::current_exception();
+                next = points.size();
+            }
+        };
+
+        if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+        threads = std::min<size_t>(threads, (points.size() + block - 1) / block);
+        std::vector<std::thread> workers;
+        for (unsigned int i = 1; i < threads; i++) workers.push_back(std::thread(worker));
+        worker();
+        for (std::thread& thread : workers) thread.join();
+        if (error) std::rethrow_exception(error);
+
+        for (size_t m = 0; m < distances::num_metrics; m++) {
+            if (output_names[m] == "") continue;
+
+            streams::FileWriter output;
+            output.open(output_names[m]);
+            for (size_t i = 0; i < points.size(); i++) output.write(std::to_string(i + 1) + ".\t" + classes[m][i] + "\n");
+            output.close();
+        }
+    }
+} // anonymous
+
+int main(int argc, char** argv) {
+    if (argc < 5) usage(argv[0]);
+
+    Options options;
+    options.classified = argv[1];
+    options.unclassified = argv[2];
+    options.k = strtol(argv[3], NULL, 0);
+    options.output = argv[4];
+    if (options.k < 1) usage(argv[0]);
+
+    for (int i = 5; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) usage(argv[0]);
+        std::string value = argv[++i];
+
+        if (arg == "--threads") options.threads = strtol(value.c_str(), NULL, 0);
+        else if (arg == "--metrics") {
+            try {
+                options.metrics = parse_metrics(value);
+            } catch (std::invalid_argument& e) {
+                usage(argv[0]);
+            }
+        } else usage(argv[0]);
+    }
+
+    std::vector<std::string> output_names;
+    for (size_t m = 0; m < distances::num_metrics; m++) {
+        output_names.push_back(options.metrics[m] ? options.output + "_" + distances::metric_names[m] + ".txt" : "");
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    try {
+        classify(options.classified, options.unclassified, options.k, output_names, options.threads);
+    } catch (std::exception& e) {
+        std::cerr << "\e[31;1mFailed to classify:\e[0m " << e.what() << std::endl;
+        return 1;
+    }
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    for (const std::string& name : output_names) {
+        if (name != "") std::cout << "Wrote " << name << std::endl;
+    }
+    std::cout << "Classified " << options.unclassified << " in " << ms << " ms" << std::endl;
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <random>
+
+#include "knn.h"
+#include "distances.h"
+
+namespace bench {
+    /**
+     * Parameters shared by all of the benchmarks.
+     */
+    struct Config {
+        size_t rows;            // The number of points in generated Data Sets
+        size_t dims;            // The number of features of generated points
+        size_t classes;         // The number of classes of generated points
+        unsigned int seed;      // The seed of every random generator, so runs are reproducible
+        size_t repeat;          // The number of timed repetitions of every benchmark
+        std::string filter;     // Only run benchmarks whose name contains this
+
+        Config() : rows(10000), dims(16), classes(5), seed(1), repeat(5) { }
+    };
+
+    /**
+     * Generator of synthetic classified data.
+     * Every class is a gaussian cluster around a random center.
+     */
+    class Generator {
+        std::mt19937 m_random;
+        size_t m_dims;
+        std::vector<std::vector<double>> m_centers;
+
+        public:
+            /**
+             * Constructor for a Generator.
+             * @param dims          The number of features of every point.
+             * @param classes       The number of classes.
+             * @param seed          The seed of the generator.
+             */
+            Generator(size_t dims, size_t classes, unsigned int seed);
+
+            /**
+             * Generates the features of a point and the index of its class.
+             */
+            std::vector<double> features(size_t& class_index);
+
+            /**
+             * Generates a csv line.
+             * @param classified    Whether or not the line ends with the point's class.
+             */
+            std::string line(bool classified);
+
+            /**
+             * Generates csv lines.
+             * @param rows          The number of lines.
+             * @param classified    Whether or not the lines end with the points' classes.
+             */
+            std::vector<std::string> lines(size_t rows, bool classified);
+
+            /**
+             * Generates a Cartesian Data Point (the caller must delete it).
+             * @param classified    Whether or not the point has a class.
+             */
+            knn::CartDataPoint<double>* point(bool classified);
+
+            /**
+             * Generates a Data Set of classified points (the caller must delete it).
+             * @param rows          The number of points in the Data Set.
+             */
+            dubdset* dataset(size_t rows);
+    };
+
+    /**
+     * Runs benchmarks and collects their results.
+     */
+    class Runner {
+        Config m_config;
+        std::vector<std::string> m_results;
+
+        public:
+            Runner(const Config& config) : m_config(config) { }
+
+            const Config& config() const { return this->m_config; }
+
+            /**
+             * Times a benchmark. The body is run once to warm up, and then timed config().repeat times.
+             * @param name          The name of the benchmark, groups separated by '/'.
+             * @param params        The parameters of the benchmark, as the members of a JSON object.
+             * @param ops           The number of operations performed by every run of the body.
+             * @param body          The timed code.
+             * @param setup         Untimed code run before every run of the body.
+             * @param teardown      Untimed code run after every run of the body.
+             */
+            void run(std::string name, std::string params, size_t ops, std::function<void()> body,
+                    std::function<void()> setup=nullptr, std::function<void()> teardown=nullptr);
+
+            /**
+             * @return The results of every benchmark run so far, as a JSON document.
+             */
+            std::string json() const;
+    };
+
+    /**
+     * Prevents the compiler from optimizing away the computation of a value.
+     */
+    template <typename T>
+    void do_not_optimize(const T& value) {
+        asm volatile("" : : "r,m"(value) : "memory");
+    }
+
+    /** Benchmark groups **/
+
+    void distance_benchmarks(Runner& runner);
+    void quickselect_benchmarks(Runner& runner);
+    void dataset_benchmarks(Runner& runner);
+    void parsing_benchmarks(Runner& runner);
+    void serialization_benchmarks(Runner& runner);
+    void transport_benchmarks(Runner& runner);
+    void sparse_benchmarks(Runner& runner);
+    void thread_pool_benchmarks(Runner& runner);
+    void queue_benchmarks(Runner& runner);
+}
@@ -0,0 +1,769 @@
+#include "bench.h"
+#include "thread-pool.h"
+#include "feature-set.h"
+#include "reduction.h"
+#include "batching.h"
+#include "sparse-feature-set.h"
+#include "files.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <set>
+#include <unistd.h>
+
+namespace {
+    using namespace bench;
+
+    /**
+     * Formats a member of a JSON object.
+     */
+    std::string param(std::string name, size_t value) {
+        return "\"" + name + "\": " + std::to_string(value);
+    }
+
+    /**
+     * Stream over one end of a socketpair, for benchmarking serialization without the network stack.
+     */
+    class SocketPairStream : public streams::Stream {
+        int m_fd;
+
+        public:
+            SocketPairStream(int fd) : m_fd(fd) { }
+
+            char* receive(size_t& size, bool force_size=true) override {
+                if (size == 0) return nullptr;
+
+                char* data = new char[size];
+                size_t i = 0;
+                while (i < size) {
+                    ssize_t bytes_read = recv(this->m_fd, data + i, size - i, 0);
+                    if (bytes_read <= 0) {
+                        delete[] data;
+                        throw std::ios_base::failure("error encountered while receiving from socketpair");
+                    }
+                    i += bytes_read;
+                }
+
+                return data;
+            }
+
+            void receive_into(void* buffer, size_t size) override {
+                size_t i = 0;
+                while (i < size) {
+                    ssize_t bytes_read = recv(this->m_fd, (char*)buffer + i, size - i, 0);
+                    if (bytes_read <= 0) throw std::ios_base::failure("error encountered while receiving from socketpair");
+                    i += bytes_read;
+                }
+            }
+
+            void send(const void* data, size_t size) override {
+                size_t i = 0;
+                while (i < size) {
+                    ssize_t bytes_sent = ::send(this->m_fd, (const char*)data + i, size - i, 0);
+                    if (bytes_sent < 0) throw std::ios_base::failure("error encountered while sending to socketpair");
+                    i += bytes_sent;
+                }
+            }
+
+            bool is_good() override { return this->m_fd >= 0; }
+
+            void close() override { ::close(this->m_fd); }
+    };
+
+    struct IndexedDistance {
+        int index;
+        double distance;
+
+        bool operator<(const IndexedDistance& other) const { return this->distance < other.distance; }
+    };
+
+    void count_job(std::atomic<size_t>* counter) {
+        counter->fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * The queue the thread pool used before it was lock-free: a mutex around a std::queue, and a condition
+     * variable notified on every push.
+     */
+    class MutexQueue {
+        std::mutex m_mutex;
+        std::condition_variable m_not_empty;
+        std::queue<size_t> m_items;
+
+        public:
+            void push(size_t item) {
+                {
+                    std::unique_lock<std::mutex> lock{this->m_mutex};
+                    this->m_items.push(item);
+                }
+                this->m_not_empty.notify_one();
+            }
+
+            size_t pop() {
+                std::unique_lock<std::mutex> lock{this->m_mutex};
+                this->m_not_empty.wait(lock, [this] { return !this->m_items.empty(); });
+                size_t item = this->m_items.front();
+                this->m_items.pop();
+                return item;
+            }
+    };
+
+    /**
+     * An MPMCQueue which blocks the way the thread pool does: producers back off while it is full, and consumers
+     * spin and then park while it is empty.
+     */
+    class LockFreeQueue {
+        threading::MPMCQueue<size_t> m_queue;
+        threading::EventCount m_pushed;
+        unsigned int m_spin_limit;
+
+        public:
+            LockFreeQueue(size_t capacity) : m_queue(capacity), m_spin_limit(threading::spin_polls()) { }
+
+            void push(size_t item) {
+                while (!this->m_queue.try_push(item)) std::this_thread::yield();
+                this->m_pushed.notify();
+            }
+
+            size_t pop() {
+                size_t item;
+                while (true) {
+                    for (unsigned int i = 0; i < this->m_spin_limit; i++) {
+                        if (this->m_queue.try_pop(item)) return item;
+                        threading::cpu_relax();
+                    }
+
+                    uint32_t key = this->m_pushed.prepare_wait();
+                    if (this->m_queue.try_pop(item)) {
+                        this->m_pushed.cancel_wait();
+                        return item;
+                    }
+                    this->m_pushed.wait(key);
+                }
+            }
+    };
+
+    /**
+     * Passes the items 0..items-1 from producers to consumers through a queue.
+     * @param seen          If not null, counts how many times every item was popped.
+     * @return              The sum of the popped items.
+     */
+    template <typename Q>
+    size_t transfer(Q& queue, unsigned int producers, unsigned int consumers, size_t items,
+            std::atomic<unsigned char>* seen) {
+        std::atomic<size_t> sum{0};
+        std::vector<std::thread> threads;
+
+        for (unsigned int p = 0; p < producers; p++) {
+            threads.push_back(std::thread([&queue, p, producers, items]() {
+                    for (size_t i = p; i < items; i += producers) queue.push(i);
+                }));
+        }
+
+        for (unsigned int c = 0; c < consumers; c++) {
+            threads.push_back(std::thread([&queue, &sum, c, consumers, items, seen]() {
+                    size_t local = 0;
+                    for (size_t i = c; i < items; i += consumers) {
+                        size_t item = queue.pop();
+                        if (seen) seen[item].fetch_add(1, std::memory_order_relaxed);
+                        local += item;
+                    }
+                    sum.fetch_add(local);
+                }));
+        }
+
+        for (std::thread& thread : threads) thread.join();
+        return sum.load();
+    }
+
+    /**
+     * Benchmarks the fused distance kernel on the points' features stored as T's.
+     */
+    template <typename T>
+    void kernel_benchmark(Runner& runner, const std::string& params,
+            const std::vector<std::unique_ptr<knn::CartDataPoint<double>>>& points) {
+        size_t dims = points[0]->data().length();
+        size_t pairs = points.size() - 1;
+        std::vector<T> features;
+        for (auto& p : points) {
+            for (size_t j = 0; j < dims; j++) features.push_back((T)(int)p->data()[j]);
+        }
+
+        runner.run(std::string("distance/all_kernel_") + knn::feature_name<T>(), params, pairs, [&]() {
+            double out[distances::num_metrics];
+            for (size_t i = 0; i < pairs; i++) {
+                distances::all_kernel(&features[i * dims], &features[(i + 1) * dims], dims, 1.0, 1.0, out);
+                do_not_optimize(out);
+            }
+        });
+    }
+    /**
+     * Benchmarks a transport, given the two ends of a connection over it (which are closed at the end).
+     */
+    template <typename S>
+    void transport_benchmark(Runner& runner, const std::string& transport, S& client, S& server) {
+        const size_t messages = 1000;
+        const size_t bulk_bytes = 16 << 20;
+
+        /* A small request and response, as most of the protocol is */
+        std::string message(64, 'x');
+        runner.run("transport/" + transport + "_round_trip", param("bytes", message.size()), messages, [&]() {
+            std::thread echo([&]() {
+                for (size_t i = 0; i < messages; i++) {
+                    server.receive_into(&message[0], message.size());
+                    server.send(message.data(), message.size());
+                }
+            });
+            std::string received(message.size(), '\0');
+            for (size_t i = 0; i < messages; i++) {
+                client.send(message.data(), message.size());
+                client.receive_into(&received[0], received.size());
+            }
+            echo.join();
+            do_not_optimize(received);
+        });
+
+        /* A large payload, as a bulk upload is */
+        std::vector<char> payload(bulk_bytes, 1);
+        std::vector<char> received(bulk_bytes);
+        runner.run("transport/" + transport + "_bulk", param("bytes", bulk_bytes), 1, [&]() {
+            std::thread sending([&]() { client.send(payload.data(), payload.size()); });
+            server.receive_into(received.data(), received.size());
+            sending.join();
+            do_not_optimize(received);
+        });
+
+        client.close();
+        server.close();
+    }
+} // anonymous
+
+namespace bench {
+    void distance_benchmarks(Runner& runner) {
+        const Config& config = runner.config();
+        const size_t pairs = 10000;
+        Generator generator{config.dims, config.classes, config.seed};
+        std::vector<std::unique_ptr<knn::CartDataPoint<double>>> points;
+        for (size_t i = 0; i < pairs + 1; i++) points.emplace_back(generator.point(true));
+
+        std::string params = param("dims", config.dims);
+        struct { std::string name; double (*distance)(const dubdpoint*, const dubdpoint*); } metrics[] = {
+            {"distance/euclidean", distances::euclidean_distance},
+            {"distance/manhattan", distances::manhattan_distance},
+            {"distance/chebyshev", distances::chebyshev_distance},
+            {"distance/cosine", distances::cosine_distance},
+            {"distance/inner_product", distances::inner_product_distance}
+        };
+
+        for (auto& metric : metrics) {
+            runner.run(metric.name, params, pairs, [&]() {
+                for (size_t i = 0; i < pairs; i++) do_not_optimize(metric.distance(points[i].get(), points[i + 1].get()));
+            });
+        }
+
+        runner.run("distance/all_distances", params, pairs, [&]() {
+            double out[distances::num_metrics];
+            for (size_t i = 0; i < pairs; i++) {
+                distances::all_distances(points[i].get(), points[i + 1].get(), out);
+                do_not_optimize(out);
+            }
+        });
+
+        kernel_benchmark<double>(runner, params, points);
+        kernel_benchmark<float>(runner, params, points);
+        kernel_benchmark<int16_t>(runner, params, points);
+        kernel_benchmark<uint8_t>(runner, params, points);
+    }
+
+    void quickselect_benchmarks(Runner& runner) {
+        const Config& config = runner.config();
+        const int k = 5;
+        std::mt19937 random(config.seed);
+        std::uniform_real_distribution<double> distance(0.0, 100.0);
+        std::vector<IndexedDistance> distances;
+        for (size_t i = 0; i < config.rows; i++) distances.push_back({(int)i, distance(random)});
+
+        std::string params = param("rows", config.rows) + ", " + param("k", k);
+
+        runner.run("quickselect/quickselect", params, 1, [&]() {
+            do_not_optimize(knn::quickselect(distances, k)[k - 1].index);
+        }, [&]() { srand(config.seed); });
+
+        runner.run("quickselect/nth_element", params, 1, [&]() {
+            std::vector<IndexedDistance> copy = distances;
+            std::nth_element(copy.begin(), copy.begin() + k - 1, copy.end());
+            do_not_optimize(copy[k - 1].index);
+        });
+
+        runner.run("quickselect/partial_sort", params, 1, [&]() {
+            std::vector<IndexedDistance> copy = distances;
+            std::partial_sort(copy.begin(), copy.begin() + k, copy.end());
+            do_not_optimize(copy[k - 1].index);
+        });
+    }
+
+    void dataset_benchmarks(Runner& runner) {
+        const Config& config = runner.config();
+        const size_t queries = 20;
+        const int k = 5;
+        Generator generator{config.dims, config.classes, config.seed};
+        std::unique_ptr<dubdset> dataset{generator.dataset(config.rows)};
+        std::vector<std::unique_ptr<knn::CartDataPoint<double>>> points;
+        for (size_t i = 0; i < queries; i++) points.emplace_back(generator.point(false));
+
+        std::string params = param("rows", config.rows) + ", " + param("dims", config.dims) + ", " + param("k", k);
+
+        runner.run("dataset/get_nearest_class", params, queries, [&]() {
+            for (auto& p : points) do_not_optimize(dataset->get_nearest_class(k, p.get(), distances::euclidean_distance));
+        }, [&]() { srand(config.seed); });
+
+        /* Exact-match lookups of points near the end of the Data Set, by a scan and through the hash index */
+        std::vector<const knn::DataPoint<misc::array<double>>*> labeled;
+        for (size_t i = 0; i < queries; i++) labeled.push_back(dataset->get_data()[config.rows - 1 - i]);
+
+        runner.run("dataset/get_class_scan", params, queries, [&]() {
+            for (auto p : labeled) do_not_optimize(dataset->get_class(p));
+        });
+
+        dataset->build_index();
+        runner.run("dataset/get_class_indexed", params, queries, [&]() {
+            for (auto p : labeled) do_not_optimize(dataset->get_class(p));
+        });
+
+        runner.run("dataset/get_k_nearest_indices", params, queries, [&]() {
+            for (auto& p : points) {
+                do_not_optimize(dataset->get_k_nearest_indices(10, p.get(), distances::all_distances, distances::num_metrics));
+            }
+        });
+
+        /* Cosine similarity computing both norms per pair, against the norms cached by a Feature Set */
+        runner.run("dataset/cosine_uncached", params, queries, [&]() {
+            for (auto& p : points) do_not_optimize(dataset->get_nearest_class(k, p.get(), distances::cosine_distance));
+        }, [&]() { srand(config.seed); });
+
+        knn::TypedFeatureSet<double> feature_set{generator.dataset(config.rows)};
+        runner.run("dataset/cosine_cached", params, queries, [&]() {
+            for (auto& p : points) do_not_optimize(feature_set.get_nearest_class(k, p.get(), distances::cosine_metric));
+        });
+
+        /* A scan per query, against one blocked scan answering every query (as a batch of sessions is answered) */
+        runner.run("dataset/unbatched_classify", params, queries, [&]() {
+            for (auto& p : points) do_not_optimize(feature_set.get_nearest_class(k, p.get(), 0));
+        });
+
+        std::vector<knn::BatchQuery> batch;
+        for (auto& p : points) batch.push_back(knn::BatchQuery{k, p.get(), 0});
+        runner.run("dataset/batched_classify", params, queries, [&]() {
+            do_not_optimize(feature_set.get_nearest_classes(batch));
+        });
+
+        /* 1 to 8 concurrent sessions classifying through a shared Feature Set, each scanning for its own queries,
+         * against a batched one, whose queries are coalesced into one scan */
+        auto classify_concurrently = [&](knn::FeatureSet& set, size_t sessions) {
+            std::vector<std::thread> threads;
+            for (size_t s = 0; s < sessions; s++) {
+                threads.push_back(std::thread([&, s]() {
+                    for (size_t i = s; i < points.size(); i += sessions) {
+                        do_not_optimize(set.get_nearest_class(k, points[i].get(), 0));
+                    }
+                }));
+            }
+            for (std::thread& thread : threads) thread.join();
+        };
+        for (size_t sessions = 1; sessions <= 8; sessions *= 2) {
+            knn::Batching batching;
+            batching.window = std::chrono::microseconds(200);
+            batching.max_queries = sessions;
+            std::unique_ptr<knn::FeatureSet> batched{knn::batch(knn::make_feature_set(generator.dataset(config.rows)),
+                    batching)};
+
+            std::string session_params = params + ", " + param("sessions", sessions);
+            runner.run("dataset/unbatched_sessions", session_params, queries, [&]() {
+                classify_concurrently(feature_set, sessions);
+            });
+            runner.run("dataset/batched_sessions", session_params, queries, [&]() {
+                classify_concurrently(*batched, sessions);
+            });
+        }
+
+        /* Scanning a PCA projection onto a quarter of the dimensions and reranking, against scanning every feature */
+        runner.run("dataset/full_scan", params, queries, [&]() {
+            for (auto& p : points) do_not_optimize(feature_set.get_k_nearest_indices(k, p.get(), 0));
+        });
+
+        knn::Reduction reduction;
+        reduction.method = knn::Reduction::pca;
+        reduction.dims = std::max<size_t>(config.dims / 4, 1);
+        std::unique_ptr<knn::FeatureSet> reduced{knn::reduce(knn::make_feature_set(generator.dataset(config.rows)), reduction)};
+        runner.run("dataset/reduced_scan", params + ", " + param("reduced_dims", reduction.dims), queries, [&]() {
+            for (auto& p : points) do_not_optimize(reduced->get_k_nearest_indices(k, p.get(), 0));
+        });
+
+        /* A single query against a Data Set large enough to be split across threads, on one thread and split */
+        const size_t large_rows = std::max<size_t>(config.rows * 20, parallel::threshold());
+        const unsigned int threads = std::max(4u, std::thread::hardware_concurrency());
+        std::unique_ptr<dubdset> large{generator.dataset(large_rows)};
+        std::string large_params = param("rows", large_rows) + ", " + param("dims", config.dims) + ", " + param("k", k);
+        std::string split_params = large_params + ", " + param("threads", threads);
+        unsigned int max_threads = parallel::max_threads();
+        parallel::set_max_threads(threads);
+
+        runner.run("dataset/serial_scan", large_params, queries, [&]() {
+            parallel::Serial serial;
+            for (auto& p : points) do_not_optimize(large->get_nearest_class(k, p.get(), distances::euclidean_distance));
+        }, [&]() { srand(config.seed); });
+
+        runner.run("dataset/split_scan", split_params, queries, [&]() {
+            for (auto& p : points) do_not_optimize(large->get_nearest_class(k, p.get(), distances::euclidean_distance));
+        }, [&]() { srand(config.seed); });
+
+        runner.run("dataset/serial_all_metrics_scan", large_params, queries, [&]() {
+            parallel::Serial serial;
+            for (auto& p : points) {
+                do_not_optimize(large->get_k_nearest_indices(k, p.get(), distances::all_distances, distances::num_metrics));
+            }
+        });
+
+        runner.run("dataset/split_all_metrics_scan", split_params, queries, [&]() {
+            for (auto& p : points) {
+                do_not_optimize(large->get_k_nearest_indices(k, p.get(), distances::all_distances, distances::num_metrics));
+            }
+        });
+
+        parallel::set_max_threads(max_threads);
+    }
+
+    void parsing_benchmarks(Runner& runner) {
+        const Config& config = runner.config();
+        Generator generator{config.dims, config.classes, config.seed};
+        std::vector<std::string> classified = generator.lines(config.rows, true);
+        std::vector<std::string> unclassified = generator.lines(config.rows, false);
+
+        std::string params = param("rows", config.rows) + ", " + param("dims", config.dims);
+        double (*converter)(std::string) = [](std::string s) { return std::stod(s); };
+
+        runner.run("parsing/initialize_dataset", params, config.rows, [&]() {
+            size_t i = 0;
+            dubdset* dataset = knn::initialize_dataset<double>([&](std::string& s) -> std::string {
+                    s = i < classified.size() ? classified[i++] : "";
+                    return s;
+                }, converter);
+            do_not_optimize(dataset);
+            delete dataset;
+        });
+
+        runner.run("parsing/get_point", params, config.rows, [&]() {
+            for (const std::string& line : unclassified) {
+                knn::CartDataPoint<double>* p = knn::get_point<double>(line, converter, false);
+                do_not_optimize(p);
+                delete p;
+            }
+        });
+
+        /* Reading and writing the lines of a local file through file streams, against a mapping and a FileWriter */
+        char path[] = "/tmp/knnbench-XXXXXX";
+        int fd = mkstemp(path);
+        if (fd < 0) throw std::ios_base::failure("error encountered while creating a temporary file, errno: " +
+                std::to_string(errno));
+        ::close(fd);
+
+        runner.run("io/ofstream_write", params, config.rows, [&]() {
+            std::ofstream file(path);
+            for (const std::string& line : classified) file << line << "\n";
+        });
+
+        runner.run("io/file_writer", params, config.rows, [&]() {
+            streams::FileWriter file;
+            file.open(path);
+            for (const std::string& line : classified) {
+                file.write(line);
+                file.write("\n", 1);
+            }
+            file.close();
+        });
+
+        runner.run("io/ifstream_getline", params, config.rows, [&]() {
+            std::ifstream file(path);
+            std::string line;
+            size_t bytes = 0;
+            while (std::getline(file, line)) bytes += line.size();
+            do_not_optimize(bytes);
+        });
+
+        runner.run("io/mapped_lines", params, config.rows, [&]() {
+            streams::MappedFile file;
+            file.open(path);
+            streams::LineView line;
+            size_t bytes = 0;
+            while (file.read_line(line)) bytes += line.length;
+            do_not_optimize(bytes);
+        });
+
+        unlink(path);
+    }
+
+    void serialization_benchmarks(Runner& runner) {
+        const Config& config = runner.config();
+        const size_t messages = 1000;
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+            throw std::ios_base::failure("error encountered while creating socketpair, errno: " + std::to_string(errno));
+        }
+
+        SocketPairStream a{fds[0]};
+        SocketPairStream b{fds[1]};
+        streams::Serializer sender;
+        streams::Serializer receiver;
+        sender(&a);
+        receiver(&b);
+
+        Generator generator{config.dims, config.classes, config.seed};
+        std::string line = generator.line(true);
+        std::unique_ptr<knn::CartDataPoint<double>> point{generator.point(true)};
+
+        runner.run("serialization/string", param("bytes", line.size()), messages, [&]() {
+            std::string received;
+            for (size_t i = 0; i < messages; i++) {
+                sender << line;
+                receiver >> received;
+            }
+            do_not_optimize(received);
+        });
+
+        runner.run("serialization/cart_data_point", param("dims", config.dims), messages, [&]() {
+            knn::CartDataPoint<double> received;
+            for (size_t i = 0; i < messages; i++) {
+                sender << *point;
+                receiver >> received;
+            }
+            do_not_optimize(received);
+        });
+
+        runner.run("serialization/round_trip", param("bytes", line.size()), messages, [&]() {
+            std::string received;
+            for (size_t i = 0; i < messages; i++) {
+                sender << line;
+                receiver >> received;
+                receiver << received;
+                sender >> received;
+            }
+            do_not_optimize(received);
+        });
+
+        /* A whole Data Set doesn't fit in the socketpair's buffer, so it is sent from another thread */
+        std::unique_ptr<dubdset> dataset{generator.dataset(config.rows)};
+        runner.run("serialization/dataset_points", param("rows", config.rows), config.rows, [&]() {
+            std::thread sending([&]() {
+                for (const knn::DataPoint<misc::array<double>>* p : dataset->get_data()) {
+                    sender << *(const knn::CartDataPoint<double>*)p;
+                }
+            });
+            dubdset received;
+            for (size_t i = 0; i < config.rows; i++) {
+                knn::CartDataPoint<double> p;
+                receiver >> p;
+                received.add(&p);
+            }
+            sending.join();
+            do_not_optimize(received);
+        });
+
+        runner.run("serialization/dataset_bulk", param("rows", config.rows), config.rows, [&]() {
+            std::thread sending([&]() { sender << *dataset; });
+            dubdset received;
+            receiver >> received;
+            sending.join();
+            do_not_optimize(received);
+        });
+
+        a.close();
+        b.close();
+    }
+
+    void transport_benchmarks(Runner& runner) {
+        std::string path = "/tmp/knnbench-" + std::to_string(getpid()) + ".sock";
+        streams::UnixSocket listener;
+        listener.bind_to(path);
+        listener.listening(1);
+
+        {
+            streams::UnixSocket client{path};
+            streams::UnixSocket server = listener.accept_connection();
+            transport_benchmark(runner, "unix", client, server);
+        }
+
+        {
+            std::unique_ptr<streams::SharedMemoryStream> client;
+            std::thread connecting([&]() { client.reset(new streams::SharedMemoryStream(path)); });
+            streams::SharedMemoryStream server{listener.accept_connection()};
+            connecting.join();
+            transport_benchmark(runner, "shm", *client, server);
+        }
+
+        listener.close();
+        unlink(path.c_str());
+
+        /* Over loopback, on the first free port from an arbitrary one */
+        for (int port = 47000; port < 47100; port++) {
+            try {
+                streams::TCPSocket tcp_listener{"127.0.0.1", port};
+                tcp_listener.listening(1);
+                streams::TCPSocket client{"127.0.0.1", 0, "127.0.0.1", port};
+                streams::TCPSocket server = tcp_listener.accept_connection();
+                tcp_listener.close();
+                transport_benchmark(runner, "tcp", client, server);
+                break;
+            } catch (std::ios_base::failure& e) { }
+        }
+    }
+
+    void sparse_benchmarks(Runner& runner) {
+        const Config& config = runner.config();
+        const size_t queries = 20;
+        const int k = 5;
+        const size_t dims = 5000;
+        const size_t nnz = 50;
+        const size_t rows = config.rows / 5;
+
+        /* Points with nnz nonzero features at random indices, stored both densely and sparsely */
+        std::mt19937 random{config.seed};
+        std::uniform_int_distribution<uint32_t> index(0, dims - 1);
+        std::uniform_real_distribution<double> value(-1, 1);
+        auto generate = [&]() {
+            std::set<uint32_t> indices;
+            while (indices.size() < nnz) indices.insert(index(random));
+
+            knn::SparseVector point;
+            for (uint32_t i : indices) {
+                point.indices.push_back(i);
+                point.values.push_back(value(random));
+            }
+            return point;
+        };
+
+        dubdset* dense_set = new dubdset();
+        knn::SparseDataSet* sparse_set = new knn::SparseDataSet();
+        for (size_t i = 0; i < rows; i++) {
+            knn::SparseVector point = generate();
+            std::string class_name = "class" + std::to_string(i % config.classes);
+            dense_set->adopt(new knn::CartDataPoint<double>(class_name, point.dense(dims)));
+            sparse_set->add(class_name, point);
+        }
+        knn::TypedFeatureSet<double> dense{dense_set};
+        knn::SparseFeatureSet sparse{sparse_set};
+
+        std::vector<knn::SparseVector> sparse_points;
+        std::vector<std::unique_ptr<knn::CartDataPoint<double>>> dense_points;
+        for (size_t i = 0; i < queries; i++) {
+            sparse_points.push_back(generate());
+            dense_points.emplace_back(new knn::CartDataPoint<double>(sparse_points.back().dense(dims)));
+        }
+
+        std::string params = param("rows", rows) + ", " + param("dims", dims) + ", " + param("nnz", nnz) + ", " +
+            param("k", k);
+
+        /* A scan of every feature, against a merge of the nonzeros */
+        runner.run("sparse/dense_classify", params + ", " + param("bytes", dense.memory_usage()), queries, [&]() {
+            for (auto& p : dense_points) do_not_optimize(dense.get_nearest_class(k, p.get(), 0));
+        }, [&]() { srand(config.seed); });
+
+        runner.run("sparse/classify", params + ", " + param("bytes", sparse.memory_usage()), queries, [&]() {
+            for (auto& p : sparse_points) do_not_optimize(sparse.get_nearest_class(k, p, 0));
+        });
+
+        runner.run("sparse/dense_classify_cosine", params, queries, [&]() {
+            for (auto& p : dense_points) do_not_optimize(dense.get_nearest_class(k, p.get(), distances::cosine_metric));
+        });
+
+        runner.run("sparse/classify_cosine", params, queries, [&]() {
+            for (auto& p : sparse_points) do_not_optimize(sparse.get_nearest_class(k, p, distances::cosine_metric));
+        });
+
+        runner.run("sparse/all_nearest_indices", params, queries, [&]() {
+            for (auto& p : dense_points) do_not_optimize(sparse.get_k_nearest_indices(k, p.get()));
+        });
+    }
+
+    void thread_pool_benchmarks(Runner& runner) {
+        const size_t jobs = 100000;
+        const unsigned int threads = std::max(2u, std::thread::hardware_concurrency());
+        std::unique_ptr<threading::ThreadPool> pool;
+        std::atomic<size_t> counter{0};
+
+        runner.run("thread_pool/add_job", param("threads", threads), jobs, [&]() {
+            for (size_t i = 0; i < jobs; i++) pool->add_job(count_job, &counter);
+            while (counter.load() < jobs) std::this_thread::yield();
+        }, [&]() {
+            counter = 0;
+            pool.reset(new threading::ThreadPool(threads, nullptr, jobs));
+        }, [&]() {
+            pool->end();
+            pool.reset();
+        });
+
+        /* With a small queue, adding jobs has to back off while the threads catch up */
+        runner.run("thread_pool/add_job_backpressure", param("threads", threads) + ", " + param("capacity", 64), jobs,
+                [&]() {
+            for (size_t i = 0; i < jobs; i++) {
+                while (!pool->add_job(count_job, &counter)) std::this_thread::yield();
+            }
+            while (counter.load() < jobs) std::this_thread::yield();
+        }, [&]() {
+            counter = 0;
+            pool.reset(new threading::ThreadPool(threads, nullptr, 64));
+        }, [&]() {
+            pool->end();
+            pool.reset();
+        });
+    }
+
+    void queue_benchmarks(Runner& runner) {
+        const size_t items = 1000000;
+        const size_t expected_sum = items * (items - 1) / 2;
+        const unsigned int threads = std::max(2u, std::thread::hardware_concurrency());
+        const unsigned int producers = threads / 2;
+        const unsigned int consumers = threads - producers;
+        std::string params = param("producers", producers) + ", " + param("consumers", consumers);
+
+        runner.run("queue/mutex", params, items, [&]() {
+            MutexQueue queue;
+            do_not_optimize(transfer(queue, producers, consumers, items, nullptr));
+        });
+
+        runner.run("queue/mpmc", params + ", " + param("capacity", 1024), items, [&]() {
+            LockFreeQueue queue{1024};
+            do_not_optimize(transfer(queue, producers, consumers, items, nullptr));
+        });
+
+        /* Stress test: with a tiny ring every cell is reused many times and producers keep finding it full.
+         * Every item must come out exactly once. */
+        std::unique_ptr<std::atomic<unsigned char>[]> seen(new std::atomic<unsigned char>[items]);
+        for (unsigned int capacity : {2u, 16u}) {
+            runner.run("queue/mpmc_stress", params + ", " + param("capacity", capacity), items, [&]() {
+                LockFreeQueue queue{capacity};
+                size_t sum = transfer(queue, producers, consumers, items, seen.get());
+
+                for (size_t i = 0; i < items; i++) {
+                    if (seen[i].load() != 1) {
+                        std::cerr << "\e[31;1mqueue/mpmc_stress: item " << i << " was popped " << (int)seen[i].load()
+                            << " times\e[0m" << std::endl;
+                        std::exit(1);
+                    }
+                }
+                if (sum != expected_sum) {
+                    std::cerr << "\e[31;1mqueue/mpmc_stress: wrong sum of items\e[0m" << std::endl;
+                    std::exit(1);
+                }
+            }, [&]() {
+                for (size_t i = 0; i < items; i++) seen[i].store(0);
+            });
+        }
+    }
+}
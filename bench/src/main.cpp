@@ -0,0 +1,56 @@
+#include "bench.h"
+
+#include <iostream>
+#include <fstream>
+
+using namespace bench;
+
+int main(int argc, char** argv) {
+    Config config;
+    std::string output;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "\e[31;1mUsage:\e[0m " << argv[0] << " [--rows n] [--dims n] [--classes n] [--seed n]"
+                << " [--repeat n] [--filter name] [--output file]" << std::endl;
+            std::exit(1);
+        }
+
+        std::string value = argv[++i];
+        if (arg == "--rows") config.rows = std::stoul(value);
+        else if (arg == "--dims") config.dims = std::stoul(value);
+        else if (arg == "--classes") config.classes = std::stoul(value);
+        else if (arg == "--seed") config.seed = std::stoul(value);
+        else if (arg == "--repeat") config.repeat = std::stoul(value);
+        else if (arg == "--filter") config.filter = value;
+        else if (arg == "--output") output = value;
+        else {
+            std::cerr << "\e[31;1mUnknown option:\e[0m " << arg << std::endl;
+            std::exit(1);
+        }
+    }
+
+    /* Hardware events are counted when the kernel allows it */
+    std::string reason;
+    if (!perf::enable(reason)) std::cerr << "Hardware counters are unavailable (" << reason << "), only timing" << std::endl;
+
+    Runner runner{config};
+
+    distance_benchmarks(runner);
+    quickselect_benchmarks(runner);
+    dataset_benchmarks(runner);
+    parsing_benchmarks(runner);
+    serialization_benchmarks(runner);
+    transport_benchmarks(runner);
+    sparse_benchmarks(runner);
+    thread_pool_benchmarks(runner);
+    queue_benchmarks(runner);
+
+    if (output == "") {
+        std::cout << runner.json();
+    } else {
+        std::ofstream file(output);
+        file << runner.json();
+    }
+}
@@ -0,0 +1,145 @@
+#include "bench.h"
+
+#include <chrono>
+#include <algorithm>
+#include <iostream>
+
+namespace bench {
+    Generator::Generator(size_t dims, size_t classes, unsigned int seed) : m_random(seed), m_dims(dims) {
+        std::uniform_real_distribution<double> center(-10.0, 10.0);
+
+        this->m_centers.resize(classes);
+        for (std::vector<double>& c : this->m_centers) {
+            for (size_t i = 0; i < dims; i++) c.push_back(center(this->m_random));
+        }
+    }
+
+    std::vector<double> Generator::features(size_t& class_index) {
+        std::uniform_int_distribution<size_t> pick(0, this->m_centers.size() - 1);
+        std::normal_distribution<double> noise(0.0, 3.0);
+
+        class_index = pick(this->m_random);
+        std::vector<double> data;
+        for (size_t i = 0; i < this->m_dims; i++) {
+            data.push_back(this->m_centers[class_index][i] + noise(this->m_random));
+        }
+
+        return data;
+    }
+
+    std::string Generator::line(bool classified) {
+        size_t class_index;
+        std::vector<double> data = this->features(class_index);
+        std::string line;
+
+        for (size_t i = 0; i < data.size(); i++) {
+            if (i > 0) line += ",";
+            line += std::to_string(data[i]);
+        }
+        if (classified) line += ",class" + std::to_string(class_index);
+
+        return line;
+    }
+
+    std::vector<std::string> Generator::lines(size_t rows, bool classified) {
+        std::vector<std::string> lines;
+        for (size_t i = 0; i < rows; i++) lines.push_back(this->line(classified));
+        return lines;
+    }
+
+    knn::CartDataPoint<double>* Generator::point(bool classified) {
+        size_t class_index;
+        std::vector<double> data = this->features(class_index);
+        misc::array<double> arr(data);
+
+        if (classified) return new knn::CartDataPoint<double>("class" + std::to_string(class_index), arr);
+        return new knn::CartDataPoint<double>(arr);
+    }
+
+    dubdset* Generator::dataset(size_t rows) {
+        dubdset* dataset = new dubdset();
+
+        for (size_t i = 0; i < rows; i++) {
+            knn::CartDataPoint<double>* p = this->point(true);
+            dataset->add(p);
+            delete p;
+        }
+
+        return dataset;
+    }
+
+    void Runner::run(std::string name, std::string params, size_t ops, std::function<void()> body,
+            std::function<void()> setup, std::function<void()> teardown) {
+        if (name.find(this->m_config.filter) == std::string::npos) return;
+
+        std::vector<double> ns_per_op;
+
+        /* The hardware events of the timed runs, counted on this thread only */
+        perf::Counts counts;
+        size_t counted_runs = 0;
+
+        /* The first run only warms up */
+        for (size_t r = 0; r <= this->m_config.repeat; r++) {
+            if (setup) setup();
+
+            perf::Counts counts_start, counts_end;
+            bool counted = perf::read(counts_start);
+            auto start = std::chrono::steady_clock::now();
+            body();
+            auto end = std::chrono::steady_clock::now();
+            counted = counted && perf::read(counts_end);
+
+            if (teardown) teardown();
+
+            double ns = std::chrono::duration_cast<std::chrono::duration<double, std::nano>>(end - start).count();
+            if (r > 0) ns_per_op.push_back(ns / ops);
+            if (r > 0 && counted) {
+                counts += counts_end.since(counts_start);
+                counted_runs++;
+            }
+        }
+
+        std::sort(ns_per_op.begin(), ns_per_op.end());
+        double mean = 0;
+        for (double ns : ns_per_op) mean += ns / ns_per_op.size();
+        double median = ns_per_op.empty() ? 0 : ns_per_op[ns_per_op.size() / 2];
+        double min = ns_per_op.empty() ? 0 : ns_per_op.front();
+
+        std::string result = "{\"name\": \"" + name + "\", \"params\": {" + params + "}, \"ops\": " +
+                std::to_string(ops) + ", \"ns_per_op\": {\"min\": " + std::to_string(min) + ", \"median\": " +
+                std::to_string(median) + ", \"mean\": " + std::to_string(mean) + "}";
+
+        if (counted_runs > 0) {
+            /* Mean counts per op, over the runs which could be counted */
+            double divisor = (double)counted_runs * ops;
+            result += ", \"counters_per_op\": {";
+            for (int e = 0; e < perf::num_events; e++) {
+                result += std::string(e > 0 ? ", " : "") + "\"" + perf::event_names[e] + "\": " +
+                    std::to_string(counts.values[e] / divisor);
+            }
+            result += ", \"ipc\": " + std::to_string(counts.ipc()) + "}";
+
+            std::cerr << name << "\t" << median << " ns/op\tIPC " << counts.ipc() << ", " <<
+                counts[perf::llc_misses] / divisor << " LLC misses/op" << std::endl;
+        } else {
+            std::cerr << name << "\t" << median << " ns/op" << std::endl;
+        }
+
+        this->m_results.push_back(result + "}");
+    }
+
+    std::string Runner::json() const {
+        std::string json = "{\n  \"config\": {\"rows\": " + std::to_string(this->m_config.rows) +
+            ", \"dims\": " + std::to_string(this->m_config.dims) +
+            ", \"classes\": " + std::to_string(this->m_config.classes) +
+            ", \"seed\": " + std::to_string(this->m_config.seed) +
+            ", \"repeat\": " + std::to_string(this->m_config.repeat) +
+            ", \"counters\": " + (perf::enabled() ? "true" : "false") + "},\n  \"results\": [";
+
+        for (size_t i = 0; i < this->m_results.size(); i++) {
+            json += (i > 0 ? ",\n    " : "\n    ") + this->m_results[i];
+        }
+
+        return json + "\n  ]\n}\n";
+    }
+}
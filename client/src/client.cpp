@@ -1,21 +1,40 @@
 #include "knn.h"
 #include "serialization.h"
+#include <thread>
 
 using namespace streams;
 using namespace knn;
 
-int main(int argc, char** argv) {
-    if (argc < 3) {
-        std::cout << "\e[31;1mUsage:\e[0m " << argv[0] << " <client ip> <server ip> <server port>" << std::endl;
-        std::exit(1);
+/**
+ * Sends the lines of a file each time the server requests one, until the server ends the transfer.
+ * @param serializer        The serializer connected to the server.
+ * @param file_path         The file to send.
+ */
+void send_lines(Serializer& serializer, std::string file_path) {
+    std::ifstream file;
+    file.open(file_path);
+    SerializationTokens token;
+    serializer >> token;
+    std::string line;
+    while (token != end_token) {
+        std::getline(file, line);
+        serializer << line;
+        serializer >> token;
     }
+    file.close();
+}
 
-    TCPSocket client = TCPSocket(argv[1], 0, argv[2], strtol(argv[3], NULL, 0));
-    
+/**
+ * Runs a session with the server, until the server ends it.
+ * @param client            The connection to the server (closed at the end).
+ * @param upload_format     The format train files are uploaded in.
+ */
+void run_session(Stream* client, UploadFormat upload_format) {
     Serializer serializer;
-    serializer(&client);
+    serializer(client);
 
     SerializationTokens token;
+    std::thread streamer;
 
     while (true) {
         serializer >> token;
@@ -28,6 +47,26 @@ int main(int argc, char** argv) {
             continue;
         }
 
+        // any other token is only sent once the server has received the whole streamed file
+        if (streamer.joinable()) streamer.join();
+
+        // wants the whole file streamed, while it keeps sending output
+        if (token == stream_file_r_token) {
+            std::string file_path;
+            serializer >> file_path;
+            streamer = std::thread([file_path, serializer]() mutable {
+                std::ifstream file(file_path);
+                std::string line;
+                try {
+                    while (std::getline(file, line) && line != "") {
+                        serializer << line;
+                    }
+                    serializer << std::string("");
+                } catch (std::ios_base::failure& e) { }
+            });
+            continue;
+        }
+
         // sends string
         if (token == send_token) {
             std::string send_string;
@@ -40,16 +79,34 @@ int main(int argc, char** argv) {
         if (token == open_file_r_token) {
             std::string file_path;
             serializer >> file_path;
-            std::ifstream file;
-            file.open(file_path);
-            serializer >> token;
-            std::string line;
-            while (token != end_token) {
-                std::getline(file, line);
-                serializer << line;
-                serializer >> token;
+            send_lines(serializer, file_path);
+            continue;
+        }
+
+        // wants a train file, in the format of our choosing
+        if (token == upload_dataset_token) {
+            std::string file_path;
+            serializer >> file_path;
+            uint32_t format = upload_format;
+            little_endian(format);
+            serializer << format;
+
+            if (upload_format == text_upload || upload_format == sparse_upload) {
+                send_lines(serializer, file_path);
+                continue;
+            }
+
+            std::ifstream file(file_path);
+            auto getline = [&file](std::string& s) -> std::string {
+                if (!std::getline(file, s)) s = "";
+                return s;
+            };
+
+            try {
+                send_columns(serializer, upload_format, getline);
+            } catch (std::invalid_argument& e) {
+                std::cerr << "\e[31;1mUpload stopped:\e[0m " << e.what() << std::endl;
             }
-            file.close();
             continue;
         }
 
@@ -75,7 +132,42 @@ int main(int argc, char** argv) {
         }
     }
 
-    client.close();
+    if (streamer.joinable()) streamer.join();
+    client->close();
+}
 
+int main(int argc, char** argv) {
+    // local servers may also be reached through a Unix-domain socket, or shared memory set up over one
+    std::string transport = argc > 1 ? argv[1] : "";
+    bool local = transport == "--unix" || transport == "--shm";
+    int format_arg = local ? 3 : 4;
+
+    if (argc < format_arg) {
+        std::cout << "\e[31;1mUsage:\e[0m " << argv[0] << " <client ip> <server ip> <server port> [text|f64|f32|i16|u8|svm]" <<
+            std::endl << "       " << argv[0] << " --unix|--shm <server path> [text|f64|f32|i16|u8|svm]" << std::endl;
+        std::exit(1);
+    }
+
+    // the format train files are uploaded in
+    UploadFormat upload_format = text_upload;
+    if (argc > format_arg) {
+        try {
+            upload_format = parse_upload_format(argv[format_arg]);
+        } catch (std::invalid_argument& e) {
+            std::cout << "\e[31;1mUnknown upload format:\e[0m " << argv[format_arg] << std::endl;
+            std::exit(1);
+        }
+    }
+
+    if (transport == "--unix") {
+        UnixSocket client{std::string(argv[2])};
+        run_session(&client, upload_format);
+    } else if (transport == "--shm") {
+        SharedMemoryStream client{std::string(argv[2])};
+        run_session(&client, upload_format);
+    } else {
+        TCPSocket client = TCPSocket(argv[1], 0, argv[2], strtol(argv[3], NULL, 0));
+        run_session(&client, upload_format);
+    }
 }
 
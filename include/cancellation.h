@@ -0,0 +1,112 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+
+namespace cancellation {
+    /**
+     * Thrown by check when the work of the calling thread was cancelled or outlived its deadline.
+     */
+    class Cancelled : public std::runtime_error {
+        public:
+            Cancelled(const std::string& reason) : std::runtime_error(reason) { }
+    };
+
+    /**
+     * Cancels the work of a session cooperatively: the threads working for the session attach to its token, and
+     * long loops call check, which throws Cancelled once the token is cancelled (eg. because the peer hung up)
+     * or its deadline passed.
+     * Cancelling is final, while deadlines are set and cleared around every command.
+     */
+    class Token {
+        std::atomic<bool> m_cancelled;
+        std::atomic<int64_t> m_deadline;        // In nanoseconds of the steady clock, 0 if there is none
+        mutable std::mutex m_mutex;
+        std::string m_reason;
+
+        public:
+            Token() : m_cancelled(false), m_deadline(0) { }
+
+            Token(const Token&) = delete;
+            Token& operator=(const Token&) = delete;
+
+            /**
+             * Cancels the token, the first reason given is kept.
+             * @param reason        Why the work was cancelled (eg. "client disconnected").
+             */
+            void cancel(const std::string& reason);
+
+            bool cancelled() const { return this->m_cancelled.load(std::memory_order_acquire); }
+
+            /**
+             * @return The reason the token was cancelled with, or "" if it wasn't.
+             */
+            std::string reason() const;
+
+            void set_deadline(std::chrono::steady_clock::time_point deadline) {
+                this->m_deadline.store(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            deadline.time_since_epoch()).count(), std::memory_order_relaxed);
+            }
+
+            void clear_deadline() { this->m_deadline.store(0, std::memory_order_relaxed); }
+
+            /**
+             * @throws          Cancelled if the token was cancelled or its deadline passed.
+             */
+            void check() const;
+    };
+
+    /**
+     * The token of the calling thread, or null if its work can't be cancelled.
+     */
+    extern thread_local Token* t_token;
+
+    inline Token* current() { return t_token; }
+
+    /**
+     * Attaches the calling thread to a token for the attachment's lifetime (like tracing::Attach).
+     * Attaching to a null token leaves the thread's work uncancellable.
+     */
+    class Attach {
+        Token* m_previous;
+
+        public:
+            Attach(Token* token) : m_previous(t_token) { t_token = token; }
+            ~Attach() { t_token = this->m_previous; }
+    };
+
+    /**
+     * Sets the deadline of the calling thread's token for the scope's lifetime.
+     * A zero timeout (or a thread without a token) sets no deadline.
+     */
+    class Deadline {
+        Token* m_token;
+
+        public:
+            Deadline(std::chrono::milliseconds timeout) : m_token(timeout.count() > 0 ? t_token : nullptr) {
+                if (this->m_token != nullptr) this->m_token->set_deadline(std::chrono::steady_clock::now() + timeout);
+            }
+
+            ~Deadline() {
+                if (this->m_token != nullptr) this->m_token->clear_deadline();
+            }
+    };
+
+    /**
+     * Checks the token of the calling thread, if it has one.
+     * @throws          Cancelled if the token was cancelled or its deadline passed.
+     */
+    inline void check() {
+        if (t_token != nullptr) t_token->check();
+    }
+
+    /**
+     * How many iterations scan loops run between checks. Checking reads the clock (when there's a deadline), so
+     * it is amortized over many distances.
+     */
+    const size_t check_interval = 1024;
+}
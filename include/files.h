@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstring>
+#include <ios>
+#include <string>
+
+namespace streams {
+    /**
+     * A line of a mapped file, which points into the mapping (and is valid only as long as it).
+     * The line doesn't include its newline.
+     */
+    struct LineView {
+        const char* data;
+        size_t length;
+
+        std::string str() const { return std::string(this->data, this->length); }
+    };
+
+    /**
+     * A file mapped into memory for reading its lines sequentially, without copying them.
+     */
+    class MappedFile {
+        const char* m_data;
+        size_t m_size;
+        size_t m_offset;
+
+        public:
+            MappedFile() : m_data(nullptr), m_size(0), m_offset(0) { }
+            ~MappedFile() { this->close(); }
+
+            MappedFile(const MappedFile&) = delete;
+            MappedFile& operator=(const MappedFile&) = delete;
+
+            /**
+             * Maps a file (closing the file mapped before, if any).
+             * @param filename      The file's path.
+             * @throws              std::ios_base::failure if the file can't be opened or mapped.
+             */
+            void open(const std::string& filename);
+
+            /**
+             * Reads the next line, as std::getline would (the last line needn't end with a newline).
+             * @param line          Set to the line.
+             * @return              Whether there was a line left.
+             */
+            bool read_line(LineView& line) {
+                if (this->m_offset >= this->m_size) return false;
+
+                const char* start = this->m_data + this->m_offset;
+                size_t left = this->m_size - this->m_offset;
+                const char* end = (const char*)memchr(start, '\n', left);
+                line.data = start;
+                line.length = end != nullptr ? end - start : left;
+                this->m_offset += line.length + 1;
+                return true;
+            }
+
+            /**
+             * Unmaps the file.
+             */
+            void close();
+
+            bool is_open() const { return this->m_data != nullptr; }
+            size_t size() const { return this->m_size; }
+    };
+
+    /**
+     * A file written through a large page-aligned buffer, so it is written in few large writes however small the
+     * pieces written to it are.
+     */
+    class FileWriter {
+        int m_fd;
+        char* m_buffer;
+        size_t m_used;
+
+        public:
+            static const size_t buffer_size = 1 << 20;
+
+            FileWriter() : m_fd(-1), m_buffer(nullptr), m_used(0) { }
+            ~FileWriter();
+
+            FileWriter(const FileWriter&) = delete;
+            FileWriter& operator=(const FileWriter&) = delete;
+
+            /**
+             * Creates (or truncates) a file for writing, closing the file opened before, if any.
+             * @param filename      The file's path.
+             * @throws              std::ios_base::failure if the file can't be created.
+             */
+            void open(const std::string& filename);
+
+            /**
+             * Writes to the file (which is written to only when the buffer fills up, or on flush).
+             * Pieces larger than the buffer are written directly.
+             * @throws              std::ios_base::failure if writing fails.
+             */
+            void write(const char* data, size_t size);
+            void write(const std::string& s) { this->write(s.data(), s.size()); }
+
+            /**
+             * Writes the buffered data to the file.
+             * @throws              std::ios_base::failure if writing fails.
+             */
+            void flush();
+
+            /**
+             * Flushes and closes the file.
+             * @throws              std::ios_base::failure if the last write fails (the file is closed anyway).
+             */
+            void close();
+
+            bool is_open() const { return this->m_fd >= 0; }
+    };
+}
@@ -39,6 +39,7 @@ namespace knn {
      */
     template <typename T>
     std::vector<T> quickselect(const std::vector<T>& vec, int k) {
+        tracing::Span span{"quickselect", "knn"};
         std::vector<T> new_vec = vec;
         int l = 0;
         int h = new_vec.size() - 1;
@@ -53,5 +54,54 @@ namespace knn {
             else l = pi + 1;
         }
     }
+
+    /**
+     * Gets the most common class among neighbors, breaking ties by the nearest neighbor.
+     * @param voters        The number of neighbors, sorted from nearest to farthest.
+     * @param class_of      Gets the class of the j-th neighbor.
+     */
+    template <typename F>
+    std::string vote_classes(size_t voters, F class_of) {
+        std::unordered_map<std::string, int> classes;
+        for (size_t j = 0; j < voters; j++) classes[class_of(j)]++;
+
+        int max_count = 0;
+        std::string max_string;
+
+        /* Go over the neighbors in order so ties are broken by the nearest neighbor */
+        for (size_t j = 0; j < voters; j++) {
+            std::string class_name = class_of(j);
+            if (classes[class_name] > max_count) {
+                max_string = class_name;
+                max_count = classes[class_name];
+            }
+        }
+
+        return max_string;
+    }
+
+    /**
+     * Gets the most common class among neighbors, counted in a map, so ties are broken by the order of the map (as
+     * DataSet::get_nearest_class breaks them).
+     * @param voters        The number of neighbors.
+     * @param class_of      Gets the class of the j-th neighbor.
+     */
+    template <typename F>
+    std::string tally_classes(size_t voters, F class_of) {
+        std::unordered_map<std::string, int> classes;
+        for (size_t j = 0; j < voters; j++) classes[class_of(j)]++;
+
+        int max_count = 0;
+        std::string max_string;
+
+        for (auto entry : classes) {
+            if (entry.second > max_count) {
+                max_string = entry.first;
+                max_count = entry.second;
+            }
+        }
+
+        return max_string;
+    }
 } // knn
 
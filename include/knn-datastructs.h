@@ -1,6 +1,7 @@
 #pragma once
 
 #include "knn.h"
+#include <queue>
 
 namespace knn {
     /**
@@ -26,6 +27,11 @@ namespace knn {
 
             virtual DataPoint<T>* clone() const =0;
 
+            /**
+             * @return The number of bytes used by the Data Point (including the memory it points to).
+             */
+            virtual size_t memory_usage() const =0;
+
             virtual bool operator==(const DataPoint<T>& other) const { return other.data() == this->data(); }
     };
 
@@ -53,11 +59,11 @@ namespace knn {
                 other.m_data = nullptr;
             }
             
-            CartDataPoint(const misc::array<T> data) :
-                m_data(data), m_class_name() {}
+            CartDataPoint(misc::array<T> data) :
+                m_data(std::move(data)), m_class_name() {}
 
-            CartDataPoint(std::string class_name, const misc::array<T> data) :
-                m_data(data), m_class_name(class_name) {}
+            CartDataPoint(std::string class_name, misc::array<T> data) :
+                m_data(std::move(data)), m_class_name(std::move(class_name)) {}
 
             ~CartDataPoint() { }
 
@@ -69,6 +75,10 @@ namespace knn {
 
             const misc::array<T>& data() const override { return this->m_data; }
 
+            size_t memory_usage() const override {
+                return sizeof(*this) + this->m_data.length() * sizeof(T) + accounting::heap_usage(this->m_class_name);
+            }
+
             template <typename M>
             friend streams::Serializer& operator<<(streams::Serializer& s, const CartDataPoint<M>& cdp);
             template <typename M>
@@ -91,16 +101,18 @@ namespace knn {
     template <typename T>
     class DataSet {
         std::vector<DataPoint<T>*> m_data;
+        std::unordered_multimap<uint64_t, int> m_index;     // The indices of the Data Points by the hash of their data
+        bool m_indexed;
 
         public:
             /**
              * Default constructor for DataSet.
              */
-            DataSet() {}
+            DataSet() : m_indexed(false) {}
 
-            DataSet(std::vector<DataPoint<T>*>& vec) : m_data(vec) { }
+            DataSet(std::vector<DataPoint<T>*>& vec) : m_data(vec), m_indexed(false) { }
 
-            DataSet(std::vector<DataPoint<T>*>&& vec) : m_data(vec) { }
+            DataSet(std::vector<DataPoint<T>*>&& vec) : m_data(vec), m_indexed(false) { }
 
             ~DataSet() {
                 for (size_t i = 0; i < this->m_data.size(); i++) {
@@ -115,12 +127,28 @@ namespace knn {
              */
             DataSet& add(const DataPoint<T>* data_point);
 
-            std::string get_class(const DataPoint<T>* data_point) const {
-                for (DataPoint<T>* dp : this->m_data) {
-                    if (*dp == *data_point)  return dp->class_type();
-                }
-                return "";
-            }
+            /**
+             * Add a Data Point to the Data Set without copying it.
+             * @param data_point        The point to add, which is owned (and deleted) by the Data Set.
+             * @return                  A reference to this Data Set.
+             */
+            DataSet& adopt(DataPoint<T>* data_point);
+
+            /**
+             * Indexes the Data Points by a hash of their data (see misc::hash), so get_class finds exact matches
+             * without scanning the Data Set. Data Points added later are indexed as they are added.
+             */
+            void build_index();
+
+            bool indexed() const { return this->m_indexed; }
+
+            /**
+             * Gets the class of the first Data Point equal to a given one, in constant expected time if the Data Set
+             * is indexed (by a scan otherwise).
+             * @param data_point    The Data Point to look for.
+             * @return              The class of the equal Data Point, "" if there is none.
+             */
+            std::string get_class(const DataPoint<T>* data_point) const;
             
             /**
              * Gets the k-nearest neighbors to another input Data Point.
@@ -128,6 +156,7 @@ namespace knn {
              * @param p             The point to find the nearest neighbors to.
              * @param distance      A function for computing distances between Data Points.
              * @return              An array whose first k elements are the closest neighbors to p.
+             * @note                Scans of large Data Sets are split across threads (see parallel::partitions).
              */
             template <typename M>
             DataPoint<T>** get_k_nearest(int k, const DataPoint<T>* p, M (*distance)(const DataPoint<T>*, const DataPoint<T>*)) const;
@@ -142,7 +171,63 @@ namespace knn {
             template <typename M>
             std::string get_nearest_class(int k, const DataPoint<T>* p, M (*distance)(const DataPoint<T>*, const DataPoint<T>*)) const;
 
-            const std::vector<DataPoint<T>*>& get_data() { return this->m_data; }
+            /**
+             * Gets the k-nearest neighbors to an input Data Point relative to several distance metrics at once,
+             * computing every metric in a single pass over the Data Set.
+             * @param k             The k-value to run the algorithm on.
+             * @param p             The point to find the nearest neighbors to.
+             * @param distances     A function computing the distances between two Data Points relative to every
+             *                      metric, writing them into its output array.
+             * @param num_metrics   The number of metrics computed by distances.
+             * @param exclude       The index of a Data Point to skip (for leave-one-out), -1 to skip none.
+             * @return              For every metric, the indices of the (at most) k closest neighbors to p,
+             *                      sorted from nearest to farthest.
+             */
+            template <typename M>
+            std::vector<std::vector<int>> get_k_nearest_indices(int k, const DataPoint<T>* p,
+                    void (*distances)(const DataPoint<T>*, const DataPoint<T>*, M*), size_t num_metrics, int exclude=-1) const;
+
+            /**
+             * Gets the k-nearest neighbors relative to several distance metrics at once, given the distances of
+             * every Data Point from the query (so they may use information cached per Data Point).
+             * @param k             The k-value to run the algorithm on.
+             * @param distances     A function called as distances(i, out) which writes the distances of the i-th
+             *                      Data Point relative to every metric into out.
+             * @param num_metrics   The number of metrics computed by distances.
+             * @param exclude       The index of a Data Point to skip (for leave-one-out), -1 to skip none.
+             * @return              For every metric, the indices of the (at most) k closest neighbors,
+             *                      sorted from nearest to farthest.
+             * @throws              cancellation::Cancelled if the calling thread's work is cancelled during the scan.
+             * @note                Scans of large Data Sets are split across threads (see parallel::partitions), so
+             *                      distances may be called concurrently.
+             */
+            template <typename M, typename D>
+            std::vector<std::vector<int>> select_k_nearest(int k, D distances, size_t num_metrics, int exclude=-1) const;
+
+            /**
+             * Gets the most common class among the first k of a list of neighbors.
+             * @param indices       Indices of Data Points, sorted from nearest to farthest.
+             * @param k             The number of neighbors which vote.
+             * @return              The name of the most common class. Ties go to the class of the nearer neighbor.
+             */
+            std::string vote(const std::vector<int>& indices, int k) const;
+
+            size_t size() const { return this->m_data.size(); }
+
+            /**
+             * @return The number of bytes used by the Data Set and its Data Points.
+             */
+            size_t memory_usage() const {
+                size_t bytes = sizeof(*this) + this->m_data.capacity() * sizeof(DataPoint<T>*);
+                for (const DataPoint<T>* dp : this->m_data) bytes += dp->memory_usage();
+
+                /* Every entry of the index is a node holding its hash, and every bucket a pointer */
+                bytes += this->m_index.size() * (sizeof(std::pair<const uint64_t, int>) + sizeof(void*) + sizeof(size_t)) +
+                    this->m_index.bucket_count() * sizeof(void*);
+                return bytes;
+            }
+
+            const std::vector<DataPoint<T>*>& get_data() const { return this->m_data; }
 
         private:
             /**
@@ -159,24 +244,54 @@ namespace knn {
             };
 
             /**
-             * Transforms the vector of Data Points to a vector of Distance Points.
+             * Transforms a range of the vector of Data Points to a vector of Distance Points.
              * @param p             The point to find the distance relative to.
              * @param distance      The distance function.
+             * @param begin, end    The range of Data Points.
              * @return              A vector of all the distances.
+             * @throws              cancellation::Cancelled if the calling thread's work is cancelled during the scan.
              */
             template <typename M>
-            std::vector<DistancePoint<M>> transform_data(const DataPoint<T>* p, M (*distance)(const DataPoint<T>*, const DataPoint<T>*)) const {
+            std::vector<DistancePoint<M>> transform_data(const DataPoint<T>* p, M (*distance)(const DataPoint<T>*, const DataPoint<T>*),
+                    size_t begin, size_t end) const {
+               tracing::Span span{"transform_data", "knn"};
                std::vector<DistancePoint<M>> distances;
-               int i = 0;
+               distances.reserve(end - begin);
 
-               for (const DataPoint<T>* dp : this->m_data) {
-                   distances.push_back(DistancePoint<M>(i, distance(p, dp)));
-                   i++;
+               for (size_t i = begin; i < end; i++) {
+                   if ((i - begin) % cancellation::check_interval == 0) cancellation::check();
+                   distances.push_back(DistancePoint<M>(i, distance(p, this->m_data[i])));
                }
 
                return distances;
             }
+
+            /**
+             * Scans the Data Points in [begin, end) for the k nearest relative to several metrics at once (see
+             * select_k_nearest).
+             * @return              For every metric, a max-heap of the (at most) k nearest.
+             * @throws              cancellation::Cancelled if the calling thread's work is cancelled during the scan.
+             */
+            template <typename M, typename D>
+            std::vector<std::priority_queue<DistancePoint<M>>> scan_k_nearest(int k, D& distances, size_t num_metrics,
+                    int exclude, size_t begin, size_t end) const;
     };
+
+    /**
+     * Serializes a Data Set of Cartesian Data Points: the number of points and of features, a dictionary of the
+     * class names followed by the index of every point's class in it, and then the features of every point as a
+     * single contiguous payload of T's.
+     * @throws              std::invalid_argument if the points have different numbers of features.
+     */
+    template <typename T>
+    streams::Serializer& operator<<(streams::Serializer& s, const DataSet<misc::array<T>>& data_set);
+
+    /**
+     * Deserializes a Data Set of Cartesian Data Points, adding the points to data_set. The features of every point
+     * are received straight into the point.
+     */
+    template <typename T>
+    streams::Serializer& operator>>(streams::Serializer& s, DataSet<misc::array<T>>& data_set);
 }
 
 #include "knn-datastructs.tpp"
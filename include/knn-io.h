@@ -2,6 +2,7 @@
 
 #include "knn.h"
 #include <functional>
+#include <cstdint>
 
 namespace knn {
     /**
@@ -13,20 +14,6 @@ namespace knn {
     template <typename T>
     CartDataPoint<T>* get_point(std::string str, T (*converter)(std::string), bool classified);
 
-    /**
-     * Classifies points relative to different distances.
-     * @param classified            File name of classified points to initialize a Data Set with.
-     * @param unclassified          File name of unclassified points to classify.
-     * @param k                     The k to use in quickselect.
-     * @param converter             Converter from string to correct datatype (T).
-     * @param output_names          Names of output files.
-     * @param distances             Array of distance functions.
-     */
-    template <typename T, typename M>
-    void all_distances(std::string classified, std::string unclassified, int k,
-            T (*converter)(std::string), misc::array<std::string> output_names,
-            misc::array<M (*)(const DataPoint<misc::array<T>>*, const DataPoint<misc::array<T>>*)> distances);
-
     /**
      * Reads in a Cartesian Data Point from an input file stream.
      * @param input_stream      The input stream.
@@ -41,10 +28,90 @@ namespace knn {
     /**
      * Initializes a Data Set from an input file stream.
      * @param getline           A function for receiving a line of input.
+     * @param reserve           If given, called with the number of bytes of every point before it is added to the
+     *                          Data Set. It may throw to stop reading (the Data Set is then deleted).
+     * @param divert            If given, every point is passed to it instead of being added to the Data Set (which
+     *                          is then returned empty, and reserve isn't called). It may throw to stop reading.
      * @return                  A Data Set of Cartesian Data Points read from the stream.
      */
     template <typename T>
-    DataSet<misc::array<T>>* initialize_dataset(std::function<std::string(std::string&)> getline, T (*converter)(std::string));
+    DataSet<misc::array<T>>* initialize_dataset(std::function<std::string(std::string&)> getline, T (*converter)(std::string),
+            std::function<void(size_t)> reserve=nullptr, std::function<void(const CartDataPoint<T>&)> divert=nullptr);
+
+    /**
+     * Formats in which a classified csv file can be uploaded.
+     * The binary formats are sent as blocks of columns (see send_columns). The sparse format is sent line by line,
+     * as the text format is, but its lines are sparse points in libsvm format (see parse_sparse_point).
+     */
+    enum UploadFormat : uint32_t { text_upload, float64_upload, float32_upload, int16_upload, uint8_upload, sparse_upload };
+
+    /**
+     * Parses the name of an upload format: text, f64, f32, i16, u8 or svm.
+     * @throws                  std::invalid_argument if there is no such format.
+     */
+    UploadFormat parse_upload_format(const std::string& name);
+
+    /**
+     * @return                  The name of the feature type F (f64, f32, i16 or u8).
+     */
+    template <typename F>
+    const char* feature_name();
+
+    /**
+     * Converts a value to a feature of type F.
+     * @throws                  std::invalid_argument if F is an integer type and the value is not an integer in its range.
+     */
+    template <typename F>
+    F to_feature(double value);
+
+    /**
+     * Parses a feature of type F (a converter for get_point and read_point).
+     * @throws                  std::invalid_argument if the string isn't a number or doesn't fit in F.
+     */
+    template <typename F>
+    F parse_feature(std::string s);
+
+    /* The largest payload (columns and label indices) of a block of columns, which the recipient allocates */
+    static const size_t max_block_bytes = 1 << 20;
+
+    /**
+     * Parses a classified csv file and sends it as blocks of packed little-endian columns.
+     * Every block consists of its number of rows, its number of columns, the labels first seen in the block,
+     * every column as a packed array of F's, and for every row the index of its label in the dictionary of
+     * labels sent so far. A block of zero rows ends the upload.
+     * @param s                 The serializer to send through.
+     * @param getline           A function for receiving a line of input.
+     * @param block_rows        The maximal number of rows in a block (fewer if they'd exceed max_block_bytes).
+     * @throws                  std::invalid_argument if a line's number of fields differs from the first line's,
+     *                          one of its values isn't a valid F, or a single row exceeds max_block_bytes. The upload
+     *                          is ended before throwing.
+     */
+    template <typename F>
+    void send_columns(streams::Serializer& s, std::function<std::string(std::string&)> getline, size_t block_rows=4096);
+
+    /**
+     * Sends a classified csv file in one of the binary upload formats (see send_columns<F>).
+     * @throws                  std::invalid_argument if a line is malformed (the upload is ended before throwing),
+     *                          or if the format is not binary.
+     */
+    void send_columns(streams::Serializer& s, UploadFormat format, std::function<std::string(std::string&)> getline,
+            size_t block_rows=4096);
+
+    /**
+     * Receives a Data Set sent by send_columns.
+     * @param s                 The serializer to receive from.
+     * @param reserve           If given, called with the number of bytes of every label, and of every block's points
+     *                          before the block is received. If it throws, the rest of the upload is received and
+     *                          discarded, and then the exception is rethrown (the Data Set is deleted).
+     * @param divert            If given, every point is passed to it instead of being added to the Data Set (which
+     *                          is then returned empty, and reserve isn't called). If it throws, the upload is
+     *                          discarded as if reserve had.
+     * @return                  A Data Set of Cartesian Data Points, whose data is converted from F to T.
+     * @throws                  std::ios_base::failure if a block is malformed or exceeds max_block_bytes.
+     */
+    template <typename T, typename F>
+    DataSet<misc::array<T>>* receive_columns(streams::Serializer& s, std::function<void(size_t)> reserve=nullptr,
+            std::function<void(const CartDataPoint<T>&)> divert=nullptr);
 }
 
 #include "knn-io.tpp"
@@ -10,9 +10,16 @@
 #include <ios>
 
 #include "misc.h"
+#include "metrics.h"
+#include "tracing.h"
+#include "cancellation.h"
+#include "perf.h"
+#include "parallel.h"
+#include "memory-accounting.h"
 #include "streams.h"
 #include "knn-algo.h"
 #include "knn-datastructs.h"
 #include "knn-io.h"
+#include "sparse.h"
 #include "serialization.h"
 
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <atomic>
+#include <stdexcept>
+#include <string>
+
+namespace accounting {
+    /**
+     * Thrown when charging memory would exceed a quota. Nothing is charged when it is thrown.
+     */
+    class QuotaExceeded : public std::runtime_error {
+        public:
+            QuotaExceeded(const std::string& what) : std::runtime_error(what) { }
+    };
+
+    /**
+     * The kinds of memory charged to accounts.
+     */
+    enum Kind { dataset_memory, index_memory, result_memory, num_kinds };
+
+    /**
+     * A limited amount of memory shared by many accounts (the memory of the whole server).
+     */
+    class Budget {
+        std::atomic<size_t> m_used[num_kinds];
+        std::atomic<size_t> m_total;
+        std::atomic<size_t> m_limit;
+
+        public:
+            Budget(size_t limit=0);
+
+            /**
+             * @param limit     The number of bytes which may be reserved, 0 for no limit.
+             */
+            void set_limit(size_t limit) { this->m_limit.store(limit); }
+            size_t limit() const { return this->m_limit.load(); }
+
+            /**
+             * Reserves memory.
+             * @throws QuotaExceeded if the reservation would exceed the limit.
+             */
+            void reserve(Kind kind, size_t bytes);
+            void release(Kind kind, size_t bytes);
+
+            size_t used(Kind kind) const { return this->m_used[kind].load(); }
+            size_t used() const { return this->m_total.load(); }
+    };
+
+    /**
+     * @return The budget of the whole process.
+     */
+    Budget& global_budget();
+
+    /**
+     * Sets/gets the quota of every account created afterwards (0 for no quota).
+     */
+    void set_session_limit(size_t limit);
+    size_t session_limit();
+
+    /**
+     * The memory used by a single session. Memory charged to an account is also reserved from the global budget,
+     * and whatever is still charged when the account is destroyed is released.
+     */
+    class Account {
+        Budget& m_budget;
+        size_t m_limit;
+        std::atomic<size_t> m_used[num_kinds];
+
+        public:
+            /**
+             * @param budget    The budget the account's memory is reserved from.
+             * @param limit     The number of bytes which may be charged to the account, 0 for no limit.
+             */
+            Account(Budget& budget=global_budget(), size_t limit=session_limit());
+            ~Account();
+
+            Account(const Account&) = delete;
+            Account& operator=(const Account&) = delete;
+
+            /**
+             * Charges memory to the account.
+             * @throws QuotaExceeded if the charge would exceed the account's quota or the budget's limit.
+             */
+            void charge(Kind kind, size_t bytes);
+            void release(Kind kind, size_t bytes);
+
+            size_t used(Kind kind) const { return this->m_used[kind].load(); }
+            size_t used() const;
+            size_t limit() const { return this->m_limit; }
+    };
+
+    /**
+     * Memory charged to an account for the lifetime of the Charge.
+     */
+    class Charge {
+        Account& m_account;
+        Kind m_kind;
+        size_t m_bytes;
+
+        public:
+            Charge(Account& account, Kind kind) : m_account(account), m_kind(kind), m_bytes(0) { }
+            ~Charge() { this->m_account.release(this->m_kind, this->m_bytes); }
+
+            Charge(const Charge&) = delete;
+            Charge& operator=(const Charge&) = delete;
+
+            void add(size_t bytes) {
+                this->m_account.charge(this->m_kind, bytes);
+                this->m_bytes += bytes;
+            }
+
+            size_t bytes() const { return this->m_bytes; }
+    };
+
+    /**
+     * @return The heap memory used by a string (0 if it fits in the string itself).
+     */
+    size_t heap_usage(const std::string& s);
+
+    /**
+     * Parses a number of bytes with an optional K, M or G suffix (eg. "512M").
+     * @throws std::invalid_argument if the size is malformed.
+     */
+    size_t parse_size(const std::string& size);
+}
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace metrics {
+    /**
+     * The number of shards of every counter and histogram.
+     * Every thread updates its own shard, so threads rarely contend on the same cache line.
+     */
+    const size_t num_shards = 16;
+
+    /**
+     * @return The shard of the calling thread.
+     */
+    size_t thread_shard();
+
+    /**
+     * Monotonically increasing counter, sharded per thread.
+     */
+    class Counter {
+        /* Padded to a cache line */
+        struct Shard {
+            std::atomic<uint64_t> value;
+            char padding[64 - sizeof(std::atomic<uint64_t>)];
+        };
+
+        Shard m_shards[num_shards];
+
+        public:
+            Counter();
+
+            void add(uint64_t n=1) { this->m_shards[thread_shard()].value.fetch_add(n, std::memory_order_relaxed); }
+
+            /**
+             * @return The sum of all of the shards.
+             */
+            uint64_t value() const;
+    };
+
+    /**
+     * Value which may go up and down (sizes, depths of queues etc).
+     */
+    class Gauge {
+        std::atomic<int64_t> m_value;
+
+        public:
+            Gauge() : m_value(0) { }
+
+            void add(int64_t n=1) { this->m_value.fetch_add(n, std::memory_order_relaxed); }
+            void sub(int64_t n=1) { this->m_value.fetch_sub(n, std::memory_order_relaxed); }
+            void set(int64_t n) { this->m_value.store(n, std::memory_order_relaxed); }
+            int64_t value() const { return this->m_value.load(std::memory_order_relaxed); }
+    };
+
+    /**
+     * Histogram of non-negative integers (durations in nanoseconds, sizes in bytes etc), sharded per thread.
+     * Like an HDR histogram, values are counted in log-linear buckets: every power of two is split into
+     * 2^sub_bits buckets, so every value is recorded with a relative error of at most 2^-sub_bits.
+     */
+    class Histogram {
+        public:
+            static const int sub_bits = 3;
+            static const size_t sub_count = 1 << sub_bits;
+            static const size_t num_buckets = (64 - sub_bits + 1) * sub_count;
+
+            Histogram();
+
+            void record(uint64_t value);
+
+            /**
+             * A merged view of all of the shards.
+             */
+            struct Snapshot {
+                std::vector<uint64_t> buckets;
+                uint64_t count;
+                uint64_t sum;
+
+                /**
+                 * @param q     The quantile, between 0 and 1.
+                 * @return      An approximation of the quantile (the midpoint of its bucket).
+                 */
+                uint64_t quantile(double q) const;
+            };
+
+            Snapshot snapshot() const;
+
+            /**
+             * @return The index of the bucket of a value.
+             */
+            static size_t bucket(uint64_t value);
+
+            /**
+             * @return The smallest value of a bucket.
+             */
+            static uint64_t bucket_start(size_t bucket);
+
+        private:
+            struct Shard {
+                std::atomic<uint64_t> buckets[num_buckets];
+                std::atomic<uint64_t> count;
+                std::atomic<uint64_t> sum;
+            };
+
+            std::unique_ptr<Shard[]> m_shards;
+    };
+
+    /**
+     * Records the time (in nanoseconds) between its construction and destruction into a histogram.
+     */
+    class Timer {
+        Histogram& m_histogram;
+        std::chrono::steady_clock::time_point m_start;
+
+        public:
+            Timer(Histogram& histogram) : m_histogram(histogram), m_start(std::chrono::steady_clock::now()) { }
+
+            ~Timer() {
+                this->m_histogram.record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            std::chrono::steady_clock::now() - this->m_start).count());
+            }
+    };
+
+    /**
+     * Registry of named metrics.
+     * Metrics are created on their first lookup and live as long as the program, so references to them may be
+     * cached (in static variables, for example) to avoid repeated lookups on hot paths.
+     */
+    class Registry {
+        template <typename M>
+        struct Entry {
+            std::string name;
+            std::string labels;
+            std::unique_ptr<M> metric;
+        };
+
+        std::mutex m_mutex;
+        std::map<std::string, Entry<Counter>> m_counters;
+        std::map<std::string, Entry<Gauge>> m_gauges;
+        std::map<std::string, Entry<Histogram>> m_histograms;
+
+        template <typename M>
+        M& get(std::map<std::string, Entry<M>>& metrics, const std::string& name, const std::string& labels);
+
+        public:
+            /**
+             * Gets a metric, creating it if necessary.
+             * @param name      The name of the metric.
+             * @param labels    The labels of the metric in the Prometheus format (eg. command="exit").
+             */
+            Counter& counter(const std::string& name, const std::string& labels="");
+            Gauge& gauge(const std::string& name, const std::string& labels="");
+            Histogram& histogram(const std::string& name, const std::string& labels="");
+
+            /**
+             * Renders all of the metrics in the Prometheus text format.
+             * Histograms are rendered as summaries of their p50, p90, p99 and p999 quantiles.
+             */
+            std::string render();
+    };
+
+    /**
+     * @return The registry of the process.
+     */
+    Registry& registry();
+}
@@ -1,5 +1,9 @@
 #pragma once
 #include <iostream>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
 
 #include "streams.h"
 #include "serialization.h"
@@ -160,6 +164,11 @@ namespace misc {
              */
             size_t length() const { return this->m_len; }
 
+            /**
+             * @return A pointer to the contiguous elements of the array.
+             */
+            const T* data() const { return this->m_arr; }
+
             /**
              * Check if two arrays have the same length, throw an exception if they don't.
              * @param other     Another array.
@@ -183,32 +192,74 @@ namespace misc {
             }
 
             template <typename M>
-            friend streams::Serializer& operator<<(streams::Serializer& s, const array<M> arr);
+            friend streams::Serializer& operator<<(streams::Serializer& s, const array<M>& arr);
             template <typename M>
             friend streams::Serializer& operator>>(streams::Serializer& s, array<M>& arr);
     };
 
-    /** Serialization for arrays **/
+    /**
+     * Hashes bytes a word at a time.
+     * @param data      The bytes.
+     * @param size      The number of bytes.
+     * @return          The hash of the bytes.
+     */
+    inline uint64_t hash_bytes(const void* data, size_t size) {
+        const unsigned char* bytes = (const unsigned char*)data;
+        uint64_t hash = 0x9e3779b97f4a7c15ull ^ size;
+        size_t i = 0;
+        for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+            uint64_t word;
+            memcpy(&word, bytes + i, sizeof(word));
+            hash = (hash ^ word) * 0xff51afd7ed558ccdull;
+            hash ^= hash >> 32;
+        }
+
+        uint64_t tail = 0;
+        if (i < size) memcpy(&tail, bytes + i, size - i);
+        hash = (hash ^ tail) * 0xc4ceb9fe1a85ec53ull;
+        return hash ^ (hash >> 29);
+    }
+
+    /**
+     * Hashes the raw bytes of an array of an arithmetic type, so equal arrays hash equally (arrays holding NaNs are
+     * never equal anyway). Floating point zeros are hashed as +0, since -0 == +0.
+     */
     template <typename T>
-    streams::Serializer& operator<<(streams::Serializer& s, const array<T> arr) {
-        s << arr.m_len;
-        for (int i = 0; i < arr.m_len; i++) {
-            s << arr.m_arr[i];
+    uint64_t hash(const array<T>& arr) {
+        size_t i = 0;
+        if (std::is_floating_point<T>::value) {
+            while (i < arr.length() && arr.data()[i] != 0) i++;
+        } else {
+            i = arr.length();
         }
+        if (i == arr.length()) return hash_bytes(arr.data(), arr.length() * sizeof(T));
 
+        std::vector<T> canonical(arr.data(), arr.data() + arr.length());
+        for (; i < canonical.size(); i++) {
+            if (canonical[i] == 0) canonical[i] = 0;
+        }
+        return hash_bytes(canonical.data(), canonical.size() * sizeof(T));
+    }
+
+    /**
+     * Serialization for arrays: the length, followed by the elements (as one contiguous payload if they are
+     * streams::bulk_serializable, which they are received straight into).
+     */
+    template <typename T>
+    streams::Serializer& operator<<(streams::Serializer& s, const array<T>& arr) {
+        s << arr.m_len;
+        streams::send_elements(s, arr.m_arr, arr.m_len);
         return s;
     }
 
     template <typename T>
     streams::Serializer& operator>>(streams::Serializer& s, array<T>& arr) {
+        size_t length = streams::receive_length<T>(s);
         if (arr.m_len > 0) { delete[] arr.m_arr; arr.m_len = 0; }
-        s >> arr.m_len;
-        arr.m_arr = new T[arr.m_len];
-
-        for (int i = 0; i < arr.m_len; i++) {
-            s >> arr.m_arr[i];
-        }
+        arr.m_arr = length > 0 ? new T[length] : nullptr;
+        arr.m_len = length;
 
+        streams::receive_elements(s, arr.m_arr, length);
         return s;
     }
 }
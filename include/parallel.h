@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+
+namespace parallel {
+    /**
+     * Sets/gets the number of Data Points from which a single scan is split across threads (0 to never split).
+     * Every partition of a split scan has at least half this many points.
+     */
+    void set_threshold(size_t points);
+    size_t threshold();
+
+    /**
+     * Sets/gets the most threads a scan is split across, which is also the number of threads all of the split
+     * scans together may run on (their helper threads are reserved from a budget of max_threads() - 1).
+     * Defaults to one per CPU.
+     */
+    void set_max_threads(unsigned int threads);
+    unsigned int max_threads();
+
+    /**
+     * Sets how helper threads are placed: place(i) is called on the i-th helper when it starts (before its first
+     * partition), once its CPU affinity is reset to the CPUs the process started on, rather than those of the thread
+     * which happened to start it. Helpers started before the call are left as they are.
+     */
+    void set_helper_placement(std::function<void(unsigned int)> place);
+
+    /**
+     * Keeps the scans of the calling thread from being split for the guard's lifetime, eg. on threads which already
+     * split the work between them (one query per thread).
+     */
+    class Serial {
+        bool m_previous;
+
+        public:
+            /**
+             * @param serial        Whether the guard applies (so it may be conditional).
+             */
+            Serial(bool serial=true);
+            ~Serial();
+    };
+
+    /**
+     * @param n             The number of Data Points scanned.
+     * @param min_size      The fewest points a partition may have (eg. the k of the scan).
+     * @return              The number of partitions a scan of n points is split into, 1 if it isn't split.
+     *                      It only depends on n and the settings, so a scan splits the same way however many threads
+     *                      end up running it.
+     */
+    size_t partitions(size_t n, size_t min_size=1);
+
+    /**
+     * Runs body(partition, begin, end) for every partition of [0, n) into num_partitions contiguous ranges, on the
+     * calling thread and on as many helper threads (up to one per other partition) as the budget has free, so
+     * concurrent scans fall back to running on their own threads rather than oversubscribing the CPUs.
+     * Helper threads are started as they are first needed and kept for the following scans.
+     * Helper threads work for the caller's session: they are attached to its cancellation token, trace and counters.
+     * @throws              The first exception thrown by body, once every thread is done (the partitions not
+     *                      started by then are skipped).
+     */
+    void for_partitions(size_t n, size_t num_partitions, const std::function<void(size_t, size_t, size_t)>& body);
+}
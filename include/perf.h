@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+namespace perf {
+    /**
+     * The hardware events counted, and their names.
+     */
+    enum Event { cycles, instructions, llc_misses, branch_misses, num_events };
+    extern const char* const event_names[num_events];
+
+    /**
+     * What a Scope counts: a whole command (on the session's thread), or a scan of a Data Set (on whichever thread
+     * runs it).
+     */
+    enum Kind { command_scope, scan_scope, num_kinds };
+    extern const char* const kind_names[num_kinds];
+
+    /**
+     * Counts of the hardware events over some stretch of a thread's execution.
+     */
+    struct Counts {
+        uint64_t values[num_events];
+
+        Counts() { for (uint64_t& value : this->values) value = 0; }
+
+        uint64_t operator[](Event event) const { return this->values[event]; }
+
+        Counts& operator+=(const Counts& other) {
+            for (int e = 0; e < num_events; e++) this->values[e] += other.values[e];
+            return *this;
+        }
+
+        /**
+         * @return The counts of other (an earlier reading) up to these.
+         */
+        Counts since(const Counts& other) const;
+
+        /**
+         * @return Instructions per cycle, 0 if no cycles were counted.
+         */
+        double ipc() const;
+
+        /**
+         * @return The counts formatted for a log line.
+         */
+        std::string describe() const;
+    };
+
+    /**
+     * Enables counting, which is off by default. The counters are opened with perf_event_open, per thread and for
+     * user space only, so the kernel allows them unless perf_event_paranoid is above 2 or the machine has no
+     * hardware counters (eg. most virtual machines). If it doesn't allow them, counting stays disabled.
+     * @param reason        Set to why the counters can't be opened, if they can't.
+     * @return              Whether counting is enabled.
+     */
+    bool enable(std::string& reason);
+
+    bool enabled();
+
+    /**
+     * Reads the calling thread's counters, opening them on its first read.
+     * @return              Whether they could be read (they can't if counting is disabled or the thread's counters
+     *                      can't be opened).
+     */
+    bool read(Counts& counts);
+
+    /**
+     * The hardware events counted during a session, by the kind of the scopes which counted them.
+     */
+    class Session {
+        mutable std::mutex m_mutex;
+        Counts m_counts[num_kinds];
+        size_t m_scopes[num_kinds];
+
+        public:
+            Session() { for (size_t& scopes : this->m_scopes) scopes = 0; }
+
+            void add(Kind kind, const Counts& counts);
+
+            Counts counts(Kind kind) const;
+            size_t scopes(Kind kind) const;
+    };
+
+    /**
+     * The session the calling thread counts into, or null.
+     */
+    extern thread_local Session* t_session;
+
+    inline Session* current_session() { return t_session; }
+
+    /**
+     * Attaches the calling thread to a session for the attachment's lifetime.
+     */
+    class Attach {
+        Session* m_previous;
+
+        public:
+            Attach(Session* session) : m_previous(t_session) { t_session = session; }
+            ~Attach() { t_session = this->m_previous; }
+    };
+
+    /**
+     * Counts the hardware events of the calling thread between its construction and destruction, adding them to
+     * the server's metrics (knn_perf_events_total) and to the thread's session. Scopes may nest.
+     * When counting is disabled this only costs an atomic load.
+     */
+    class Scope {
+        Kind m_kind;
+        bool m_active;
+        Counts m_start;
+
+        public:
+            Scope(Kind kind) : m_kind(kind), m_active(enabled() && read(this->m_start)) { }
+            ~Scope();
+
+            Scope(const Scope&) = delete;
+            Scope& operator=(const Scope&) = delete;
+    };
+}
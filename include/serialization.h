@@ -2,6 +2,8 @@
 
 #include <vector>
 #include <map>
+#include <utility>
+#include <type_traits>
 
 #include "streams.h"
 
@@ -12,7 +14,26 @@ namespace streams {
                               open_file_r_token,
                               write_file_token,
                               read_file_token,
-                              end_token};
+                              end_token,
+                              stream_file_r_token,
+                              upload_dataset_token};
+
+    /**
+     * Converts a primitive between the host's byte order and little-endian byte order (in place).
+     * This is a no-op on little-endian hosts.
+     * @param value     The value to convert.
+     */
+    template <typename T>
+    void little_endian(T& value) {
+    #if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        char* bytes = (char*)&value;
+        for (size_t i = 0; i < sizeof(T) / 2; i++) {
+            std::swap(bytes[i], bytes[sizeof(T) - 1 - i]);
+        }
+    #else
+        (void)value;
+    #endif
+    }
 
     /**
      * Class for serializing objects.
@@ -69,6 +90,37 @@ namespace streams {
         return s;
     }
 
+    /** Bounds on received sequences **/
+
+    /**
+     * The most bytes a received sequence (string, vector or array) may hold. Their lengths are sent by the peer,
+     * so they are checked before anything is allocated for them.
+     */
+    const size_t max_sequence_bytes = 1 << 26;
+
+    /**
+     * @throws          std::ios_base::failure if n T's are more than max_sequence_bytes.
+     */
+    template <typename T>
+    void check_length(size_t n) {
+        if (n > max_sequence_bytes / sizeof(T)) {
+            throw std::ios_base::failure("received a sequence of " + std::to_string(n) + " elements, more than " +
+                    std::to_string(max_sequence_bytes) + " bytes");
+        }
+    }
+
+    /**
+     * Deserializes the length of a sequence of T's.
+     * @throws          std::ios_base::failure if the sequence would be more than max_sequence_bytes.
+     */
+    template <typename T>
+    size_t receive_length(Serializer& s) {
+        size_t n;
+        s >> n;
+        check_length<T>(n);
+        return n;
+    }
+
     /** Serialization for primitive pointer types **/
     
     /**
@@ -153,14 +205,9 @@ namespace streams {
     }
 
     inline Serializer& operator>>(Serializer& s, std::string& str) {
-        size_t n;
-        char* cstr;
-
-        s >> n;
-        s >> SerializablePointer<char>(cstr, n).allocate();
-        str = std::string(cstr, n);
-        if (n > 0) delete[] cstr;
-
+        size_t n = receive_length<char>(s);
+        str.resize(n);
+        if (n > 0) s.stream()->receive_into(&str[0], n);
         return s;
     }
 
@@ -168,30 +215,94 @@ namespace streams {
         return s << std::string(str);
     }
 
+    /** Serialization for sequences of elements **/
+
+    /**
+     * Whether elements of type T are serialized in bulk: as a single contiguous payload of their bytes (which is
+     * what serializing them one by one sends too, one send per element). Pointers are serialized as what they
+     * point to, so they aren't.
+     */
+    template <typename T>
+    struct bulk_serializable : std::integral_constant<bool, std::is_trivially_copyable<T>::value &&
+        !std::is_pointer<T>::value> { };
+
+    template <typename T>
+    void send_elements(Serializer& s, const T* data, size_t n, std::true_type) {
+        if (n > 0) s.stream()->send(data, n * sizeof(T));
+    }
+
+    template <typename T>
+    void send_elements(Serializer& s, const T* data, size_t n, std::false_type) {
+        for (size_t i = 0; i < n; i++) s << data[i];
+    }
+
+    template <typename T>
+    void receive_elements(Serializer& s, T* data, size_t n, std::true_type) {
+        if (n > 0) s.stream()->receive_into(data, n * sizeof(T));
+    }
+
+    template <typename T>
+    void receive_elements(Serializer& s, T* data, size_t n, std::false_type) {
+        for (size_t i = 0; i < n; i++) s >> data[i];
+    }
+
+    /**
+     * Serializes n contiguous elements (without their number), in bulk if they are bulk_serializable.
+     */
+    template <typename T>
+    void send_elements(Serializer& s, const T* data, size_t n) {
+        send_elements(s, data, n, bulk_serializable<T>());
+    }
+
+    /**
+     * Deserializes n elements straight into their storage, in bulk if they are bulk_serializable.
+     * @throws          std::ios_base::failure if the elements are more than max_sequence_bytes.
+     */
+    template <typename T>
+    void receive_elements(Serializer& s, T* data, size_t n) {
+        check_length<T>(n);
+        receive_elements(s, data, n, bulk_serializable<T>());
+    }
+
+    /**
+     * Serializes a vector as its size followed by its elements.
+     * std::vector<bool> packs its elements, so they are serialized one by one.
+     */
     template <typename T>
-    Serializer& operator<<(Serializer& s, const std::vector<T> vec) {
+    Serializer& operator<<(Serializer& s, const std::vector<T>& vec) {
         s << (size_t)vec.size();
-        
-        for (T val : vec) {
-            s << vec;
-        }
+        send_elements(s, vec.data(), vec.size());
+        return s;
+    }
 
+    inline Serializer& operator<<(Serializer& s, const std::vector<bool>& vec) {
+        s << (size_t)vec.size();
+        for (bool val : vec) s << val;
         return s;
     }
 
+    /**
+     * Deserializes a vector, replacing its elements.
+     */
     template <typename T>
     Serializer& operator>>(Serializer& s, std::vector<T>& vec) {
-        size_t size;
-        s >> size;
+        size_t size = receive_length<T>(s);
+
+        vec.resize(size);
+        receive_elements(s, vec.data(), size);
+        return s;
+    }
+
+    inline Serializer& operator>>(Serializer& s, std::vector<bool>& vec) {
+        size_t size = receive_length<bool>(s);
 
-        for (int i = 0; i < size; i++) {
-            T val;
+        vec.clear();
+        for (size_t i = 0; i < size; i++) {
+            bool val;
             s >> val;
             vec.push_back(val);
         }
 
         return s;
     }
-
 }
-
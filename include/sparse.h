@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "misc.h"
+
+namespace knn {
+    /**
+     * A point stored as its nonzero features only: their indices, in increasing order, and their values.
+     */
+    struct SparseVector {
+        std::vector<uint32_t> indices;
+        std::vector<double> values;
+
+        size_t nnz() const { return this->indices.size(); }
+
+        void clear() {
+            this->indices.clear();
+            this->values.clear();
+        }
+
+        /**
+         * @return The point's dims features, zeros included.
+         * @throws          std::invalid_argument if the point has a nonzero feature past dims.
+         */
+        misc::array<double> dense(size_t dims) const;
+
+        /**
+         * @return The nonzero features of n dense features.
+         */
+        static SparseVector from_dense(const double* features, size_t n);
+    };
+
+    /**
+     * The nonzero features of a row of a Sparse Data Set, pointing into the Data Set.
+     */
+    struct SparseRow {
+        const uint32_t* indices;
+        const double* values;
+        size_t nnz;
+    };
+
+    /**
+     * A Data Set of sparse points in compressed sparse row (CSR) form: the nonzero features of every point are stored
+     * back to back in two arrays (indices and values), so the Data Set's memory (and the cost of scanning it) is
+     * proportional to its number of nonzeros rather than to its width.
+     */
+    class SparseDataSet {
+        std::vector<size_t> m_offsets;          // Row i's nonzeros are at [m_offsets[i], m_offsets[i + 1])
+        std::vector<uint32_t> m_indices;
+        std::vector<double> m_values;
+        std::vector<uint32_t> m_labels;         // The index of every row's class in m_classes
+        std::vector<std::string> m_classes;
+        std::unordered_map<std::string, uint32_t> m_dictionary;
+        size_t m_dims;
+
+        public:
+            SparseDataSet() : m_offsets(1, 0), m_dims(0) { }
+
+            /**
+             * Adds a point to the Data Set.
+             * @param class_name    The point's class.
+             * @param point         The point's nonzero features.
+             */
+            void add(const std::string& class_name, const SparseVector& point);
+
+            size_t size() const { return this->m_labels.size(); }
+
+            /**
+             * @return One past the largest index of a nonzero feature of any point.
+             */
+            size_t dims() const { return this->m_dims; }
+
+            size_t nnz() const { return this->m_indices.size(); }
+
+            SparseRow row(size_t i) const {
+                size_t start = this->m_offsets[i];
+                return SparseRow{this->m_indices.data() + start, this->m_values.data() + start,
+                    this->m_offsets[i + 1] - start};
+            }
+
+            const std::string& class_type(size_t i) const { return this->m_classes[this->m_labels[i]]; }
+
+            /**
+             * Releases the spare capacity left by adding points one by one.
+             */
+            void shrink_to_fit();
+
+            /**
+             * @return The number of bytes used by the Data Set.
+             */
+            size_t memory_usage() const;
+
+            /**
+             * @return The number of bytes a point with nnz nonzeros adds to a Data Set (not counting its class).
+             */
+            static size_t point_usage(size_t nnz) {
+                return nnz * (sizeof(uint32_t) + sizeof(double)) + sizeof(size_t) + sizeof(uint32_t);
+            }
+    };
+
+    /**
+     * Parses a point in libsvm format: "label index:value index:value ...", with 1-based indices. The indices needn't
+     * be sorted, and features whose value is 0 are dropped.
+     * @param line          The line to parse.
+     * @param classified    Whether the line starts with a label. An unclassified line may start with one too, which
+     *                      is skipped.
+     * @param label         Set to the point's label ("" if it has none).
+     * @param point         Set to the point's nonzero features, with 0-based indices.
+     * @throws              std::invalid_argument if the line is malformed or repeats an index.
+     */
+    void parse_sparse_point(const std::string& line, bool classified, std::string& label, SparseVector& point);
+
+    /**
+     * Initializes a Sparse Data Set from lines in libsvm format.
+     * @param getline           A function for receiving a line of input.
+     * @param reserve           If given, called with the number of bytes of every point before it is added to the
+     *                          Data Set. It may throw to stop reading (the Data Set is then deleted).
+     * @return                  A Sparse Data Set of the points read.
+     * @throws                  std::invalid_argument if a line is malformed.
+     */
+    SparseDataSet* read_sparse_dataset(std::function<std::string(std::string&)> getline,
+            std::function<void(size_t)> reserve=nullptr);
+
+    /**
+     * @return Whether a file holds sparse points in libsvm format, by its extension (.svm or .libsvm).
+     */
+    bool is_sparse_file(const std::string& path);
+}
@@ -1,7 +1,11 @@
 #pragma once
 
 #include <stdexcept>
+#include <atomic>
+#include <cstdint>
 #include <ios>
+#include <string>
+#include <cstring>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/select.h>
@@ -47,6 +51,21 @@ namespace streams {
             return prim;
         }
 
+        /**
+         * Receive exactly size bytes into a buffer, rather than into newly allocated memory.
+         * Streams which can read straight into the buffer should override this.
+         * @param buffer    The buffer to receive into (of at least size bytes).
+         * @param size      The number of bytes to receive.
+         */
+        virtual void receive_into(void* buffer, size_t size) {
+            if (size == 0) return;
+
+            size_t s = size;
+            char* data = this->receive(s);
+            memcpy(buffer, data, size);
+            delete[] data;
+        }
+
         /**
          * Send data through the stream.
          * @param data      The data to send.
@@ -76,15 +95,52 @@ namespace streams {
         int port;
     };
 
-    class TCPSocket : public Stream {
-        int fd;
+    /**
+     * A Stream over a connected socket, of any family.
+     */
+    class SocketStream : public Stream {
+        protected:
+            int fd;
+            size_t m_bytes_sent;
+            size_t m_bytes_received;
+
+            SocketStream(int socket_fd) : fd(socket_fd), m_bytes_sent(0), m_bytes_received(0) { }
+
+        public:
+            /**
+             * Makes receiving fail (throwing std::ios_base::failure) once it waits for longer than a timeout.
+             * @param timeout       The timeout in seconds, 0 to wait forever.
+             */
+            void set_receive_timeout(int timeout);
 
+            char* receive(size_t& size, bool force_size=true) override;
+            void receive_into(void* buffer, size_t size) override;
+
+            void send(const void* data, size_t size) override;
+
+            bool is_good() override { return this->fd >= 0; }
+
+            /**
+             * Gets the file descriptor of the socket (eg. to poll it).
+             */
+            int get_fd() const { return this->fd; }
+
+            void close() override;
+
+            /**
+             * The number of bytes sent/received through this socket (copies of the socket count separately).
+             */
+            size_t bytes_sent() const { return this->m_bytes_sent; }
+            size_t bytes_received() const { return this->m_bytes_received; }
+    };
+
+    class TCPSocket : public SocketStream {
         /**
          * Constructor for creating TCP sockets out of file descriptors.
          * This should only be called by a method like accept_connection.
          * @param socket_fd     The file descriptor to use.
          */
-        TCPSocket(int socket_fd) : fd(socket_fd) { }
+        TCPSocket(int socket_fd) : SocketStream(socket_fd) { }
 
         public:
             /**
@@ -107,8 +163,6 @@ namespace streams {
             TCPSocket(std::string ip, int port, std::string dest_ip, int dest_port) :
                 TCPSocket(ip.c_str(), port, dest_ip.c_str(), dest_port) { }
 
-            TCPSocket(const TCPSocket& other) : fd(other.fd) { }
-
             /**
              * Wrapper around C's listen function (literally just call listen(this->fd, buffer))
              */
@@ -133,41 +187,212 @@ namespace streams {
             void connect_to(const char* ip, int port);
             void connect_to(std::string ip, int port) { this->connect_to(ip.c_str(), port); }
 
-            char* receive(size_t& size, bool force_size=true) override;
+            /**
+             * Gets the address of the socket.
+             */
+            Address get_address();
+    };
 
-            /*template <typename T>
-            T receive() override {
-                T primitive;
-                int bytes_read = 0;
-                int i = 0;
+    /**
+     * A Unix-domain stream socket, for clients on the same host as the server. It skips the loopback TCP stack,
+     * and can pass file descriptors (which is how a SharedMemoryStream is set up).
+     */
+    class UnixSocket : public SocketStream {
+        UnixSocket(int socket_fd) : SocketStream(socket_fd) { }
 
-                while (i < sizeof(primitive)) {
-                    bytes_read = recv(this->fd, &primitive + i, sizeof(primitive) - i);
+        public:
+            /**
+             * Construct an unbound, unconnected socket.
+             */
+            UnixSocket();
 
-                    if (bytes_read < 0) {
-                        throw std::ios_base::failure("error encountered while receiving from socket, errno: " +
-                                std::to_string(errno));
+            /**
+             * Construct a socket and connect it to the socket bound to a path.
+             */
+            UnixSocket(const std::string& dest_path);
 
-                    } else if (bytes_read == 0) {
-                        throw std::ios_base::failure("socket closed before forced reception of data");
-                    }
+            /**
+             * Binds the socket to a path, replacing a socket left there (eg. by a server which didn't exit cleanly).
+             */
+            void bind_to(const std::string& path);
 
-                    i += bytes_read;
-                }
+            void listening(int buffer);
 
-                return primitive;
-            }*/
+            /**
+             * Accept a connection request (blocking).
+             */
+            UnixSocket accept_connection();
 
-            void send(const void* data, size_t size) override;
+            void connect_to(const std::string& path);
 
             /**
-             * Gets the address of the socket.
+             * Gets the address of the socket: the path it is bound to (for accepted sockets, the path of the
+             * listening socket) as the ip, and the process id of its peer as the port.
              */
             Address get_address();
 
-            bool is_good() override { return this->fd >= 0; }
+            /**
+             * Sends data along with file descriptors, which the peer receives as its own descriptors of the same
+             * files.
+             * @param data      The data (at least a byte, which the descriptors are attached to).
+             */
+            void send_descriptors(const void* data, size_t size, const int* fds, size_t num_fds);
+
+            /**
+             * Receives data along with exactly num_fds file descriptors (see send_descriptors).
+             */
+            void receive_descriptors(void* data, size_t size, int* fds, size_t num_fds);
+    };
+
+    /**
+     * A Stream between two processes on the same host, through a ring buffer in shared memory for each direction.
+     * Sending and receiving copy straight to and from the rings, so neither goes through the kernel unless the ring
+     * is full or empty: then the thread waits on an eventfd, which the other side only signals when it knows that
+     * the thread is waiting.
+     * The server's side is set up over an accepted Unix-domain connection, through which it passes the memory and
+     * the eventfds to the client. The connection stays open, so the server notices the client hanging up (eg. by
+     * polling get_fd) as it would on a socket.
+     * Each direction may be used by one thread at a time (as the protocol does). Copies of the Stream share it, and
+     * it is only released by close.
+     */
+    class SharedMemoryStream : public Stream {
+        struct Ring;
+
+        UnixSocket m_control;
+        char* m_memory;
+        size_t m_memory_size;
+        size_t m_capacity;                          // Of each ring, a power of two
+        Ring* m_send;
+        Ring* m_receive;
+        char* m_send_data;
+        char* m_receive_data;
+        int m_events[4];                            // The data and space events of the server's ring, then the client's
+        int m_send_data_event;                      // Signaled to the receiver when data is sent
+        int m_send_space_event;                     // Waited on for space to send
+        int m_receive_data_event;                   // Waited on for data to receive
+        int m_receive_space_event;                  // Signaled to the sender when data is received
+        int m_timeout;                              // In milliseconds, -1 to wait forever
+        bool m_peer_gone;
+        size_t m_bytes_sent;
+        size_t m_bytes_received;
 
+        /**
+         * Maps the shared memory and picks the rings and events of the server's or the client's side.
+         */
+        void attach(int memory, size_t capacity, bool server);
+
+        /**
+         * Unmaps the memory and closes the events (whichever are set up).
+         */
+        void release();
+
+        /**
+         * Waits until ready() holds, waking on the event (which the other side signals as waiting is set), the
+         * peer hanging up or the timeout. May return before ready() holds.
+         */
+        template <typename F>
+        void wait(std::atomic<uint32_t>& waiting, int event, F ready);
+
+        /**
+         * Receives up to size bytes, waiting for at least one.
+         * @return          The number of bytes received, 0 if the stream is closed.
+         */
+        size_t receive_some(char* data, size_t size);
+
+        /**
+         * Checks positions loaded from a ring, which the other side may have written anything to.
+         * @throws std::ios_base::failure   If the ring would hold more than its capacity (the stream is closed).
+         */
+        void check_positions(uint64_t head, uint64_t tail);
+
+        public:
+            static const size_t default_capacity = 1 << 20;
+
+            /**
+             * Sets up the server's side of the stream over an accepted connection.
+             * @param connection    The connection, which is owned (and closed) by the stream.
+             * @param capacity      The size of each ring (rounded up to a power of two).
+             */
+            SharedMemoryStream(UnixSocket connection, size_t capacity=default_capacity);
+
+            /**
+             * Sets up the client's side of the stream, by connecting to a server at a path.
+             */
+            SharedMemoryStream(const std::string& dest_path);
+
+            char* receive(size_t& size, bool force_size=true) override;
+            void receive_into(void* buffer, size_t size) override;
+
+            void send(const void* data, size_t size) override;
+
+            bool is_good() override { return this->m_memory != nullptr; }
+
+            /**
+             * Closes both directions, waking the other side.
+             */
             void close() override;
+
+            /**
+             * Makes receiving fail (throwing std::ios_base::failure) once it waits for longer than a timeout.
+             * @param timeout       The timeout in seconds, 0 to wait forever.
+             */
+            void set_receive_timeout(int timeout) { this->m_timeout = timeout > 0 ? timeout * 1000 : -1; }
+
+            /**
+             * Gets the file descriptor of the connection the stream was set up over (eg. to poll it for the peer
+             * hanging up).
+             */
+            int get_fd() const { return this->m_control.get_fd(); }
+
+            Address get_address() { return this->m_control.get_address(); }
+
+            size_t bytes_sent() const { return this->m_bytes_sent; }
+            size_t bytes_received() const { return this->m_bytes_received; }
+    };
+
+    /**
+     * A Stream which buffers another Stream, so many small sends go out as one (which is also what keeps Nagle's
+     * algorithm from delaying them), and many small receives are served from one read.
+     * Sends are buffered until the buffer fills, flush is called or the Stream receives.
+     */
+    class BufferedStream : public Stream {
+        Stream* m_stream;
+        std::string m_output;
+        std::string m_input;
+        size_t m_read_position;
+
+        public:
+            static const size_t block_size = 1 << 16;
+
+            /**
+             * @param stream    The Stream to buffer (which isn't owned by the Buffered Stream).
+             */
+            BufferedStream(Stream* stream) : m_stream(stream), m_read_position(0) { }
+
+            char* receive(size_t& size, bool force_size=true) override;
+
+            /**
+             * Receives into a buffer, reading whatever the buffer of the stream doesn't hold straight into it
+             * when it is at least a block.
+             */
+            void receive_into(void* buffer, size_t size) override;
+
+            void send(const void* data, size_t size) override;
+
+            /**
+             * Sends the buffered data.
+             */
+            void flush();
+
+            bool is_good() override { return this->m_stream->is_good(); }
+
+            /**
+             * Flushes the buffered data and closes the underlying Stream.
+             */
+            void close() override {
+                this->flush();
+                this->m_stream->close();
+            }
     };
 
     #ifdef DEF_UDP
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace tracing {
+    class Session;
+
+    /**
+     * A completed span.
+     */
+    struct Event {
+        const char* name;
+        const char* category;
+        double start;           // Microseconds since the start of the session
+        double duration;        // In microseconds
+        std::string detail;
+    };
+
+    /**
+     * The events recorded by a single thread in a session.
+     * Only the owning thread appends to it, so recording needs no locks.
+     */
+    struct Buffer {
+        Session* session;
+        int tid;
+        std::vector<Event> events;
+        size_t dropped;
+
+        /**
+         * The maximal number of events in a buffer, further events are dropped.
+         */
+        static const size_t max_events = 1 << 20;
+
+        void record(const char* name, const char* category, std::chrono::steady_clock::time_point start,
+                std::chrono::steady_clock::time_point end, std::string&& detail);
+    };
+
+    /**
+     * The spans traced during a single session, dumped as Chrome/Perfetto trace-event JSON.
+     */
+    class Session {
+        std::mutex m_mutex;
+        std::vector<std::unique_ptr<Buffer>> m_buffers;
+        std::map<std::thread::id, Buffer*> m_thread_buffers;
+        std::chrono::steady_clock::time_point m_start;
+
+        public:
+            Session() : m_start(std::chrono::steady_clock::now()) { }
+
+            std::chrono::steady_clock::time_point start() const { return this->m_start; }
+
+            /**
+             * Gets the buffer of the calling thread to record its events into, created on its first call. Threads
+             * which attach to the session over and over (eg. scan helpers) keep recording into the same buffer.
+             */
+            Buffer* register_thread();
+
+            /**
+             * Writes the session's events as trace-event JSON.
+             * All of the threads which recorded events must have detached from the session.
+             * @param path      The file to write to.
+             */
+            void dump(const std::string& path);
+    };
+
+    /**
+     * The buffer of the calling thread, or null if the thread is not tracing.
+     */
+    extern thread_local Buffer* t_buffer;
+
+    /**
+     * @return The session the calling thread is tracing into, or null.
+     */
+    inline Session* current_session() { return t_buffer == nullptr ? nullptr : t_buffer->session; }
+
+    /**
+     * Attaches the calling thread to a session for the attachment's lifetime.
+     * Attaching to a null session leaves tracing disabled.
+     */
+    class Attach {
+        Buffer* m_previous;
+
+        public:
+            Attach(Session* session) : m_previous(t_buffer) {
+                if (session != nullptr) t_buffer = session->register_thread();
+            }
+
+            ~Attach() { t_buffer = this->m_previous; }
+    };
+
+    /**
+     * Records the time between its construction and destruction as a span, if the thread is tracing.
+     * When the thread isn't tracing this only costs a thread-local load.
+     */
+    class Span {
+        Buffer* m_buffer;
+        const char* m_name;
+        const char* m_category;
+        std::string m_detail;
+        std::chrono::steady_clock::time_point m_start;
+
+        public:
+            /**
+             * @param name          The name of the span (must outlive the session).
+             * @param category      The category of the span (must outlive the session).
+             */
+            Span(const char* name, const char* category) : m_buffer(t_buffer), m_name(name), m_category(category) {
+                if (this->m_buffer != nullptr) this->m_start = std::chrono::steady_clock::now();
+            }
+
+            /**
+             * @param detail        Extra information displayed with the span (only copied when tracing).
+             */
+            Span(const char* name, const char* category, const std::string& detail) : Span(name, category) {
+                if (this->m_buffer != nullptr) this->m_detail = detail;
+            }
+
+            ~Span() {
+                if (this->m_buffer != nullptr) {
+                    this->m_buffer->record(this->m_name, this->m_category, this->m_start,
+                            std::chrono::steady_clock::now(), std::move(this->m_detail));
+                }
+            }
+    };
+}
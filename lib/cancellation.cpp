@@ -0,0 +1,28 @@
+#include "cancellation.h"
+
+namespace cancellation {
+    thread_local Token* t_token = nullptr;
+
+    void Token::cancel(const std::string& reason) {
+        std::unique_lock<std::mutex> lock{this->m_mutex};
+        if (this->m_cancelled.load(std::memory_order_relaxed)) return;
+
+        this->m_reason = reason;
+        this->m_cancelled.store(true, std::memory_order_release);
+    }
+
+    std::string Token::reason() const {
+        std::unique_lock<std::mutex> lock{this->m_mutex};
+        return this->m_reason;
+    }
+
+    void Token::check() const {
+        if (this->cancelled()) throw Cancelled(this->reason());
+
+        int64_t deadline = this->m_deadline.load(std::memory_order_relaxed);
+        if (deadline != 0 && std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count() > deadline) {
+            throw Cancelled("command deadline exceeded");
+        }
+    }
+}
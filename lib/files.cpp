@@ -0,0 +1,133 @@
+#include "files.h"
+#include <cerrno>
+#include <cstdlib>
+#include <new>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+    /**
+     * Writes all of the data to a file.
+     * @throws std::ios_base::failure if writing fails.
+     */
+    void write_all(int fd, const char* data, size_t size) {
+        while (size > 0) {
+            ssize_t written = ::write(fd, data, size);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                throw std::ios_base::failure("error encountered while writing to file, errno: " + std::to_string(errno));
+            }
+            data += written;
+            size -= written;
+        }
+    }
+} // anonymous
+
+namespace streams {
+    void MappedFile::open(const std::string& filename) {
+        this->close();
+
+        int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            throw std::ios_base::failure("error encountered while opening " + filename + ", errno: " + std::to_string(errno));
+        }
+
+        struct stat info;
+        if (fstat(fd, &info) < 0) {
+            int error = errno;
+            ::close(fd);
+            throw std::ios_base::failure("error encountered while reading the size of " + filename + ", errno: " +
+                    std::to_string(error));
+        }
+
+        /* An empty file can't be mapped, and has no lines anyway */
+        this->m_size = info.st_size;
+        this->m_offset = 0;
+        if (this->m_size == 0) {
+            ::close(fd);
+            this->m_data = "";
+            return;
+        }
+
+        void* data = mmap(nullptr, this->m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        int error = errno;
+        ::close(fd);                // The mapping keeps the file
+        if (data == MAP_FAILED) {
+            this->m_size = 0;
+            throw std::ios_base::failure("error encountered while mapping " + filename + ", errno: " +
+                    std::to_string(error));
+        }
+
+        /* The lines are read once, front to back: read ahead aggressively and drop the pages behind */
+        madvise(data, this->m_size, MADV_SEQUENTIAL);
+        madvise(data, this->m_size, MADV_WILLNEED);
+        this->m_data = (const char*)data;
+    }
+
+    void MappedFile::close() {
+        if (this->m_data != nullptr && this->m_size > 0) munmap((void*)this->m_data, this->m_size);
+        this->m_data = nullptr;
+        this->m_size = 0;
+        this->m_offset = 0;
+    }
+
+    FileWriter::~FileWriter() {
+        try {
+            this->close();
+        } catch (std::ios_base::failure& e) { }
+        free(this->m_buffer);
+    }
+
+    void FileWriter::open(const std::string& filename) {
+        this->close();
+
+        if (this->m_buffer == nullptr) {
+            void* buffer;
+            if (posix_memalign(&buffer, 4096, buffer_size) != 0) throw std::bad_alloc();
+            this->m_buffer = (char*)buffer;
+        }
+
+        this->m_fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (this->m_fd < 0) {
+            throw std::ios_base::failure("error encountered while creating " + filename + ", errno: " +
+                    std::to_string(errno));
+        }
+    }
+
+    void FileWriter::write(const char* data, size_t size) {
+        if (this->m_fd < 0) return;
+
+        if (this->m_used + size > buffer_size) this->flush();
+        if (size >= buffer_size) {
+            write_all(this->m_fd, data, size);
+            return;
+        }
+
+        memcpy(this->m_buffer + this->m_used, data, size);
+        this->m_used += size;
+    }
+
+    void FileWriter::flush() {
+        if (this->m_fd < 0 || this->m_used == 0) return;
+
+        size_t used = this->m_used;
+        this->m_used = 0;
+        write_all(this->m_fd, this->m_buffer, used);
+    }
+
+    void FileWriter::close() {
+        if (this->m_fd < 0) return;
+
+        try {
+            this->flush();
+        } catch (std::ios_base::failure& e) {
+            ::close(this->m_fd);
+            this->m_fd = -1;
+            throw;
+        }
+        ::close(this->m_fd);
+        this->m_fd = -1;
+    }
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "knn.h"
+#include <queue>
 
 using namespace knn;
 
@@ -8,13 +9,73 @@ template <typename T>
 DataSet<T>& DataSet<T>::add(const DataPoint<T>* data_point) {
     DataPoint<T>* new_point = data_point->clone();
     this->m_data.push_back(new_point);
+    if (this->m_indexed) this->m_index.insert(std::make_pair(misc::hash(new_point->data()), (int)this->m_data.size() - 1));
     return *this;
 }
 
+template <typename T>
+DataSet<T>& DataSet<T>::adopt(DataPoint<T>* data_point) {
+    this->m_data.push_back(data_point);
+    if (this->m_indexed) this->m_index.insert(std::make_pair(misc::hash(data_point->data()), (int)this->m_data.size() - 1));
+    return *this;
+}
+
+template <typename T>
+void DataSet<T>::build_index() {
+    this->m_index.clear();
+    this->m_index.reserve(this->m_data.size());
+    for (size_t i = 0; i < this->m_data.size(); i++) {
+        this->m_index.insert(std::make_pair(misc::hash(this->m_data[i]->data()), (int)i));
+    }
+    this->m_indexed = true;
+}
+
+template <typename T>
+std::string DataSet<T>::get_class(const DataPoint<T>* data_point) const {
+    if (!this->m_indexed) {
+        for (DataPoint<T>* dp : this->m_data) {
+            if (*dp == *data_point) return dp->class_type();
+        }
+        return "";
+    }
+
+    /* Points with the same hash may still differ (and equal ones needn't be in the order they were added) */
+    int first = -1;
+    auto range = this->m_index.equal_range(misc::hash(data_point->data()));
+    for (auto it = range.first; it != range.second; it++) {
+        if ((first < 0 || it->second < first) && *this->m_data[it->second] == *data_point) first = it->second;
+    }
+    return first >= 0 ? this->m_data[first]->class_type() : "";
+}
+
 template <typename T>
 template <typename M>
 DataPoint<T>** DataSet<T>::get_k_nearest(int k, const DataPoint<T>* p, M (*distance)(const DataPoint<T>*, const DataPoint<T>*)) const {
-    std::vector<DistancePoint<M>> selected_distances = quickselect<DistancePoint<M>>(this->transform_data(p, distance), k);
+    static metrics::Histogram& scan_time = metrics::registry().histogram("knn_query_scan_ns");
+    metrics::Timer timer{scan_time};
+    perf::Scope counted{perf::scan_scope};
+    tracing::Span span{"get_k_nearest", "knn"};
+
+    size_t n = this->m_data.size();
+    size_t partitions = parallel::partitions(n, k);
+    std::vector<DistancePoint<M>> selected_distances;
+
+    if (partitions <= 1) {
+        selected_distances = quickselect<DistancePoint<M>>(this->transform_data(p, distance, 0, n), k);
+    } else {
+        /* The k nearest of every partition hold the k nearest of all */
+        std::vector<std::vector<DistancePoint<M>>> nearest(partitions);
+        parallel::for_partitions(n, partitions, [&](size_t part, size_t begin, size_t end) {
+                nearest[part] = quickselect<DistancePoint<M>>(this->transform_data(p, distance, begin, end), k);
+                nearest[part].erase(nearest[part].begin() + k, nearest[part].end());
+            });
+
+        std::vector<DistancePoint<M>> candidates;
+        candidates.reserve(partitions * k);
+        for (const std::vector<DistancePoint<M>>& part : nearest) candidates.insert(candidates.end(), part.begin(), part.end());
+        selected_distances = quickselect<DistancePoint<M>>(candidates, k);
+    }
+
     DataPoint<T>** selected_points = new DataPoint<T>*[k];
 
     for (int i = 0; i < k; i++) {
@@ -28,31 +89,150 @@ DataPoint<T>** DataSet<T>::get_k_nearest(int k, const DataPoint<T>* p, M (*dista
 template <typename T>
 template <typename M>
 std::string DataSet<T>::get_nearest_class(int k, const DataPoint<T>* p, M (*distance)(const DataPoint<T>*, const DataPoint<T>*)) const {
-    std::unordered_map<std::string, int> classes;
     DataPoint<T>** selected_points = this->get_k_nearest(k, p, distance);
+    tracing::Span span{"vote", "knn"};
 
-    for (int i = 0; i < k; i++) {
-        if (classes.find(selected_points[i]->class_type()) == classes.end()) {
-            classes[selected_points[i]->class_type()] = 1;
-        } else {
-            classes[selected_points[i]->class_type()]++;
+    std::string nearest = tally_classes(k, [selected_points](size_t j) { return selected_points[j]->class_type(); });
+
+    for (int i = 0; i < k; i++) delete selected_points[i];
+    delete[] selected_points;
+
+    return nearest;
+}
+
+
+
+template <typename T>
+template <typename M>
+std::vector<std::vector<int>> DataSet<T>::get_k_nearest_indices(int k, const DataPoint<T>* p,
+        void (*distances)(const DataPoint<T>*, const DataPoint<T>*, M*), size_t num_metrics, int exclude) const {
+    return this->select_k_nearest<M>(k, [this, p, distances](size_t i, M* out) {
+            distances(p, this->m_data[i], out);
+        }, num_metrics, exclude);
+}
+
+template <typename T>
+template <typename M, typename D>
+std::vector<std::vector<int>> DataSet<T>::select_k_nearest(int k, D distances, size_t num_metrics, int exclude) const {
+    static metrics::Histogram& scan_time = metrics::registry().histogram("knn_query_scan_ns");
+    metrics::Timer timer{scan_time};
+    perf::Scope counted{perf::scan_scope};
+    tracing::Span span{"select_k_nearest", "knn"};
+
+    size_t n = this->m_data.size();
+    size_t partitions = parallel::partitions(n, k);
+    std::vector<std::priority_queue<DistancePoint<M>>> nearest;
+
+    if (partitions <= 1) {
+        nearest = this->scan_k_nearest<M>(k, distances, num_metrics, exclude, 0, n);
+    } else {
+        std::vector<std::vector<std::priority_queue<DistancePoint<M>>>> partition_nearest(partitions);
+        parallel::for_partitions(n, partitions, [&](size_t part, size_t begin, size_t end) {
+                partition_nearest[part] = this->scan_k_nearest<M>(k, distances, num_metrics, exclude, begin, end);
+            });
+
+        /* Merge the k nearest of every partition, in the order of the partitions */
+        nearest.resize(num_metrics);
+        for (std::vector<std::priority_queue<DistancePoint<M>>>& part : partition_nearest) {
+            for (size_t m = 0; m < num_metrics; m++) {
+                for (; !part[m].empty(); part[m].pop()) {
+                    const DistancePoint<M>& candidate = part[m].top();
+                    if ((int)nearest[m].size() < k) {
+                        nearest[m].push(candidate);
+                    } else if (candidate.distance < nearest[m].top().distance) {
+                        nearest[m].pop();
+                        nearest[m].push(candidate);
+                    }
+                }
+            }
         }
-        delete selected_points[i];
     }
 
-    delete[] selected_points;
+    std::vector<std::vector<int>> indices(num_metrics);
+    for (size_t m = 0; m < num_metrics; m++) {
+        indices[m].resize(nearest[m].size());
+
+        /* The heap pops the farthest first, so fill from the back */
+        for (size_t j = indices[m].size(); j > 0; j--) {
+            indices[m][j - 1] = nearest[m].top().index;
+            nearest[m].pop();
+        }
+    }
+
+    return indices;
+}
+
+template <typename T>
+template <typename M, typename D>
+std::vector<std::priority_queue<typename DataSet<T>::template DistancePoint<M>>> DataSet<T>::scan_k_nearest(int k, D& distances,
+        size_t num_metrics, int exclude, size_t begin, size_t end) const {
+    /* One bounded max-heap per metric, whose top is the farthest of the current k nearest */
+    std::vector<std::priority_queue<DistancePoint<M>>> nearest(num_metrics);
+    std::vector<M> point_distances(num_metrics);
+
+    for (size_t i = begin; i < end; i++) {
+        if ((i - begin) % cancellation::check_interval == 0) cancellation::check();
+        if ((int)i == exclude) continue;
 
-    int max_count = 0;
-    std::string max_string;
+        distances(i, point_distances.data());
 
-    for (auto entry : classes) {
-        if (entry.second > max_count) {
-            max_string = entry.first;
-            max_count = entry.second;
+        for (size_t m = 0; m < num_metrics; m++) {
+            if ((int)nearest[m].size() < k) {
+                nearest[m].push(DistancePoint<M>(i, point_distances[m]));
+            } else if (point_distances[m] < nearest[m].top().distance) {
+                nearest[m].pop();
+                nearest[m].push(DistancePoint<M>(i, point_distances[m]));
+            }
         }
     }
 
-    return max_string;
+    return nearest;
 }
 
+template <typename T>
+std::string DataSet<T>::vote(const std::vector<int>& indices, int k) const {
+    return vote_classes(std::min(k, (int)indices.size()), [this, &indices](size_t j) {
+            return this->m_data[indices[j]]->class_type();
+        });
+}
+
+template <typename T>
+streams::Serializer& knn::operator<<(streams::Serializer& s, const DataSet<misc::array<T>>& data_set) {
+    const std::vector<DataPoint<misc::array<T>>*>& points = data_set.get_data();
+    uint64_t dims = points.empty() ? 0 : points[0]->data().length();
+
+    std::vector<std::string> names;
+    std::vector<uint32_t> labels;
+    std::unordered_map<std::string, uint32_t> dictionary;
+    for (const DataPoint<misc::array<T>>* p : points) {
+        p->data().assert_comparable(points[0]->data());
+        auto entry = dictionary.insert(std::make_pair(p->class_type(), (uint32_t)names.size()));
+        if (entry.second) names.push_back(p->class_type());
+        labels.push_back(entry.first->second);
+    }
+
+    s << (uint64_t)points.size() << dims << names << labels;
+    for (const DataPoint<misc::array<T>>* p : points) streams::send_elements(s, p->data().data(), dims);
+    return s;
+}
+
+template <typename T>
+streams::Serializer& knn::operator>>(streams::Serializer& s, DataSet<misc::array<T>>& data_set) {
+    uint64_t n, dims;
+    std::vector<std::string> names;
+    std::vector<uint32_t> labels;
+    s >> n >> dims >> names >> labels;
+    if (labels.size() != n) throw std::ios_base::failure("malformed Data Set: " + std::to_string(labels.size()) +
+            " labels for " + std::to_string(n) + " points");
+    streams::check_length<T>(dims);
+
+    for (uint64_t i = 0; i < n; i++) {
+        if (labels[i] >= names.size()) throw std::ios_base::failure("malformed Data Set: unknown label");
 
+        misc::array<T> features(dims);
+        streams::receive_elements(s, &features[0], dims);
+        data_set.adopt(new CartDataPoint<T>(names[labels[i]], std::move(features)));
+    }
+
+    return s;
+}
@@ -1,7 +1,13 @@
 #pragma once
 
 #include <iostream>
+#include <cstring>
+#include <cmath>
+#include <limits>
+#include <type_traits>
+#include <memory>
 #include "knn.h"
+#include "files.h"
 
 namespace knn {
     template <typename T>
@@ -57,83 +63,281 @@ namespace knn {
     }
     
     template <typename T>
-    DataSet<misc::array<T>>* initialize_dataset(std::function<std::string(std::string&)> getline, T (*converter)(std::string)) {
+    DataSet<misc::array<T>>* initialize_dataset(std::function<std::string(std::string&)> getline, T (*converter)(std::string),
+            std::function<void(size_t)> reserve, std::function<void(const CartDataPoint<T>&)> divert) {
+        tracing::Span span{"initialize_dataset", "knn"};
         DataSet<misc::array<T>>* dataset = new DataSet<misc::array<T>>();
         CartDataPoint<T>* point;
         
-        while ((point = read_point<T>(getline, converter, true)) != nullptr) {
-            dataset->add(point);
-            delete point;
+        while (true) {
+            try {
+                point = read_point<T>(getline, converter, true);
+            } catch (...) {
+                delete dataset;
+                throw;
+            }
+            if (point == nullptr) break;
+
+            try {
+                if (divert) divert(*point);
+                else if (reserve) reserve(point->memory_usage() + sizeof(DataPoint<misc::array<T>>*));
+            } catch (...) {
+                delete point;
+                delete dataset;
+                throw;
+            }
+
+            if (divert) delete point;
+            else dataset->adopt(point);
         }
     
         return dataset;
     }
 }
 
-namespace {
-    /**
-     * Writes the name of the closest class (among the k closest neighbors) to a point to an input file stream.
-     * @param data_set          The Data Set to use for finding neighbors.
-     * @param k                 The k to use in quickselect.
-     * @param p                 The Data Point to find the closest class to.
-     * @param distance          A distance function for Data Points.
-     * @param output_stream     The output file stream.     
-     */
-    template <typename T, typename M>
-    void write_closest_class(DataSet<misc::array<T>>& data_set, int k, const CartDataPoint<T>* p,
-            M (*distance)(const DataPoint<misc::array<T>>*, const DataPoint<misc::array<T>>*),
-            std::ofstream& output_stream) {
-        output_stream << data_set.get_nearest_class(k, p, distance) << "\n";
+namespace knn {
+    template <>
+    inline const char* feature_name<double>() { return "f64"; }
+    template <>
+    inline const char* feature_name<float>() { return "f32"; }
+    template <>
+    inline const char* feature_name<int16_t>() { return "i16"; }
+    template <>
+    inline const char* feature_name<uint8_t>() { return "u8"; }
+
+    template <typename F>
+    F to_feature(double value) {
+        if (std::is_integral<F>::value && (value != std::floor(value) ||
+                    value < std::numeric_limits<F>::min() || value > std::numeric_limits<F>::max())) {
+            throw std::invalid_argument(std::to_string(value) + " is not a valid " + feature_name<F>() + " feature");
+        }
+        return (F)value;
     }
-    
-    /**
-     * Writes the closest classes of a file of points to an output file.
-     * @param data_set          The Data Set of classified points.
-     * @param k                 The k to use in quickselect.
-     * @param distance          Distance function for Data Points.
-     * @param input_stream      File stream for unclassified points.
-     * @param output_stream     The output file stream.
-     * @param converter         Converter from string to correct data type.
-     */
-    template <typename T, typename M>
-    void write_closest_classes(DataSet<misc::array<T>>& data_set, int k,
-            M (*distance)(const DataPoint<misc::array<T>>*, const DataPoint<misc::array<T>>*),
-            std::ifstream& input_stream, std::ofstream& output_stream,
-            T (*converter)(std::string)) {
-        CartDataPoint<T>* p;
-    
-        while ((p = read_point(input_stream, converter, false)) != nullptr) {
-            write_closest_class<T,M>(data_set, k, p, distance, output_stream);
-            delete p;
+
+    template <typename F>
+    F parse_feature(std::string s) { return to_feature<F>(std::stod(s)); }
+
+    inline UploadFormat parse_upload_format(const std::string& name) {
+        if (name == "text") return text_upload;
+        if (name == "f64") return float64_upload;
+        if (name == "f32") return float32_upload;
+        if (name == "i16") return int16_upload;
+        if (name == "u8") return uint8_upload;
+        if (name == "svm") return sparse_upload;
+        throw std::invalid_argument("unknown upload format: " + name);
+    }
+
+    inline void send_columns(streams::Serializer& s, UploadFormat format, std::function<std::string(std::string&)> getline,
+            size_t block_rows) {
+        switch (format) {
+            case float64_upload: send_columns<double>(s, getline, block_rows); break;
+            case float32_upload: send_columns<float>(s, getline, block_rows); break;
+            case int16_upload: send_columns<int16_t>(s, getline, block_rows); break;
+            case uint8_upload: send_columns<uint8_t>(s, getline, block_rows); break;
+            default: throw std::invalid_argument("not a binary upload format");
         }
     }
-} // anonymous
 
-namespace knn {
-    template <typename T, typename M>
-    void all_distances(std::string classified, std::string unclassified, int k,
-            T (*converter)(std::string), misc::array<std::string> output_names,
-            misc::array<M (*)(const DataPoint<misc::array<T>>*, const DataPoint<misc::array<T>>*)> distances) {
-        output_names.assert_comparable(distances);
-
-        std::ifstream classified_stream;
-        classified_stream.open(classified);
-    
-        DataSet<misc::array<T>>* dataset = initialize_dataset<T>(classified_stream, converter);
-        
-        for (int i = 0; i < output_names.length(); i++) {
-            std::ofstream output_stream;
-            output_stream.open(output_names[i]);
-            std::ifstream unclassified_stream;
-            unclassified_stream.open(unclassified);
+    template <typename F>
+    void send_columns(streams::Serializer& s, std::function<std::string(std::string&)> getline, size_t block_rows) {
+        std::unordered_map<std::string, uint32_t> dictionary;
+        std::vector<std::string> new_labels;
+        std::vector<F> values;
+        std::vector<uint32_t> labels;
+        uint64_t dims = 0;
+
+        /* Sends the rows gathered so far as a block */
+        auto send_block = [&]() {
+            if (labels.empty()) return;
+
+            uint64_t header[3] = {labels.size(), dims, new_labels.size()};
+            for (uint64_t& h : header) streams::little_endian(h);
+            s << header[0] << header[1] << header[2];
+
+            for (const std::string& label : new_labels) s << label;
+
+            /* Transpose the rows into columns */
+            size_t rows = labels.size();
+            std::vector<char> payload(rows * (dims * sizeof(F) + sizeof(uint32_t)));
+            F* columns = (F*)payload.data();
+            uint32_t* ids = (uint32_t*)(payload.data() + rows * dims * sizeof(F));
+
+            for (size_t i = 0; i < rows; i++) {
+                for (size_t j = 0; j < dims; j++) {
+                    F value = values[i * dims + j];
+                    streams::little_endian(value);
+                    columns[j * rows + i] = value;
+                }
+                uint32_t id = labels[i];
+                streams::little_endian(id);
+                ids[i] = id;
+            }
+
+            s.stream()->send(payload.data(), payload.size());
+
+            new_labels.clear();
+            values.clear();
+            labels.clear();
+        };
+
+        std::string line;
+        size_t line_number = 0;
+
+        while (getline(line) != "") {
+            line_number++;
+            size_t label_start = line.rfind(',');
+            size_t fields = 0;
+            size_t prev_index = 0;
+            size_t curr_index;
+            std::string error;
 
-            write_closest_classes<T,M>(*dataset, k, distances[i], unclassified_stream, output_stream, converter);
+            try {
+                while (label_start != std::string::npos && prev_index <= label_start) {
+                    curr_index = line.find(',', prev_index);
+                    values.push_back(parse_feature<F>(line.substr(prev_index, curr_index - prev_index)));
+                    prev_index = curr_index + 1;
+                    fields++;
+                }
+            } catch (std::logic_error& e) {
+                error = "line " + std::to_string(line_number) + ": " + e.what();
+            }
 
-            output_stream.close();
-            unclassified_stream.close();
+            if (dims == 0) {
+                dims = fields;
+                if (dims * sizeof(F) + sizeof(uint32_t) > max_block_bytes) {
+                    error = "line " + std::to_string(line_number) + " has " + std::to_string(fields) +
+                            " fields, more than a block holds";
+                }
+                block_rows = std::max<size_t>(std::min(block_rows, max_block_bytes / (dims * sizeof(F) + sizeof(uint32_t))), 1);
+            }
+            if (error == "" && (fields != dims || fields == 0)) {
+                error = "line " + std::to_string(line_number) + " has " + std::to_string(fields) +
+                        " fields, expected " + std::to_string(dims);
+            }
+
+            /* End the upload with the lines before this one */
+            if (error != "") {
+                values.resize(labels.size() * dims);
+                send_block();
+                s << (uint64_t)0;
+                throw std::invalid_argument(error);
+            }
+
+            std::string label = line.substr(label_start + 1);
+            auto entry = dictionary.find(label);
+            if (entry == dictionary.end()) {
+                entry = dictionary.insert({label, dictionary.size()}).first;
+                new_labels.push_back(label);
+            }
+            labels.push_back(entry->second);
+
+            if (labels.size() == block_rows) send_block();
         }
-    
-        delete dataset;
+
+        send_block();
+        s << (uint64_t)0;
     }
-}
 
+    template <typename T, typename F>
+    DataSet<misc::array<T>>* receive_columns(streams::Serializer& s, std::function<void(size_t)> reserve,
+            std::function<void(const CartDataPoint<T>&)> divert) {
+        tracing::Span span{"receive_columns", "knn"};
+        DataSet<misc::array<T>>* dataset = new DataSet<misc::array<T>>();
+        std::vector<std::string> dictionary;
+        uint64_t dims = 0;
+        std::exception_ptr rejection;
+
+        /* After a rejection the rest of the upload is discarded, through a buffer of its own */
+        auto discard = [&s](size_t size) {
+            char buffer[4096];
+            while (size > 0) {
+                size_t n = std::min(size, sizeof(buffer));
+                s.stream()->receive_into(buffer, n);
+                size -= n;
+            }
+        };
+        auto charge = [&reserve, &rejection](size_t bytes) {
+            if (rejection || !reserve) return;
+            try {
+                reserve(bytes);
+            } catch (...) {
+                rejection = std::current_exception();
+            }
+        };
+
+        try {
+            while (true) {
+                uint64_t rows, block_dims, num_labels;
+                s >> rows;
+                streams::little_endian(rows);
+                if (rows == 0) break;
+
+                s >> block_dims >> num_labels;
+                streams::little_endian(block_dims);
+                streams::little_endian(num_labels);
+
+                /* The sizes come from the peer, so they are bounded before anything is computed from them */
+                if (dims == 0) dims = block_dims;
+                if (block_dims != dims || dims == 0 || dims > (max_block_bytes - sizeof(uint32_t)) / sizeof(F) ||
+                        rows > max_block_bytes / (dims * sizeof(F) + sizeof(uint32_t)) || num_labels > rows) {
+                    throw std::ios_base::failure("malformed column block");
+                }
+
+                for (uint64_t i = 0; i < num_labels; i++) {
+                    std::string label;
+                    s >> label;
+                    charge(sizeof(std::string) + accounting::heap_usage(label));
+                    dictionary.push_back(label);
+                }
+
+                /* The points are charged before their block is received (but for their labels' heap memory) */
+                size_t size = rows * (dims * sizeof(F) + sizeof(uint32_t));
+                size_t point_bytes = sizeof(CartDataPoint<T>) + dims * sizeof(T) + sizeof(DataPoint<misc::array<T>>*);
+                if (!divert) charge(rows * point_bytes);
+                if (rejection) {
+                    discard(size);
+                    continue;
+                }
+
+                std::unique_ptr<char[]> payload{s.stream()->receive(size)};
+                const char* columns = payload.get();
+                const char* ids = payload.get() + rows * dims * sizeof(F);
+
+                for (size_t i = 0; i < rows; i++) {
+                    misc::array<T> arr(dims);
+                    for (size_t j = 0; j < dims; j++) {
+                        F value;
+                        memcpy(&value, columns + (j * rows + i) * sizeof(F), sizeof(F));
+                        streams::little_endian(value);
+                        arr[j] = (T)value;
+                    }
+
+                    uint32_t id;
+                    memcpy(&id, ids + i * sizeof(uint32_t), sizeof(uint32_t));
+                    streams::little_endian(id);
+                    if (id >= dictionary.size()) throw std::ios_base::failure("malformed column block");
+
+                    CartDataPoint<T> point(dictionary[id], arr);
+                    try {
+                        if (divert) divert(point);
+                        else if (reserve) reserve(point.memory_usage() + sizeof(DataPoint<misc::array<T>>*) - point_bytes);
+                    } catch (...) {
+                        rejection = std::current_exception();
+                        break;
+                    }
+                    if (!divert) dataset->add(&point);
+                }
+            }
+        } catch (...) {
+            delete dataset;
+            throw;
+        }
+
+        if (rejection) {
+            delete dataset;
+            std::rethrow_exception(rejection);
+        }
+
+        return dataset;
+    }
+}
@@ -0,0 +1,107 @@
+#include "memory-accounting.h"
+#include "metrics.h"
+
+namespace accounting {
+    namespace {
+        const char* kind_names[num_kinds] = {"dataset", "index", "result"};
+
+        std::atomic<size_t> default_session_limit{0};
+
+        metrics::Gauge& used_gauge(Kind kind) {
+            static metrics::Gauge* gauges[num_kinds] = {
+                &metrics::registry().gauge("knn_memory_bytes", "kind=\"dataset\""),
+                &metrics::registry().gauge("knn_memory_bytes", "kind=\"index\""),
+                &metrics::registry().gauge("knn_memory_bytes", "kind=\"result\"")
+            };
+            return *gauges[kind];
+        }
+
+        metrics::Counter& rejections() {
+            static metrics::Counter& counter = metrics::registry().counter("knn_memory_rejections_total");
+            return counter;
+        }
+    } // anonymous
+
+    Budget::Budget(size_t limit) : m_total(0), m_limit(limit) {
+        for (std::atomic<size_t>& used : this->m_used) used.store(0);
+    }
+
+    void Budget::reserve(Kind kind, size_t bytes) {
+        size_t limit = this->m_limit.load();
+        size_t total = this->m_total.load();
+
+        do {
+            if (limit > 0 && total + bytes > limit) {
+                rejections().add();
+                throw QuotaExceeded("the server's memory quota of " + std::to_string(limit) + " bytes would be exceeded by " +
+                        std::to_string(bytes) + " bytes of " + kind_names[kind] + " memory");
+            }
+        } while (!this->m_total.compare_exchange_weak(total, total + bytes));
+
+        this->m_used[kind].fetch_add(bytes);
+        used_gauge(kind).add(bytes);
+    }
+
+    void Budget::release(Kind kind, size_t bytes) {
+        this->m_total.fetch_sub(bytes);
+        this->m_used[kind].fetch_sub(bytes);
+        used_gauge(kind).sub(bytes);
+    }
+
+    Budget& global_budget() {
+        static Budget budget;
+        return budget;
+    }
+
+    void set_session_limit(size_t limit) { default_session_limit.store(limit); }
+    size_t session_limit() { return default_session_limit.load(); }
+
+    Account::Account(Budget& budget, size_t limit) : m_budget(budget), m_limit(limit) {
+        for (std::atomic<size_t>& used : this->m_used) used.store(0);
+    }
+
+    Account::~Account() {
+        for (int kind = 0; kind < num_kinds; kind++) this->release((Kind)kind, this->m_used[kind].load());
+    }
+
+    size_t Account::used() const {
+        size_t sum = 0;
+        for (const std::atomic<size_t>& used : this->m_used) sum += used.load();
+        return sum;
+    }
+
+    void Account::charge(Kind kind, size_t bytes) {
+        if (this->m_limit > 0 && this->used() + bytes > this->m_limit) {
+            rejections().add();
+            throw QuotaExceeded("the session's memory quota of " + std::to_string(this->m_limit) + " bytes would be exceeded by " +
+                    std::to_string(bytes) + " bytes of " + kind_names[kind] + " memory");
+        }
+
+        this->m_budget.reserve(kind, bytes);
+        this->m_used[kind].fetch_add(bytes);
+    }
+
+    void Account::release(Kind kind, size_t bytes) {
+        if (bytes == 0) return;
+        this->m_used[kind].fetch_sub(bytes);
+        this->m_budget.release(kind, bytes);
+    }
+
+    size_t heap_usage(const std::string& s) {
+        /* Short strings are stored inside the string object itself */
+        std::string empty;
+        return s.capacity() > empty.capacity() ? s.capacity() + 1 : 0;
+    }
+
+    size_t parse_size(const std::string& size) {
+        size_t end;
+        size_t bytes = std::stoull(size, &end);
+        std::string suffix = size.substr(end);
+
+        if (suffix == "") return bytes;
+        if (suffix == "K" || suffix == "k") return bytes << 10;
+        if (suffix == "M" || suffix == "m") return bytes << 20;
+        if (suffix == "G" || suffix == "g") return bytes << 30;
+        throw std::invalid_argument("malformed size: " + size);
+    }
+}
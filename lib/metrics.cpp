@@ -0,0 +1,174 @@
+#include "metrics.h"
+
+#include <algorithm>
+
+namespace metrics {
+    size_t thread_shard() {
+        static std::atomic<size_t> next_shard{0};
+        thread_local size_t shard = next_shard.fetch_add(1, std::memory_order_relaxed) % num_shards;
+        return shard;
+    }
+
+    Counter::Counter() {
+        for (Shard& shard : this->m_shards) shard.value.store(0, std::memory_order_relaxed);
+    }
+
+    uint64_t Counter::value() const {
+        uint64_t sum = 0;
+        for (const Shard& shard : this->m_shards) sum += shard.value.load(std::memory_order_relaxed);
+        return sum;
+    }
+
+    Histogram::Histogram() : m_shards(new Shard[num_shards]) {
+        for (size_t i = 0; i < num_shards; i++) {
+            for (std::atomic<uint64_t>& bucket : this->m_shards[i].buckets) bucket.store(0, std::memory_order_relaxed);
+            this->m_shards[i].count.store(0, std::memory_order_relaxed);
+            this->m_shards[i].sum.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    size_t Histogram::bucket(uint64_t value) {
+        if (value < sub_count) return value;
+
+        /* The bucket is determined by the position of the leading bit and the sub_bits bits following it */
+        size_t exponent = 63 - __builtin_clzll(value);
+        size_t mantissa = (value >> (exponent - sub_bits)) & (sub_count - 1);
+        return (exponent - sub_bits + 1) * sub_count + mantissa;
+    }
+
+    uint64_t Histogram::bucket_start(size_t bucket) {
+        if (bucket < sub_count) return bucket;
+
+        size_t exponent = bucket / sub_count + sub_bits - 1;
+        size_t mantissa = bucket % sub_count;
+        return (sub_count + mantissa) << (exponent - sub_bits);
+    }
+
+    void Histogram::record(uint64_t value) {
+        Shard& shard = this->m_shards[thread_shard()];
+        shard.buckets[bucket(value)].fetch_add(1, std::memory_order_relaxed);
+        shard.count.fetch_add(1, std::memory_order_relaxed);
+        shard.sum.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    Histogram::Snapshot Histogram::snapshot() const {
+        Snapshot snapshot;
+        snapshot.buckets.resize(num_buckets, 0);
+        snapshot.count = 0;
+        snapshot.sum = 0;
+
+        for (size_t i = 0; i < num_shards; i++) {
+            for (size_t b = 0; b < num_buckets; b++) {
+                snapshot.buckets[b] += this->m_shards[i].buckets[b].load(std::memory_order_relaxed);
+            }
+            snapshot.count += this->m_shards[i].count.load(std::memory_order_relaxed);
+            snapshot.sum += this->m_shards[i].sum.load(std::memory_order_relaxed);
+        }
+
+        return snapshot;
+    }
+
+    uint64_t Histogram::Snapshot::quantile(double q) const {
+        uint64_t total = 0;
+        for (uint64_t b : this->buckets) total += b;
+        if (total == 0) return 0;
+
+        uint64_t rank = std::max((uint64_t)1, (uint64_t)(q * total + 0.5));
+        uint64_t seen = 0;
+
+        for (size_t b = 0; b < this->buckets.size(); b++) {
+            seen += this->buckets[b];
+            if (seen >= rank) {
+                uint64_t start = bucket_start(b);
+                uint64_t end = b + 1 < num_buckets ? bucket_start(b + 1) : start;
+                return start + (end - start) / 2;
+            }
+        }
+
+        return 0;
+    }
+
+    template <typename M>
+    M& Registry::get(std::map<std::string, Entry<M>>& metrics, const std::string& name, const std::string& labels) {
+        std::unique_lock<std::mutex> lock{this->m_mutex};
+        Entry<M>& entry = metrics[name + "{" + labels + "}"];
+
+        if (!entry.metric) {
+            entry.name = name;
+            entry.labels = labels;
+            entry.metric.reset(new M());
+        }
+
+        return *entry.metric;
+    }
+
+    Counter& Registry::counter(const std::string& name, const std::string& labels) {
+        return this->get(this->m_counters, name, labels);
+    }
+
+    Gauge& Registry::gauge(const std::string& name, const std::string& labels) {
+        return this->get(this->m_gauges, name, labels);
+    }
+
+    Histogram& Registry::histogram(const std::string& name, const std::string& labels) {
+        return this->get(this->m_histograms, name, labels);
+    }
+
+    namespace {
+        /**
+         * Formats the name and labels of a metric, with an extra label.
+         */
+        std::string series(const std::string& name, const std::string& labels, const std::string& extra="") {
+            std::string all = labels;
+            if (all != "" && extra != "") all += ",";
+            all += extra;
+            return all == "" ? name : name + "{" + all + "}";
+        }
+
+        /**
+         * Adds a TYPE line for a metric, unless the last metric rendered had the same name.
+         */
+        void type_line(std::string& text, std::string& last_name, const std::string& name, const std::string& type) {
+            if (name == last_name) return;
+            text += "# TYPE " + name + " " + type + "\n";
+            last_name = name;
+        }
+    } // anonymous
+
+    std::string Registry::render() {
+        std::unique_lock<std::mutex> lock{this->m_mutex};
+        std::string text;
+        std::string last_name;
+
+        for (auto& entry : this->m_counters) {
+            type_line(text, last_name, entry.second.name, "counter");
+            text += series(entry.second.name, entry.second.labels) + " " + std::to_string(entry.second.metric->value()) + "\n";
+        }
+
+        for (auto& entry : this->m_gauges) {
+            type_line(text, last_name, entry.second.name, "gauge");
+            text += series(entry.second.name, entry.second.labels) + " " + std::to_string(entry.second.metric->value()) + "\n";
+        }
+
+        for (auto& entry : this->m_histograms) {
+            const std::string& name = entry.second.name;
+            const std::string& labels = entry.second.labels;
+            Histogram::Snapshot snapshot = entry.second.metric->snapshot();
+
+            type_line(text, last_name, name, "summary");
+            for (const char* q : {"0.5", "0.9", "0.99", "0.999"}) {
+                text += series(name, labels, std::string("quantile=\"") + q + "\"") + " " +
+                    std::to_string(snapshot.quantile(std::stod(q))) + "\n";
+            }
+            text += series(name + "_sum", labels) + " " + std::to_string(snapshot.sum) + "\n";
+            text += series(name + "_count", labels) + " " + std::to_string(snapshot.count) + "\n";
+        }
+
+        return text;
+    }
+
+    Registry& registry() {
+        static Registry registry;
+        return registry;
+    }
+}
@@ -0,0 +1,222 @@
+#include "parallel.h"
+#include "cancellation.h"
+#include "metrics.h"
+#include "perf.h"
+#include "tracing.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <pthread.h>
+#include <sched.h>
+
+namespace parallel {
+    namespace {
+        std::atomic<size_t> split_threshold{1 << 17};
+        std::atomic<unsigned int> thread_limit{std::max(1u, std::thread::hardware_concurrency())};
+        std::atomic<unsigned int> busy_helpers{0};
+        thread_local bool t_serial = false;
+
+        metrics::Gauge& helpers_gauge = metrics::registry().gauge("knn_scan_helper_threads");
+
+        /**
+         * Reserves up to wanted helper threads from the budget.
+         * @return          The number of helpers reserved.
+         */
+        unsigned int reserve(unsigned int wanted) {
+            unsigned int limit = max_threads() - 1;
+            unsigned int busy = busy_helpers.load();
+
+            while (true) {
+                unsigned int granted = busy >= limit ? 0 : std::min(wanted, limit - busy);
+                if (granted == 0) return 0;
+                if (busy_helpers.compare_exchange_weak(busy, busy + granted)) return granted;
+            }
+        }
+
+        void release(unsigned int helpers) {
+            if (helpers > 0) busy_helpers.fetch_sub(helpers);
+        }
+
+        /**
+         * @return The CPUs the calling thread may run on.
+         */
+        cpu_set_t affinity() {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            if (sched_getaffinity(0, sizeof(cpus), &cpus) != 0) {
+                for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) CPU_SET(cpu, &cpus);
+            }
+            return cpus;
+        }
+
+        /* Taken by the main thread before it starts any other, so before any thread is pinned */
+        const cpu_set_t process_cpus = affinity();
+
+        /**
+         * The helper threads of split scans. A helper is only started when none is idle, so there are never more
+         * than the most helpers reserved from the budget at once, and they are never stopped.
+         */
+        class Helpers {
+            /* A task, and what is called once its helper is idle again (so the helper can be reused right away) */
+            typedef std::pair<std::function<void()>, std::function<void()>> Task;
+
+            std::mutex m_mutex;
+            std::condition_variable m_wakeup;
+            std::deque<Task> m_tasks;
+            unsigned int m_started;
+            unsigned int m_idle;                    // Idle helpers without a task queued for them
+            std::function<void(unsigned int)> m_place;
+
+            void serve(unsigned int i, Task task) {
+                pthread_setaffinity_np(pthread_self(), sizeof(process_cpus), &process_cpus);
+                std::function<void(unsigned int)> place;
+                {
+                    std::unique_lock<std::mutex> lock{this->m_mutex};
+                    place = this->m_place;
+                }
+                if (place) place(i);
+
+                while (true) {
+                    task.first();
+                    {
+                        std::unique_lock<std::mutex> lock{this->m_mutex};
+                        this->m_idle++;
+                    }
+                    task.second();
+
+                    std::unique_lock<std::mutex> lock{this->m_mutex};
+                    this->m_wakeup.wait(lock, [this]() { return !this->m_tasks.empty(); });
+                    task = std::move(this->m_tasks.front());
+                    this->m_tasks.pop_front();
+                }
+            }
+
+            public:
+                Helpers() : m_started(0), m_idle(0) { }
+
+                void set_placement(std::function<void(unsigned int)> place) {
+                    std::unique_lock<std::mutex> lock{this->m_mutex};
+                    this->m_place = place;
+                }
+
+                /**
+                 * Runs a task on an idle helper, or on a new one, and then calls done.
+                 * @throws std::system_error if a thread is needed and can't be started.
+                 */
+                void run(std::function<void()> task, std::function<void()> done) {
+                    std::unique_lock<std::mutex> lock{this->m_mutex};
+                    if (this->m_idle > 0) {
+                        this->m_idle--;
+                        this->m_tasks.push_back(Task(std::move(task), std::move(done)));
+                        this->m_wakeup.notify_one();
+                        return;
+                    }
+
+                    std::thread(&Helpers::serve, this, this->m_started, Task(std::move(task), std::move(done))).detach();
+                    this->m_started++;
+                }
+        };
+
+        /* Never destroyed, as its threads are never joined */
+        Helpers& helper_pool() {
+            static Helpers* pool = new Helpers();
+            return *pool;
+        }
+    } // anonymous
+
+    void set_helper_placement(std::function<void(unsigned int)> place) { helper_pool().set_placement(place); }
+
+    void set_threshold(size_t points) { split_threshold.store(points); }
+    size_t threshold() { return split_threshold.load(); }
+
+    void set_max_threads(unsigned int threads) { thread_limit.store(std::max(1u, threads)); }
+    unsigned int max_threads() { return thread_limit.load(); }
+
+    Serial::Serial(bool serial) : m_previous(t_serial) { t_serial = t_serial || serial; }
+    Serial::~Serial() { t_serial = this->m_previous; }
+
+    size_t partitions(size_t n, size_t min_size) {
+        size_t points = threshold();
+        if (t_serial || points == 0 || n < points || max_threads() < 2) return 1;
+
+        size_t partition_size = std::max<size_t>(std::max<size_t>(points / 2, min_size), 1);
+        return std::max<size_t>(1, std::min<size_t>(max_threads(), n / partition_size));
+    }
+
+    void for_partitions(size_t n, size_t num_partitions, const std::function<void(size_t, size_t, size_t)>& body) {
+        std::atomic<size_t> next{0};
+        std::mutex error_mutex;
+        std::exception_ptr error;
+
+        /* Every thread takes the next partition until there are none left */
+        auto work = [&]() {
+            try {
+                for (size_t part = next.fetch_add(1); part < num_partitions; part = next.fetch_add(1)) {
+                    body(part, n * part / num_partitions, n * (part + 1) / num_partitions);
+                }
+            } catch (...) {
+                std::lock_guard<std::mutex> lock{error_mutex};
+                if (!error) error = std::current_exception();
+                next = num_partitions;
+            }
+        };
+
+        unsigned int helpers = num_partitions > 1 ? reserve(num_partitions - 1) : 0;
+        cancellation::Token* token = cancellation::current();
+        tracing::Session* trace = tracing::current_session();
+        perf::Session* counters = perf::current_session();
+
+        /* The caller waits for its helpers, whose tasks reference its stack */
+        std::mutex done_mutex;
+        std::condition_variable done;
+        unsigned int running = 0;
+
+        for (unsigned int i = 0; i < helpers; i++) {
+            {
+                std::unique_lock<std::mutex> lock{done_mutex};
+                running++;
+            }
+            try {
+                helper_pool().run([&]() {
+                        cancellation::Attach cancel{token};
+                        tracing::Attach attach{trace};
+                        perf::Attach count{counters};
+                        tracing::Span span{"scan_helper", "knn"};
+                        perf::Scope counted{perf::scan_scope};
+                        work();
+                    }, [&]() {
+                        std::unique_lock<std::mutex> lock{done_mutex};
+                        if (--running == 0) done.notify_one();
+                    });
+            } catch (std::system_error& e) {
+                /* Out of threads, the partitions are scanned by the threads already running */
+                {
+                    std::unique_lock<std::mutex> lock{done_mutex};
+                    running--;
+                }
+                release(helpers - i);
+                helpers = i;
+                break;
+            }
+        }
+        helpers_gauge.add(helpers);
+
+        work();
+        {
+            std::unique_lock<std::mutex> lock{done_mutex};
+            done.wait(lock, [&running]() { return running == 0; });
+        }
+
+        helpers_gauge.sub(helpers);
+        release(helpers);
+        if (error) std::rethrow_exception(error);
+    }
+}
@@ -0,0 +1,170 @@
+#include "perf.h"
+#include "metrics.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace perf {
+    const char* const event_names[num_events] = {"cycles", "instructions", "llc_misses", "branch_misses"};
+    const char* const kind_names[num_kinds] = {"command", "scan"};
+
+    thread_local Session* t_session = nullptr;
+
+    namespace {
+        std::atomic<bool> counting{false};
+
+        const uint64_t event_configs[num_events] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+
+        /**
+         * The counters of a thread, opened as a group so they all count over the same stretches.
+         */
+        struct ThreadCounters {
+            int fds[num_events];
+            bool tried;             // Whether opening them was tried (it isn't retried)
+            int error;              // The errno of the failed open, 0 if they are open
+
+            ThreadCounters() : tried(false), error(0) {
+                for (int& fd : this->fds) fd = -1;
+            }
+
+            ~ThreadCounters() { this->close(); }
+
+            void close() {
+                for (int& fd : this->fds) {
+                    if (fd >= 0) ::close(fd);
+                    fd = -1;
+                }
+            }
+
+            bool open() {
+                if (this->tried) return this->error == 0;
+                this->tried = true;
+
+                for (int e = 0; e < num_events; e++) {
+                    struct perf_event_attr attr;
+                    memset(&attr, 0, sizeof(attr));
+                    attr.size = sizeof(attr);
+                    attr.type = PERF_TYPE_HARDWARE;
+                    attr.config = event_configs[e];
+                    attr.exclude_kernel = 1;
+                    attr.exclude_hv = 1;
+                    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+                    /* The calling thread, on any CPU */
+                    long fd = syscall(__NR_perf_event_open, &attr, 0, -1, e == 0 ? -1 : this->fds[0], PERF_FLAG_FD_CLOEXEC);
+                    if (fd < 0) {
+                        this->error = errno;
+                        this->close();
+                        return false;
+                    }
+                    this->fds[e] = fd;
+                }
+
+                return true;
+            }
+
+            bool read(Counts& counts) {
+                if (!this->open()) return false;
+
+                /* The number of events, the times the group was enabled and running, and then the counts */
+                uint64_t data[3 + num_events];
+                if (::read(this->fds[0], data, sizeof(data)) != (ssize_t)sizeof(data) || data[2] == 0) return false;
+
+                /* When the group shared the counters with other groups, it only counted part of the time */
+                double scale = data[2] < data[1] ? (double)data[1] / data[2] : 1;
+                for (int e = 0; e < num_events; e++) counts.values[e] = (uint64_t)(data[3 + e] * scale);
+                return true;
+            }
+        };
+
+        thread_local ThreadCounters t_counters;
+
+        std::string describe_error(int error) {
+            if (error == EACCES || error == EPERM) {
+                return std::string(strerror(error)) + " (see /proc/sys/kernel/perf_event_paranoid)";
+            }
+            if (error == ENOENT || error == EOPNOTSUPP || error == ENODEV) {
+                return std::string(strerror(error)) + " (no hardware counters)";
+            }
+            return strerror(error);
+        }
+
+        metrics::Counter& events_metric(Kind kind, int event) {
+            static metrics::Counter* metrics[num_kinds][num_events];
+            static std::once_flag registered;
+            std::call_once(registered, []() {
+                for (int k = 0; k < num_kinds; k++) {
+                    for (int e = 0; e < num_events; e++) {
+                        metrics[k][e] = &metrics::registry().counter("knn_perf_events_total",
+                                std::string("scope=\"") + kind_names[k] + "\",event=\"" + event_names[e] + "\"");
+                    }
+                }
+            });
+            return *metrics[kind][event];
+        }
+    } // anonymous
+
+    Counts Counts::since(const Counts& other) const {
+        Counts counts;
+        for (int e = 0; e < num_events; e++) {
+            counts.values[e] = this->values[e] > other.values[e] ? this->values[e] - other.values[e] : 0;
+        }
+        return counts;
+    }
+
+    double Counts::ipc() const {
+        return this->values[cycles] == 0 ? 0 : (double)this->values[instructions] / this->values[cycles];
+    }
+
+    std::string Counts::describe() const {
+        char ipc[32];
+        snprintf(ipc, sizeof(ipc), "%.2f", this->ipc());
+        return std::to_string(this->values[cycles]) + " cycles, " + std::to_string(this->values[instructions]) +
+            " instructions (IPC " + ipc + "), " + std::to_string(this->values[llc_misses]) + " LLC misses, " +
+            std::to_string(this->values[branch_misses]) + " branch misses";
+    }
+
+    bool enable(std::string& reason) {
+        if (!t_counters.open()) {
+            reason = describe_error(t_counters.error);
+            return false;
+        }
+
+        counting.store(true);
+        return true;
+    }
+
+    bool enabled() { return counting.load(std::memory_order_relaxed); }
+
+    bool read(Counts& counts) { return enabled() && t_counters.read(counts); }
+
+    void Session::add(Kind kind, const Counts& counts) {
+        std::lock_guard<std::mutex> lock{this->m_mutex};
+        this->m_counts[kind] += counts;
+        this->m_scopes[kind]++;
+    }
+
+    Counts Session::counts(Kind kind) const {
+        std::lock_guard<std::mutex> lock{this->m_mutex};
+        return this->m_counts[kind];
+    }
+
+    size_t Session::scopes(Kind kind) const {
+        std::lock_guard<std::mutex> lock{this->m_mutex};
+        return this->m_scopes[kind];
+    }
+
+    Scope::~Scope() {
+        Counts end;
+        if (!this->m_active || !t_counters.read(end)) return;
+
+        Counts counts = end.since(this->m_start);
+        for (int e = 0; e < num_events; e++) events_metric(this->m_kind, e).add(counts.values[e]);
+        if (t_session != nullptr) t_session->add(this->m_kind, counts);
+    }
+}
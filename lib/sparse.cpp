@@ -0,0 +1,157 @@
+#include "knn.h"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <limits>
+
+namespace {
+    const char* skip_spaces(const char* s) {
+        while (*s != '\0' && std::isspace((unsigned char)*s)) s++;
+        return s;
+    }
+
+    const char* skip_token(const char* s) {
+        while (*s != '\0' && !std::isspace((unsigned char)*s)) s++;
+        return s;
+    }
+
+    bool ends_with(const std::string& s, const std::string& suffix) {
+        return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+    }
+} // anonymous
+
+namespace knn {
+    misc::array<double> SparseVector::dense(size_t dims) const {
+        misc::array<double> features(dims);
+        for (size_t i = 0; i < dims; i++) features[i] = 0;
+
+        for (size_t i = 0; i < this->nnz(); i++) {
+            if (this->indices[i] >= dims) {
+                throw std::invalid_argument("feature " + std::to_string(this->indices[i] + 1) + " is out of range (" +
+                        std::to_string(dims) + " features)");
+            }
+            features[this->indices[i]] = this->values[i];
+        }
+
+        return features;
+    }
+
+    SparseVector SparseVector::from_dense(const double* features, size_t n) {
+        SparseVector point;
+        for (size_t i = 0; i < n; i++) {
+            if (features[i] == 0) continue;
+            point.indices.push_back(i);
+            point.values.push_back(features[i]);
+        }
+        return point;
+    }
+
+    void SparseDataSet::add(const std::string& class_name, const SparseVector& point) {
+        auto entry = this->m_dictionary.insert(std::make_pair(class_name, (uint32_t)this->m_classes.size()));
+        if (entry.second) this->m_classes.push_back(class_name);
+        this->m_labels.push_back(entry.first->second);
+
+        this->m_indices.insert(this->m_indices.end(), point.indices.begin(), point.indices.end());
+        this->m_values.insert(this->m_values.end(), point.values.begin(), point.values.end());
+        this->m_offsets.push_back(this->m_indices.size());
+        if (point.nnz() > 0) this->m_dims = std::max<size_t>(this->m_dims, point.indices.back() + 1);
+    }
+
+    void SparseDataSet::shrink_to_fit() {
+        this->m_offsets.shrink_to_fit();
+        this->m_indices.shrink_to_fit();
+        this->m_values.shrink_to_fit();
+        this->m_labels.shrink_to_fit();
+    }
+
+    size_t SparseDataSet::memory_usage() const {
+        size_t bytes = sizeof(*this) + this->m_offsets.capacity() * sizeof(size_t) +
+            this->m_indices.capacity() * sizeof(uint32_t) + this->m_values.capacity() * sizeof(double) +
+            this->m_labels.capacity() * sizeof(uint32_t) + this->m_classes.capacity() * sizeof(std::string);
+
+        /* Every class is held by the list of classes and by a node of the dictionary */
+        for (const std::string& class_name : this->m_classes) {
+            bytes += 2 * accounting::heap_usage(class_name) + sizeof(std::pair<const std::string, uint32_t>) +
+                2 * sizeof(void*);
+        }
+        return bytes;
+    }
+
+    void parse_sparse_point(const std::string& line, bool classified, std::string& label, SparseVector& point) {
+        point.clear();
+        label.clear();
+
+        const char* s = skip_spaces(line.c_str());
+        const char* end = skip_token(s);
+        if (std::find(s, end, ':') == end) {
+            label.assign(s, end);
+            s = skip_spaces(end);
+        }
+        if (classified && label == "") throw std::invalid_argument("sparse point has no label: " + line);
+
+        bool sorted = true;
+        while (*s != '\0') {
+            char* index_end;
+            char* value_end;
+            errno = 0;
+            unsigned long index = std::strtoul(s, &index_end, 10);
+            if (index_end == s || *index_end != ':' || index == 0 || errno == ERANGE ||
+                    index > std::numeric_limits<uint32_t>::max()) {
+                throw std::invalid_argument("malformed sparse feature in: " + line);
+            }
+
+            double value = std::strtod(index_end + 1, &value_end);
+            if (value_end == index_end + 1 || (*value_end != '\0' && !std::isspace((unsigned char)*value_end))) {
+                throw std::invalid_argument("malformed sparse feature in: " + line);
+            }
+            s = skip_spaces(value_end);
+
+            if (value == 0) continue;
+            if (!point.indices.empty() && index - 1 <= point.indices.back()) sorted = false;
+            point.indices.push_back(index - 1);
+            point.values.push_back(value);
+        }
+
+        if (sorted) return;
+
+        /* Sort the features by index, and reject repeated ones */
+        std::vector<std::pair<uint32_t, double>> features;
+        for (size_t i = 0; i < point.nnz(); i++) features.push_back(std::make_pair(point.indices[i], point.values[i]));
+        std::sort(features.begin(), features.end());
+
+        for (size_t i = 0; i < features.size(); i++) {
+            if (i > 0 && features[i].first == features[i - 1].first) {
+                throw std::invalid_argument("sparse feature " + std::to_string(features[i].first + 1) + " repeats in: " + line);
+            }
+            point.indices[i] = features[i].first;
+            point.values[i] = features[i].second;
+        }
+    }
+
+    SparseDataSet* read_sparse_dataset(std::function<std::string(std::string&)> getline, std::function<void(size_t)> reserve) {
+        tracing::Span span{"initialize_dataset", "knn"};
+        SparseDataSet* data_set = new SparseDataSet();
+        std::string line;
+        std::string label;
+        SparseVector point;
+
+        try {
+            while (getline(line) != "") {
+                parse_sparse_point(line, true, label, point);
+                if (reserve) reserve(SparseDataSet::point_usage(point.nnz()));
+                data_set->add(label, point);
+            }
+        } catch (...) {
+            delete data_set;
+            throw;
+        }
+
+        data_set->shrink_to_fit();
+        return data_set;
+    }
+
+    bool is_sparse_file(const std::string& path) {
+        return ends_with(path, ".svm") || ends_with(path, ".libsvm");
+    }
+}
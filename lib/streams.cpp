@@ -1,4 +1,5 @@
 #include "streams.h"
+#include "metrics.h"
 #include <iostream>
 #include <sys/socket.h>
 #include <stdio.h>
@@ -6,11 +7,57 @@
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <string.h>
+#include <algorithm>
+#include <vector>
+#include <poll.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+
+namespace {
+    metrics::Counter& bytes_sent_total = metrics::registry().counter("knn_socket_bytes_sent_total");
+    metrics::Counter& bytes_received_total = metrics::registry().counter("knn_socket_bytes_received_total");
+
+    /**
+     * @return The error of a failed recv.
+     */
+    std::ios_base::failure receive_error(int error) {
+        if (error == EAGAIN || error == EWOULDBLOCK) {
+            return std::ios_base::failure("timed out while receiving from socket");
+        }
+        return std::ios_base::failure("error encountered while receiving from socket, errno: " + std::to_string(error));
+    }
+
+    struct sockaddr_un unix_address(const std::string& path) {
+        struct sockaddr_un addr = {0};
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path)) throw std::ios_base::failure("socket path is too long: " + path);
+        memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+        return addr;
+    }
+
+    /* The rings' states take the first page of a shared memory stream, followed by the data of each ring */
+    const size_t rings_size = 4096;
+
+    size_t memory_size(size_t capacity) { return rings_size + 2 * capacity; }
+
+    /**
+     * Wakes the other side of a shared memory stream if it waits (or is about to) on an event, after what it waits
+     * for was published.
+     */
+    void notify(std::atomic<uint32_t>& waiting, int event) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiting.load(std::memory_order_relaxed) && waiting.exchange(0)) {
+            uint64_t one = 1;
+            if (write(event, &one, sizeof(one)) < 0) { }
+        }
+    }
+} // anonymous
 
 namespace streams {
     // server
-    TCPSocket::TCPSocket(const char* ip, int port) {
-        this->fd = socket(AF_INET, SOCK_STREAM, 0);
+    TCPSocket::TCPSocket(const char* ip, int port) : SocketStream(socket(AF_INET, SOCK_STREAM, 0)) {
         if (this->fd < 0) {
             throw std::ios_base::failure("error encountered while initializing socket, errno: " +
                     std::to_string(errno));
@@ -47,6 +94,16 @@ namespace streams {
         }
     }
 
+    void SocketStream::set_receive_timeout(int timeout) {
+        struct timeval s_timeout = {0};
+        s_timeout.tv_sec = timeout;
+
+        if (setsockopt(this->fd, SOL_SOCKET, SO_RCVTIMEO, &s_timeout, sizeof(s_timeout)) < 0) {
+            throw std::ios_base::failure("error encountered while setting the receive timeout, errno: " +
+                    std::to_string(errno));
+        }
+    }
+
     TCPSocket TCPSocket::accept_connection(int timeout) {
         struct sockaddr_in client;
         unsigned int addr_len = sizeof(client);
@@ -81,45 +138,59 @@ namespace streams {
         return TCPSocket(client_sock);
     }
 
-     char* TCPSocket::receive(size_t& size, bool force_size) {
+    char* SocketStream::receive(size_t& size, bool force_size) {
         if (size == 0) return nullptr;
 
         char* data = new char[size];
-        int bytes_read = 0;
 
         if (!force_size) {
-            size = recv(this->fd, data, size, 0);
-
-            if (size < 0) {
-                throw std::ios_base::failure("error encountered while receiving from socket, errno: " +
-                        std::to_string(errno));
-            } else if (size == 0) {       // Remote socket closed connection
+            ssize_t received = recv(this->fd, data, size, 0);
+
+            if (received < 0) {
+                int error = errno;
+                delete[] data;
+                throw receive_error(error);
+            } else if (received == 0) {       // Remote socket closed connection
+                delete[] data;
                 return nullptr;
             }
+            size = received;
+
+            this->m_bytes_received += size;
+            bytes_received_total.add(size);
         } else {
-            size_t i = 0;
+            try {
+                this->receive_into(data, size);
+            } catch (...) {
+                delete[] data;
+                throw;
+            }
+        }
 
-            while (i < size) {      // This will continue its loop until the number of bytes received equals the number requested.
-                bytes_read = recv(this->fd, data + i, size - i, 0);
+        return data;
+    }
 
-                if (bytes_read < 0) {
-                    delete[] data;
-                    throw std::ios_base::failure("error encountered while receiving from socket, errno: " +
-                            std::to_string(errno));
+    void SocketStream::receive_into(void* buffer, size_t size) {
+        char* data = (char*)buffer;
+        size_t i = 0;
 
-                } else if (bytes_read == 0) {
-                    delete[] data;
-                    throw std::ios_base::failure("socket closed before forced reception of data");
-                }
+        while (i < size) {      // This will continue its loop until the number of bytes received equals the number requested.
+            ssize_t bytes_read = recv(this->fd, data + i, size - i, 0);
 
-                i += bytes_read;
+            if (bytes_read < 0) {
+                throw receive_error(errno);
+            } else if (bytes_read == 0) {
+                throw std::ios_base::failure("socket closed before forced reception of data");
             }
+
+            i += bytes_read;
         }
 
-        return data;
+        this->m_bytes_received += size;
+        bytes_received_total.add(size);
     }
 
-    void TCPSocket::send(const void* data, size_t size) {
+    void SocketStream::send(const void* data, size_t size) {
         int bytes_sent;
         size_t i = 0;
 
@@ -131,9 +202,12 @@ namespace streams {
             }
             i += bytes_sent;
         }
+
+        this->m_bytes_sent += size;
+        bytes_sent_total.add(size);
     }
 
-    void TCPSocket::close() {
+    void SocketStream::close() {
         if (::close(this->fd) < 0) {
             throw std::ios_base::failure("error encountered while closing socket, errno: " +
                     std::to_string(errno));
@@ -176,5 +250,496 @@ namespace streams {
 
         return a;
     }
-}
 
+    UnixSocket::UnixSocket() : SocketStream(socket(AF_UNIX, SOCK_STREAM, 0)) {
+        if (this->fd < 0) {
+            throw std::ios_base::failure("error encountered while initializing socket, errno: " +
+                    std::to_string(errno));
+        }
+    }
+
+    UnixSocket::UnixSocket(const std::string& dest_path) : UnixSocket() {
+        try {
+            this->connect_to(dest_path);
+        } catch (...) {
+            ::close(this->fd);
+            throw;
+        }
+    }
+
+    void UnixSocket::bind_to(const std::string& path) {
+        struct sockaddr_un addr = unix_address(path);
+
+        /* Only a socket is replaced, never a file which happens to be at the path */
+        struct stat status;
+        if (stat(path.c_str(), &status) == 0 && S_ISSOCK(status.st_mode)) unlink(path.c_str());
+
+        if (bind(this->fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+            throw std::ios_base::failure("error encountered while binding socket to " + path + ", errno: " +
+                    std::to_string(errno));
+        }
+    }
+
+    void UnixSocket::listening(int buffer) {
+        if (listen(this->fd, buffer) < 0) {
+            throw std::ios_base::failure("error encountered while attempting to listen for connections, errno: " +
+                    std::to_string(errno));
+        }
+    }
+
+    UnixSocket UnixSocket::accept_connection() {
+        int client_sock = accept(this->fd, NULL, NULL);
+        if (client_sock < 0) {
+            throw std::ios_base::failure("error encountered while attempting to accept an incoming connection, errno: " +
+                    std::to_string(errno));
+        }
+
+        return UnixSocket(client_sock);
+    }
+
+    void UnixSocket::connect_to(const std::string& path) {
+        struct sockaddr_un addr = unix_address(path);
+
+        if (connect(this->fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+            throw std::ios_base::failure("error encountered while attempting to connect to " + path + ", errno: " +
+                    std::to_string(errno));
+        }
+    }
+
+    Address UnixSocket::get_address() {
+        struct sockaddr_un addr = {0};
+        socklen_t len = sizeof(addr);
+        struct ucred peer = {0};
+        socklen_t peer_len = sizeof(peer);
+
+        if (getsockname(this->fd, (struct sockaddr*)&addr, &len) < 0 ||
+                getsockopt(this->fd, SOL_SOCKET, SO_PEERCRED, &peer, &peer_len) < 0) {
+            throw std::ios_base::failure("error encountered while getting socket name, errno: " +
+                    std::to_string(errno));
+        }
+
+        Address a;
+        a.ip = std::string(addr.sun_path);
+        a.port = peer.pid;
+
+        return a;
+    }
+
+    void UnixSocket::send_descriptors(const void* data, size_t size, const int* fds, size_t num_fds) {
+        std::vector<char> control(CMSG_SPACE(num_fds * sizeof(int)), 0);
+        struct iovec iov = {const_cast<void*>(data), size};
+        struct msghdr message = {0};
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control.data();
+        message.msg_controllen = control.size();
+
+        struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(num_fds * sizeof(int));
+        memcpy(CMSG_DATA(header), fds, num_fds * sizeof(int));
+
+        ssize_t sent = sendmsg(this->fd, &message, 0);
+        if (sent < 0) {
+            throw std::ios_base::failure("error encountered while sending descriptors, errno: " + std::to_string(errno));
+        }
+
+        /* The descriptors went with the first byte */
+        if ((size_t)sent < size) this->send((const char*)data + sent, size - sent);
+        else {
+            this->m_bytes_sent += size;
+            bytes_sent_total.add(size);
+        }
+    }
+
+    void UnixSocket::receive_descriptors(void* data, size_t size, int* fds, size_t num_fds) {
+        std::vector<char> control(CMSG_SPACE(num_fds * sizeof(int)), 0);
+        struct iovec iov = {data, size};
+        struct msghdr message = {0};
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control.data();
+        message.msg_controllen = control.size();
+
+        ssize_t received = recvmsg(this->fd, &message, MSG_CMSG_CLOEXEC);
+        if (received < 0) throw receive_error(errno);
+        if (received == 0) throw std::ios_base::failure("socket closed before forced reception of data");
+
+        struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+        if (header == nullptr || header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS ||
+                header->cmsg_len != CMSG_LEN(num_fds * sizeof(int)) || (message.msg_flags & MSG_CTRUNC)) {
+            throw std::ios_base::failure("expected " + std::to_string(num_fds) + " descriptors from socket");
+        }
+        memcpy(fds, CMSG_DATA(header), num_fds * sizeof(int));
+
+        this->m_bytes_received += received;
+        bytes_received_total.add(received);
+        if ((size_t)received < size) this->receive_into((char*)data + received, size - received);
+    }
+
+    /**
+     * The state of a ring, at the start of the shared memory. The positions only grow, so the ring holds
+     * tail - head bytes (from head % capacity), and each is only written by one side.
+     * The waiting flags tell the other side to signal its event (see notify).
+     */
+    struct SharedMemoryStream::Ring {
+        alignas(64) std::atomic<uint64_t> head;         // Received up to here
+        alignas(64) std::atomic<uint64_t> tail;         // Sent up to here
+        alignas(64) std::atomic<uint32_t> closed;
+        std::atomic<uint32_t> receiver_waiting;
+        std::atomic<uint32_t> sender_waiting;
+
+        Ring() : head(0), tail(0), closed(0), receiver_waiting(0), sender_waiting(0) { }
+    };
+
+    SharedMemoryStream::SharedMemoryStream(UnixSocket connection, size_t capacity) : m_control(connection),
+        m_memory(nullptr), m_timeout(-1), m_peer_gone(false), m_bytes_sent(0), m_bytes_received(0) {
+        for (int& event : this->m_events) event = -1;
+
+        size_t ring_capacity = 4096;
+        while (ring_capacity < capacity) ring_capacity *= 2;
+
+        int memory = -1;
+        try {
+            memory = memfd_create("knn-stream", MFD_CLOEXEC);
+            if (memory < 0 || ftruncate(memory, memory_size(ring_capacity)) < 0) {
+                throw std::ios_base::failure("error encountered while creating shared memory, errno: " +
+                        std::to_string(errno));
+            }
+
+            for (int& event : this->m_events) {
+                event = eventfd(0, EFD_CLOEXEC);
+                if (event < 0) {
+                    throw std::ios_base::failure("error encountered while creating an eventfd, errno: " +
+                            std::to_string(errno));
+                }
+            }
+            this->attach(memory, ring_capacity, true);
+
+            /* The client maps the same memory and waits on the same events */
+            uint64_t client_capacity = ring_capacity;
+            int fds[5] = {memory, this->m_events[0], this->m_events[1], this->m_events[2], this->m_events[3]};
+            this->m_control.send_descriptors(&client_capacity, sizeof(client_capacity), fds, 5);
+        } catch (...) {
+            if (memory >= 0) ::close(memory);
+            this->release();
+            try { this->m_control.close(); } catch (std::ios_base::failure& e) { }
+            throw;
+        }
+
+        /* The mapping holds the memory */
+        ::close(memory);
+    }
+
+    SharedMemoryStream::SharedMemoryStream(const std::string& dest_path) : m_control(dest_path), m_memory(nullptr),
+        m_timeout(-1), m_peer_gone(false), m_bytes_sent(0), m_bytes_received(0) {
+        uint64_t capacity;
+        int fds[5];
+        try {
+            this->m_control.receive_descriptors(&capacity, sizeof(capacity), fds, 5);
+        } catch (...) {
+            try { this->m_control.close(); } catch (std::ios_base::failure& e) { }
+            throw;
+        }
+        for (int i = 0; i < 4; i++) this->m_events[i] = fds[i + 1];
+
+        try {
+            struct stat status;
+            if (capacity == 0 || (capacity & (capacity - 1)) != 0 || fstat(fds[0], &status) < 0 ||
+                    (uint64_t)status.st_size < memory_size(capacity)) {
+                throw std::ios_base::failure("server offered malformed shared memory");
+            }
+            this->attach(fds[0], capacity, false);
+        } catch (...) {
+            ::close(fds[0]);
+            this->release();
+            try { this->m_control.close(); } catch (std::ios_base::failure& e) { }
+            throw;
+        }
+
+        ::close(fds[0]);
+    }
+
+    void SharedMemoryStream::attach(int memory, size_t capacity, bool server) {
+        size_t size = memory_size(capacity);
+        void* mapped = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, memory, 0);
+        if (mapped == MAP_FAILED) {
+            throw std::ios_base::failure("error encountered while mapping shared memory, errno: " + std::to_string(errno));
+        }
+
+        this->m_memory = (char*)mapped;
+        this->m_memory_size = size;
+        this->m_capacity = capacity;
+
+        /* The server sends on the first ring, and the client on the second */
+        Ring* rings = (Ring*)this->m_memory;
+        char* data = this->m_memory + rings_size;
+        if (server) {
+            new (&rings[0]) Ring();
+            new (&rings[1]) Ring();
+        }
+
+        int side = server ? 0 : 1;
+        this->m_send = &rings[side];
+        this->m_receive = &rings[1 - side];
+        this->m_send_data = data + side * capacity;
+        this->m_receive_data = data + (1 - side) * capacity;
+        this->m_send_data_event = this->m_events[2 * side];
+        this->m_send_space_event = this->m_events[2 * side + 1];
+        this->m_receive_data_event = this->m_events[2 * (1 - side)];
+        this->m_receive_space_event = this->m_events[2 * (1 - side) + 1];
+    }
+
+    void SharedMemoryStream::release() {
+        if (this->m_memory != nullptr) munmap(this->m_memory, this->m_memory_size);
+        this->m_memory = nullptr;
+
+        for (int& event : this->m_events) {
+            if (event >= 0) ::close(event);
+            event = -1;
+        }
+    }
+
+    template <typename F>
+    void SharedMemoryStream::wait(std::atomic<uint32_t>& waiting, int event, F ready) {
+        /* Either the other side sees the flag and signals, or this side sees what the other side did */
+        waiting.store(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (!ready() && !this->m_peer_gone) {
+            struct pollfd fds[2] = {{event, POLLIN, 0}, {this->m_control.get_fd(), POLLRDHUP, 0}};
+            int num_ready_fds = poll(fds, 2, this->m_timeout);
+
+            if (num_ready_fds == 0) {
+                waiting.store(0, std::memory_order_relaxed);
+                throw std::ios_base::failure("timed out while receiving from shared memory");
+            } else if (num_ready_fds < 0 && errno != EINTR) {
+                throw std::ios_base::failure("error encountered while polling shared memory events, errno: " +
+                        std::to_string(errno));
+            }
+
+            if (fds[0].revents & POLLIN) {
+                uint64_t count;
+                if (read(event, &count, sizeof(count)) < 0) { }
+            }
+            if (fds[1].revents & (POLLRDHUP | POLLHUP | POLLERR)) this->m_peer_gone = true;
+        }
+
+        waiting.store(0, std::memory_order_relaxed);
+    }
+
+    void SharedMemoryStream::check_positions(uint64_t head, uint64_t tail) {
+        if (tail - head <= this->m_capacity) return;
+
+        this->close();
+        throw std::ios_base::failure("error encountered in shared memory, the peer corrupted the ring positions");
+    }
+
+    size_t SharedMemoryStream::receive_some(char* data, size_t size) {
+        if (this->m_memory == nullptr) throw std::ios_base::failure("error encountered while receiving, stream closed");
+
+        Ring* ring = this->m_receive;
+        uint64_t head = ring->head.load(std::memory_order_relaxed);
+
+        while (true) {
+            uint64_t tail = ring->tail.load(std::memory_order_acquire);
+            this->check_positions(head, tail);
+
+            if (tail != head) {
+                size_t n = std::min<uint64_t>(size, tail - head);
+                size_t offset = head & (this->m_capacity - 1);
+                size_t first = std::min(n, this->m_capacity - offset);
+                memcpy(data, this->m_receive_data + offset, first);
+                memcpy(data + first, this->m_receive_data, n - first);
+
+                ring->head.store(head + n, std::memory_order_release);
+                notify(ring->sender_waiting, this->m_receive_space_event);
+
+                this->m_bytes_received += n;
+                bytes_received_total.add(n);
+                return n;
+            }
+
+            /* Whatever was sent before the ring was closed is still received */
+            if (ring->closed.load(std::memory_order_acquire)) {
+                if (ring->tail.load(std::memory_order_acquire) != head) continue;
+                return 0;
+            }
+            if (this->m_peer_gone) return 0;
+
+            this->wait(ring->receiver_waiting, this->m_receive_data_event, [ring, head]() {
+                    return ring->tail.load(std::memory_order_acquire) != head ||
+                        ring->closed.load(std::memory_order_acquire);
+                });
+        }
+    }
+
+    char* SharedMemoryStream::receive(size_t& size, bool force_size) {
+        if (size == 0) return nullptr;
+
+        char* data = new char[size];
+
+        try {
+            if (!force_size) {
+                size = this->receive_some(data, size);
+                if (size == 0) {
+                    delete[] data;
+                    return nullptr;
+                }
+            } else {
+                this->receive_into(data, size);
+            }
+        } catch (...) {
+            delete[] data;
+            throw;
+        }
+
+        return data;
+    }
+
+    void SharedMemoryStream::receive_into(void* buffer, size_t size) {
+        char* data = (char*)buffer;
+        size_t i = 0;
+
+        while (i < size) {
+            size_t n = this->receive_some(data + i, size - i);
+            if (n == 0) throw std::ios_base::failure("stream closed before forced reception of data");
+            i += n;
+        }
+    }
+
+    void SharedMemoryStream::send(const void* data, size_t size) {
+        if (this->m_memory == nullptr) throw std::ios_base::failure("error encountered while sending, stream closed");
+
+        Ring* ring = this->m_send;
+        uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+        size_t i = 0;
+
+        while (i < size) {
+            if (ring->closed.load(std::memory_order_acquire) || this->m_peer_gone) {
+                throw std::ios_base::failure("error encountered while sending to shared memory, stream closed by peer");
+            }
+
+            uint64_t head = ring->head.load(std::memory_order_acquire);
+            this->check_positions(head, tail);
+            size_t space = this->m_capacity - (tail - head);
+            if (space == 0) {
+                size_t capacity = this->m_capacity;
+                this->wait(ring->sender_waiting, this->m_send_space_event, [ring, tail, capacity]() {
+                        return tail - ring->head.load(std::memory_order_acquire) < capacity ||
+                            ring->closed.load(std::memory_order_acquire);
+                    });
+                continue;
+            }
+
+            size_t n = std::min(space, size - i);
+            size_t offset = tail & (this->m_capacity - 1);
+            size_t first = std::min(n, this->m_capacity - offset);
+            memcpy(this->m_send_data + offset, (const char*)data + i, first);
+            memcpy(this->m_send_data, (const char*)data + i + first, n - first);
+
+            tail += n;
+            ring->tail.store(tail, std::memory_order_release);
+            notify(ring->receiver_waiting, this->m_send_data_event);
+            i += n;
+        }
+
+        this->m_bytes_sent += size;
+        bytes_sent_total.add(size);
+    }
+
+    void SharedMemoryStream::close() {
+        if (this->m_memory == nullptr) return;
+
+        /* Wake the other side wherever it waits, so it sees the stream closed */
+        this->m_send->closed.store(1, std::memory_order_release);
+        this->m_receive->closed.store(1, std::memory_order_release);
+        uint64_t one = 1;
+        if (write(this->m_send_data_event, &one, sizeof(one)) < 0) { }
+        if (write(this->m_receive_space_event, &one, sizeof(one)) < 0) { }
+
+        this->release();
+        this->m_control.close();
+    }
+
+    char* BufferedStream::receive(size_t& size, bool force_size) {
+        this->flush();
+        if (size == 0) return nullptr;
+
+        char* data = new char[size];
+        size_t i = 0;
+
+        while (i < size) {
+            if (this->m_read_position == this->m_input.size()) {
+                if (i > 0 && !force_size) break;
+
+                size_t block_size = BufferedStream::block_size;
+                char* block;
+                try {
+                    block = this->m_stream->receive(block_size, false);
+                } catch (...) {
+                    delete[] data;
+                    throw;
+                }
+
+                if (block == nullptr) {
+                    delete[] data;
+                    if (force_size || i > 0) throw std::ios_base::failure("stream closed before forced reception of data");
+                    return nullptr;
+                }
+
+                this->m_input.assign(block, block_size);
+                this->m_read_position = 0;
+                delete[] block;
+            }
+
+            size_t n = std::min(size - i, this->m_input.size() - this->m_read_position);
+            memcpy(data + i, this->m_input.data() + this->m_read_position, n);
+            this->m_read_position += n;
+            i += n;
+        }
+
+        size = i;
+        return data;
+    }
+
+    void BufferedStream::receive_into(void* buffer, size_t size) {
+        this->flush();
+
+        char* data = (char*)buffer;
+        size_t n = std::min(size, this->m_input.size() - this->m_read_position);
+        memcpy(data, this->m_input.data() + this->m_read_position, n);
+        this->m_read_position += n;
+
+        while (n < size) {
+            /* What's left of a large payload skips the buffer */
+            if (size - n >= BufferedStream::block_size) {
+                this->m_stream->receive_into(data + n, size - n);
+                return;
+            }
+
+            size_t block_size = BufferedStream::block_size;
+            char* block = this->m_stream->receive(block_size, false);
+            if (block == nullptr) throw std::ios_base::failure("stream closed before forced reception of data");
+            this->m_input.assign(block, block_size);
+            delete[] block;
+
+            this->m_read_position = std::min(size - n, this->m_input.size());
+            memcpy(data + n, this->m_input.data(), this->m_read_position);
+            n += this->m_read_position;
+        }
+    }
+
+    void BufferedStream::send(const void* data, size_t size) {
+        this->m_output.append((const char*)data, size);
+        if (this->m_output.size() >= BufferedStream::block_size) this->flush();
+    }
+
+    void BufferedStream::flush() {
+        if (this->m_output.empty()) return;
+        std::string output;
+        output.swap(this->m_output);
+        this->m_stream->send(output.data(), output.size());
+    }
+}
@@ -0,0 +1,75 @@
+#include "tracing.h"
+
+#include <fstream>
+
+namespace tracing {
+    thread_local Buffer* t_buffer = nullptr;
+
+    void Buffer::record(const char* name, const char* category, std::chrono::steady_clock::time_point start,
+            std::chrono::steady_clock::time_point end, std::string&& detail) {
+        if (this->events.size() >= max_events) {
+            this->dropped++;
+            return;
+        }
+
+        typedef std::chrono::duration<double, std::micro> micros;
+        this->events.push_back({name, category,
+                std::chrono::duration_cast<micros>(start - this->session->start()).count(),
+                std::chrono::duration_cast<micros>(end - start).count(), std::move(detail)});
+    }
+
+    Buffer* Session::register_thread() {
+        std::unique_lock<std::mutex> lock{this->m_mutex};
+        Buffer*& buffer = this->m_thread_buffers[std::this_thread::get_id()];
+        if (buffer == nullptr) {
+            buffer = new Buffer{this, (int)this->m_buffers.size() + 1, {}, 0};
+            this->m_buffers.emplace_back(buffer);
+        }
+        return buffer;
+    }
+
+    namespace {
+        /**
+         * Escapes a string for use in JSON.
+         */
+        std::string escape(const std::string& s) {
+            std::string escaped;
+            for (char c : s) {
+                if (c == '"' || c == '\\') escaped += std::string("\\") + c;
+                else if ((unsigned char)c < 0x20) {
+                    char code[8];
+                    snprintf(code, sizeof(code), "\\u%04x", c);
+                    escaped += code;
+                } else escaped += c;
+            }
+            return escaped;
+        }
+    } // anonymous
+
+    void Session::dump(const std::string& path) {
+        std::unique_lock<std::mutex> lock{this->m_mutex};
+        std::ofstream file(path);
+        bool first = true;
+
+        file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+
+        for (auto& buffer : this->m_buffers) {
+            for (const Event& event : buffer->events) {
+                file << (first ? "\n" : ",\n") << "{\"name\": \"" << escape(event.name) << "\", \"cat\": \"" <<
+                    escape(event.category) << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << buffer->tid <<
+                    ", \"ts\": " << std::to_string(event.start) << ", \"dur\": " << std::to_string(event.duration);
+                if (event.detail != "") file << ", \"args\": {\"detail\": \"" << escape(event.detail) << "\"}";
+                file << "}";
+                first = false;
+            }
+
+            if (buffer->dropped > 0) {
+                file << (first ? "\n" : ",\n") << "{\"name\": \"dropped events\", \"ph\": \"i\", \"s\": \"t\", \"pid\": 1, \"tid\": " <<
+                    buffer->tid << ", \"ts\": 0, \"args\": {\"count\": " << buffer->dropped << "}}";
+                first = false;
+            }
+        }
+
+        file << "\n]}\n";
+    }
+}
@@ -0,0 +1,364 @@
+#include "knn.h"
+#include "serialization.h"
+
+#include <thread>
+#include <chrono>
+#include <mutex>
+#include <algorithm>
+#include <map>
+#include <cmath>
+
+using namespace streams;
+using namespace knn;
+
+namespace {
+    typedef std::chrono::steady_clock Clock;
+
+    /**
+     * Command line options of the load generator.
+     */
+    struct Options {
+        std::string client_ip;
+        std::string server_ip;
+        int server_port;
+        size_t sessions;            // The number of concurrent sessions
+        size_t iterations;          // The number of times every session runs the script
+        std::string train_file;
+        std::string test_file;
+        std::string k;
+        std::string metric;
+        UploadFormat format;
+        std::string output;         // File to write the JSON report to
+
+        Options() : server_port(0), sessions(10), iterations(5), k("5"), metric("EUC"), format(text_upload) { }
+    };
+
+    /**
+     * A command of the script, and the inputs it asks for after being chosen from the menu.
+     */
+    struct Step {
+        std::string command;
+        std::vector<std::string> inputs;
+    };
+
+    /**
+     * The latencies (in milliseconds) of every command.
+     */
+    typedef std::map<std::string, std::vector<double>> Latencies;
+
+    /**
+     * Prefixes of menu descriptions, and the command they belong to.
+     */
+    const std::vector<std::pair<std::string, std::string>> menu_prefixes = {
+        {"upload", "upload"}, {"algorithm settings", "settings"}, {"classify", "classify"},
+        {"display results", "display"}, {"download", "download"}, {"exit", "exit"}
+    };
+
+    /**
+     * A scripted session with the server. Follows the server's tokens like knnclient, answering the
+     * server's prompts from the script instead of the terminal.
+     */
+    class Session {
+        const Options& m_options;
+        const std::map<std::string, std::vector<std::string>>& m_files;
+        std::vector<Step> m_script;
+        std::map<std::string, int> m_menu;
+        Latencies m_latencies;
+
+        /**
+         * Gets a file's lines (files are read once, before the sessions start).
+         */
+        const std::vector<std::string>& lines(const std::string& path) {
+            static const std::vector<std::string> empty;
+            auto entry = this->m_files.find(path);
+            return entry == this->m_files.end() ? empty : entry->second;
+        }
+
+        /**
+         * Records the entries of the menu printed by the server.
+         */
+        void parse_menu(const std::string& s) {
+            size_t separator = s.find(".\t");
+            if (separator == std::string::npos || separator == 0) return;
+            if (s.find_first_not_of("0123456789") != separator) return;
+
+            std::string description = s.substr(separator + 2);
+            for (auto& prefix : menu_prefixes) {
+                if (description.compare(0, prefix.first.size(), prefix.first) == 0) {
+                    this->m_menu[prefix.second] = std::stoi(s.substr(0, separator));
+                }
+            }
+        }
+
+        void send_lines(Serializer& serializer, const std::string& path) {
+            const std::vector<std::string>& file = this->lines(path);
+            SerializationTokens token;
+            size_t i = 0;
+
+            serializer >> token;
+            while (token != end_token) {
+                serializer << (i < file.size() ? file[i++] : std::string(""));
+                serializer >> token;
+            }
+        }
+
+        public:
+            Session(const Options& options, const std::map<std::string, std::vector<std::string>>& files) :
+                m_options(options), m_files(files) {
+                for (size_t i = 0; i < options.iterations; i++) {
+                    this->m_script.push_back({"upload", {options.train_file, options.test_file}});
+                    this->m_script.push_back({"settings", {options.k, options.metric}});
+                    this->m_script.push_back({"classify", {}});
+                    this->m_script.push_back({"download", {"results"}});
+                }
+                this->m_script.push_back({"exit", {}});
+            }
+
+            const Latencies& latencies() const { return this->m_latencies; }
+
+            /**
+             * Runs the script to its end.
+             * @throws std::ios_base::failure if the connection fails, and std::runtime_error if the server
+             *         strays from the script.
+             */
+            void run() {
+                TCPSocket socket{this->m_options.client_ip, 0, this->m_options.server_ip, this->m_options.server_port};
+                Serializer serializer;
+                serializer(&socket);
+
+                SerializationTokens token;
+                std::thread streamer;
+                size_t step = 0;
+                size_t input = 0;
+                bool started = false;
+                Clock::time_point start;
+
+                auto finish_step = [&]() {
+                    double ms = std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(Clock::now() - start).count();
+                    this->m_latencies[this->m_script[step].command].push_back(ms);
+                };
+
+                try {
+                    while (true) {
+                        serializer >> token;
+
+                        if (token == receive_token) {
+                            std::string s;
+                            serializer >> s;
+                            this->parse_menu(s);
+                            continue;
+                        }
+
+                        if (streamer.joinable()) streamer.join();
+
+                        if (token == send_token) {
+                            if (started && input < this->m_script[step].inputs.size()) {
+                                serializer << this->m_script[step].inputs[input++];
+                                continue;
+                            }
+
+                            /* The server is back at the menu */
+                            if (started) {
+                                finish_step();
+                                step++;
+                            }
+                            if (step >= this->m_script.size()) throw std::runtime_error("server prompted past the end of the script");
+
+                            auto entry = this->m_menu.find(this->m_script[step].command);
+                            if (entry == this->m_menu.end()) {
+                                throw std::runtime_error("server has no " + this->m_script[step].command + " command");
+                            }
+
+                            started = true;
+                            input = 0;
+                            start = Clock::now();
+                            serializer << std::to_string(entry->second);
+                        } else if (token == open_file_r_token) {
+                            std::string path;
+                            serializer >> path;
+                            this->send_lines(serializer, path);
+                        } else if (token == stream_file_r_token) {
+                            std::string path;
+                            serializer >> path;
+                            const std::vector<std::string>& file = this->lines(path);
+                            streamer = std::thread([&file, serializer]() mutable {
+                                try {
+                                    for (const std::string& line : file) {
+                                        if (line == "") break;
+                                        serializer << line;
+                                    }
+                                    serializer << std::string("");
+                                } catch (std::ios_base::failure& e) { }
+                            });
+                        } else if (token == upload_dataset_token) {
+                            std::string path;
+                            serializer >> path;
+                            uint32_t format = this->m_options.format;
+                            little_endian(format);
+                            serializer << format;
+
+                            if (this->m_options.format == text_upload || this->m_options.format == sparse_upload) {
+                                this->send_lines(serializer, path);
+                                continue;
+                            }
+
+                            const std::vector<std::string>& file = this->lines(path);
+                            size_t i = 0;
+                            auto getline = [&file, &i](std::string& s) -> std::string {
+                                s = i < file.size() ? file[i++] : "";
+                                return s;
+                            };
+                            send_columns(serializer, this->m_options.format, getline);
+                        } else if (token == open_file_w_token) {
+                            std::string path, line;
+                            serializer >> path >> token;
+                            while (token != end_token) {
+                                serializer >> line;
+                                serializer >> token;
+                            }
+                        } else if (token == end_token) {
+                            if (started) finish_step();
+                            break;
+                        }
+                    }
+                } catch (...) {
+                    if (streamer.joinable()) streamer.join();
+                    try { socket.close(); } catch (std::ios_base::failure& e) { }
+                    throw;
+                }
+
+                socket.close();
+            }
+    };
+
+    /**
+     * Gets a percentile of sorted values.
+     */
+    double percentile(const std::vector<double>& sorted, double p) {
+        if (sorted.empty()) return 0;
+        size_t rank = (size_t)std::ceil(p * sorted.size());
+        return sorted[std::min(sorted.size(), std::max((size_t)1, rank)) - 1];
+    }
+
+    std::vector<std::string> read_lines(const std::string& path) {
+        std::ifstream file(path);
+        if (!file.is_open()) throw std::invalid_argument("could not open " + path);
+
+        std::vector<std::string> lines;
+        std::string line;
+        while (std::getline(file, line)) lines.push_back(line);
+        return lines;
+    }
+
+    void usage(const char* name) {
+        std::cout << "\e[31;1mUsage:\e[0m " << name << " <client ip> <server ip> <server port> --train <file> --test <file>"
+            << " [--sessions n] [--iterations n] [--k k] [--metric EUC|MAN|CHE|COS|DOT] [--format text|f64|f32|i16|u8|svm] [--output file]"
+            << std::endl;
+        std::exit(1);
+    }
+} // anonymous
+
+int main(int argc, char** argv) {
+    if (argc < 4) usage(argv[0]);
+
+    Options options;
+    options.client_ip = argv[1];
+    options.server_ip = argv[2];
+    options.server_port = strtol(argv[3], NULL, 0);
+
+    for (int i = 4; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) usage(argv[0]);
+        std::string value = argv[++i];
+
+        if (arg == "--sessions") options.sessions = std::stoul(value);
+        else if (arg == "--iterations") options.iterations = std::stoul(value);
+        else if (arg == "--train") options.train_file = value;
+        else if (arg == "--test") options.test_file = value;
+        else if (arg == "--k") options.k = value;
+        else if (arg == "--metric") options.metric = value;
+        else if (arg == "--output") options.output = value;
+        else if (arg == "--format") {
+            try {
+                options.format = parse_upload_format(value);
+            } catch (std::invalid_argument& e) {
+                usage(argv[0]);
+            }
+        } else usage(argv[0]);
+    }
+
+    if (options.train_file == "" || options.test_file == "") usage(argv[0]);
+
+    std::map<std::string, std::vector<std::string>> files;
+    files[options.train_file] = read_lines(options.train_file);
+    files[options.test_file] = read_lines(options.test_file);
+
+    std::vector<Session> sessions(options.sessions, Session(options, files));
+    std::vector<std::thread> threads;
+    std::mutex output_mutex;
+    size_t failed = 0;
+
+    Clock::time_point start = Clock::now();
+
+    for (Session& session : sessions) {
+        threads.push_back(std::thread([&session, &output_mutex, &failed]() {
+            try {
+                session.run();
+            } catch (std::exception& e) {
+                std::unique_lock<std::mutex> lock{output_mutex};
+                std::cerr << "\e[31;1mSession failed:\e[0m " << e.what() << std::endl;
+                failed++;
+            }
+        }));
+    }
+
+    for (std::thread& thread : threads) thread.join();
+
+    double seconds = std::chrono::duration_cast<std::chrono::duration<double>>(Clock::now() - start).count();
+
+    /* Merge the latencies of all the sessions */
+    Latencies latencies;
+    for (Session& session : sessions) {
+        for (auto& entry : session.latencies()) {
+            latencies[entry.first].insert(latencies[entry.first].end(), entry.second.begin(), entry.second.end());
+        }
+    }
+
+    std::string json = "{\n  \"sessions\": " + std::to_string(options.sessions) + ", \"iterations\": " +
+        std::to_string(options.iterations) + ", \"failed\": " + std::to_string(failed) + ", \"seconds\": " +
+        std::to_string(seconds) + ",\n  \"commands\": [";
+
+    std::cout << "command\tcount\tper sec\tmean\tp50\tp95\tp99\tp999\tmax (ms)" << std::endl;
+    bool first = true;
+
+    for (auto& entry : latencies) {
+        std::vector<double>& values = entry.second;
+        std::sort(values.begin(), values.end());
+        double mean = 0;
+        for (double v : values) mean += v / values.size();
+
+        double stats[] = {values.size() / seconds, mean, percentile(values, 0.5), percentile(values, 0.95),
+            percentile(values, 0.99), percentile(values, 0.999), values.back()};
+
+        std::cout << entry.first << "\t" << values.size();
+        for (double stat : stats) std::cout << "\t" << stat;
+        std::cout << std::endl;
+
+        json += std::string(first ? "\n    " : ",\n    ") + "{\"command\": \"" + entry.first + "\", \"count\": " +
+            std::to_string(values.size()) + ", \"per_second\": " + std::to_string(stats[0]) +
+            ", \"mean_ms\": " + std::to_string(stats[1]) + ", \"p50_ms\": " + std::to_string(stats[2]) +
+            ", \"p95_ms\": " + std::to_string(stats[3]) + ", \"p99_ms\": " + std::to_string(stats[4]) +
+            ", \"p999_ms\": " + std::to_string(stats[5]) + ", \"max_ms\": " + std::to_string(stats[6]) + "}";
+        first = false;
+    }
+
+    json += "\n  ]\n}\n";
+    std::cout << options.sessions - failed << "/" << options.sessions << " sessions completed in " << seconds << "s" << std::endl;
+
+    if (options.output != "") {
+        std::ofstream file(options.output);
+        file << json;
+    }
+
+    return failed > 0 ? 1 : 0;
+}
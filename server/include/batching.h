@@ -0,0 +1,119 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include "feature-set.h"
+
+namespace knn {
+    /**
+     * How queries against shared Data Sets are coalesced into batches.
+     */
+    struct Batching {
+        std::chrono::microseconds window;       // How long a batch waits for queries to join it (0 disables batching)
+        size_t max_queries;                     // A batch is answered as soon as it has this many queries
+
+        Batching() : window(0), max_queries(64) { }
+
+        bool enabled() const { return this->window.count() > 0; }
+    };
+
+    /**
+     * A Feature Set shared by many sessions, whose classification queries are coalesced across the sessions.
+     * A query waits up to the batching window for queries from other sessions to join it, and then one of the
+     * waiting threads answers the whole batch with a single blocked scan (see FeatureSet::get_nearest_classes) and
+     * hands every session its own result. While a batch is being scanned, the next one gathers.
+     * Every other query is passed on to the Feature Set.
+     */
+    class BatchedFeatureSet : public FeatureSet {
+        struct Pending {
+            BatchQuery query;
+            std::chrono::steady_clock::time_point arrived;
+            std::string result;
+            std::exception_ptr error;
+            bool done;
+        };
+
+        FeatureSet* m_data_set;
+        Batching m_batching;
+
+        mutable std::mutex m_mutex;
+        mutable std::condition_variable m_full;         // Notified when the gathering batch fills up
+        mutable std::condition_variable m_answered;     // Notified when a batch was answered
+        mutable std::deque<Pending*> m_pending;
+        mutable bool m_scanning;                        // Whether some thread is gathering or scanning a batch
+
+        /**
+         * Answers a batch, outside of the lock.
+         */
+        void answer(const std::vector<Pending*>& batch) const;
+
+        public:
+            /**
+             * @param data_set      The Feature Set, which is owned (and deleted) by the Batched Feature Set.
+             * @param batching      How queries are batched.
+             */
+            BatchedFeatureSet(FeatureSet* data_set, const Batching& batching) :
+                m_data_set(data_set), m_batching(batching), m_scanning(false) { }
+            ~BatchedFeatureSet() { delete this->m_data_set; }
+
+            BatchedFeatureSet(const BatchedFeatureSet&) = delete;
+            BatchedFeatureSet& operator=(const BatchedFeatureSet&) = delete;
+
+            std::string feature_type() const override { return this->m_data_set->feature_type(); }
+            bool is_sparse() const override { return this->m_data_set->is_sparse(); }
+            size_t size() const override { return this->m_data_set->size(); }
+            size_t dims() const override { return this->m_data_set->dims(); }
+            misc::array<double> features(size_t i) const override { return this->m_data_set->features(i); }
+            size_t memory_usage() const override { return sizeof(*this) + this->m_data_set->memory_usage(); }
+            std::string class_type(size_t i) const override { return this->m_data_set->class_type(i); }
+
+            /**
+             * Gets the nearest class to a point, in a batch with the queries of other sessions.
+             */
+            std::string get_nearest_class(int k, const dubdpoint* p, size_t metric) const override;
+
+            std::string get_nearest_class(int k, size_t i, size_t metric) const override {
+                return this->m_data_set->get_nearest_class(k, i, metric);
+            }
+            std::string get_nearest_class(int k, const SparseVector& p, size_t metric) const override {
+                return this->m_data_set->get_nearest_class(k, p, metric);
+            }
+            std::vector<std::vector<int>> get_k_nearest_indices(int k, const dubdpoint* p) const override {
+                return this->m_data_set->get_k_nearest_indices(k, p);
+            }
+            std::vector<std::vector<int>> get_k_nearest_indices(int k, size_t i) const override {
+                return this->m_data_set->get_k_nearest_indices(k, i);
+            }
+            std::vector<int> get_k_nearest_indices(int k, const dubdpoint* p, size_t metric) const override {
+                return this->m_data_set->get_k_nearest_indices(k, p, metric);
+            }
+            std::vector<int> rerank(int k, const dubdpoint* p, const std::vector<int>& candidates, size_t metric) const override {
+                return this->m_data_set->rerank(k, p, candidates, metric);
+            }
+            std::vector<int> rerank(int k, size_t i, const std::vector<int>& candidates, size_t metric) const override {
+                return this->m_data_set->rerank(k, i, candidates, metric);
+            }
+            std::vector<double> distances(const dubdpoint* p, const std::vector<int>& indices, size_t metric) const override {
+                return this->m_data_set->distances(p, indices, metric);
+            }
+            std::string vote(const std::vector<int>& indices, int k) const override {
+                return this->m_data_set->vote(indices, k);
+            }
+            std::vector<std::string> get_nearest_classes(const std::vector<BatchQuery>& queries) const override {
+                return this->m_data_set->get_nearest_classes(queries);
+            }
+            void index_exact_matches() override { this->m_data_set->index_exact_matches(); }
+            std::string exact_class(const dubdpoint* p) const override { return this->m_data_set->exact_class(p); }
+    };
+
+    /**
+     * Batches the queries of a shared Feature Set as configured.
+     * @param data_set      The Feature Set, which is owned by the batched Feature Set.
+     * @param batching      How queries are batched.
+     * @return              The batched Feature Set, or data_set if batching is disabled.
+     */
+    FeatureSet* batch(FeatureSet* data_set, const Batching& batching);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <mutex>
+#include <condition_variable>
+#include <queue>
+
+namespace threading {
+    /**
+     * Blocking queue with a bounded capacity, for passing items between the stages of a pipeline.
+     * Producers block while the queue is full and consumers block while it is empty.
+     */
+    template <typename T>
+    class BoundedQueue {
+        std::mutex m_mutex;
+        std::condition_variable m_not_full;
+        std::condition_variable m_not_empty;
+        std::queue<T> m_items;
+        size_t m_capacity;
+        bool m_closed;
+
+        public:
+            /**
+             * Constructor for a BoundedQueue.
+             * @param capacity      The maximal number of items in the queue.
+             */
+            BoundedQueue(size_t capacity) : m_capacity(capacity), m_closed(false) { }
+
+            /**
+             * Pushes an item to the queue, blocking while the queue is full.
+             * @param item          The item to push.
+             * @return              False if the queue was closed (and the item was not pushed).
+             */
+            bool push(T item);
+
+            /**
+             * Pops an item from the queue, blocking while the queue is empty.
+             * @param item          Receives the popped item.
+             * @return              False if the queue was closed and all of its items have been popped.
+             */
+            bool pop(T& item);
+
+            /**
+             * Closes the queue. Subsequent pushes fail, and pops fail once the queue is empty.
+             */
+            void close();
+    };
+}
+
+#include "bounded-queue.tpp"
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include "feature-set.h"
+#include "batching.h"
+#include "reduction.h"
+#include "placement.h"
+
+namespace knn {
+    /**
+     * Data Sets loaded when the server starts, which sessions attach to by name instead of uploading them.
+     * The Data Sets are shared by every session attached to them, and are charged to the server's memory budget
+     * once (rather than to the sessions).
+     * Data Sets may be replicated on every NUMA node, in which case sessions attach to the replica on the node they
+     * run on.
+     */
+    class Catalog {
+        std::map<std::string, std::vector<std::shared_ptr<const FeatureSet>>> m_data_sets;     // The replicas by node
+        placement::Topology m_topology;
+
+        public:
+            /**
+             * @param topology      The topology Data Sets are replicated over.
+             */
+            Catalog(const placement::Topology& topology) : m_topology(topology) { }
+
+            /**
+             * Loads the classified csv files listed by a path, in parallel, logging the time and memory each took.
+             * Files with a libsvm extension are loaded as sparse Data Sets (see is_sparse_file), which aren't reduced.
+             * @param path          A directory, whose .csv (and .svm) files are loaded and named after the file
+             *                      (without the extension), or a manifest whose lines are "name path [type]" (paths
+             *                      relative to the manifest's directory, and the type the features are stored as:
+             *                      f64, the default and the type of the files of a directory, f32, i16 or u8).
+             * @param reduction     How the Data Sets are reduced (as uploaded ones are).
+             * @param replicate     Whether to load a replica of every Data Set on every node.
+             * @param batching      How the classification queries of the sessions sharing a Data Set are batched.
+             * @param exact_match   Whether the Data Sets are indexed for exact matches (see FeatureSet::exact_class).
+             * @throws              std::ios_base::failure if the path can't be read, std::invalid_argument if the
+             *                      manifest is malformed or a Data Set can't be loaded (or doesn't fit in the
+             *                      server's memory quota).
+             */
+            void load(const std::string& path, const Reduction& reduction, bool replicate=false,
+                    const Batching& batching=Batching(), bool exact_match=false);
+
+            /**
+             * @return The Data Set with the given name (its replica on the calling thread's node), null if there is none.
+             */
+            std::shared_ptr<const FeatureSet> get(const std::string& name) const;
+
+            /**
+             * @return The names of the Data Sets, sorted.
+             */
+            std::vector<std::string> names() const;
+
+            bool empty() const { return this->m_data_sets.empty(); }
+    };
+}
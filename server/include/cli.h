@@ -2,6 +2,12 @@
 
 #include "knn.h"
 #include "distances.h"
+#include "feature-set.h"
+#include "sparse-feature-set.h"
+#include "reduction.h"
+#include "catalog.h"
+#include "shards.h"
+#include "files.h"
 
 namespace knn {
     /**
@@ -11,6 +17,12 @@ namespace knn {
      * + open_input(filename) : opens a file for input
      * + read() -> str : returns a string read from the input file
      * + close_input() : closes the input file
+     * + open_input_stream(filename) : opens a file for input, whose lines are pushed without being requested
+     * + read_stream() -> str : returns the next line pushed from the input stream ("" at its end)
+     * + close_input_stream() : closes the input stream
+     * + read_dataset(filename, reserve, sink) -> dataset : reads a Data Set from a classified csv file (or a sparse one
+     *   in libsvm format), calling reserve with the size of every point before it is added. If a sink is given, the
+     *   points of a dense file are passed to it as they are read instead, and the Data Set is returned empty
      * + open_output(filename) : opens a file for output
      * + write(str) : writes str to the output file
      * + close_output() : closes the output file
@@ -23,6 +35,11 @@ namespace knn {
             virtual void open_input(std::string) =0;
             virtual std::string read() =0;
             virtual void close_input() =0;
+            virtual void open_input_stream(std::string) =0;
+            virtual std::string read_stream() =0;
+            virtual void close_input_stream() =0;
+            virtual FeatureSet* read_dataset(std::string, std::function<void(size_t)> reserve=nullptr,
+                    PointSink* sink=nullptr) =0;
             virtual void open_output(std::string) =0;
             virtual void write(std::string) =0;
             virtual void close_output() =0;
@@ -50,6 +67,7 @@ namespace knn {
              * @return      A reference to this.
              */
             DefaultSocketIO& operator>>(std::string& s) {
+                tracing::Span span{"send_token", "protocol"};
                 this->m_serializer << SerializationTokens::send_token;
                 this->m_serializer >> s;
                 return *this;
@@ -63,22 +81,67 @@ namespace knn {
              * @return      A reference to this.
              */
             DefaultSocketIO& operator<<(std::string s) {
+                tracing::Span span{"receive_token", "protocol"};
                 this->m_serializer << SerializationTokens::receive_token << s;
                 return *this;
             }
 
-            void open_input(std::string filename) override { this->m_serializer << SerializationTokens::open_file_r_token << filename; }
+            void open_input(std::string filename) override {
+                tracing::Span span{"open_file_r_token", "protocol"};
+                this->m_serializer << SerializationTokens::open_file_r_token << filename;
+            }
             std::string read() override {
+                tracing::Span span{"read_file_token", "protocol"};
                 this->m_serializer << SerializationTokens::read_file_token;
                 std::string s;
                 this->m_serializer >> s;
                 return s;
             }
-            void close_input() override { this->m_serializer << SerializationTokens::end_token; }
+            void close_input() override {
+                tracing::Span span{"end_token", "protocol"};
+                this->m_serializer << SerializationTokens::end_token;
+            }
+
+            /**
+             * Streams the lines of a file. The recipient sends all of the file's lines followed by an empty line,
+             * without waiting for them to be requested. Thus read_stream may be called on one thread while
+             * another thread serializes output.
+             */
+            void open_input_stream(std::string filename) override {
+                tracing::Span span{"stream_file_r_token", "protocol"};
+                this->m_serializer << SerializationTokens::stream_file_r_token << filename;
+            }
+            std::string read_stream() override {
+                tracing::Span span{"read_stream", "protocol"};
+                std::string s;
+                this->m_serializer >> s;
+                return s;
+            }
+            void close_input_stream() override { }
+
+            /**
+             * Reads a Data Set, in whichever upload format the recipient chooses.
+             * In the text format the file's lines are read one by one, in the binary formats the recipient parses
+             * the file itself and sends it as blocks of columns. The features are stored in the type of the
+             * format (doubles for text). In the sparse format the lines are read as in the text format, and parsed
+             * as libsvm points into a SparseFeatureSet.
+             * If reserve or the sink throws, the upload is ended (so the recipient stays in sync) before rethrowing.
+             */
+            FeatureSet* read_dataset(std::string filename, std::function<void(size_t)> reserve=nullptr,
+                    PointSink* sink=nullptr) override;
 
-            void open_output(std::string filename) override { this->m_serializer << SerializationTokens::open_file_w_token << filename; }
-            void write(std::string s) override { this->m_serializer << SerializationTokens::write_file_token << s; }
-            void close_output() override { this->m_serializer << SerializationTokens::end_token; }
+            void open_output(std::string filename) override {
+                tracing::Span span{"open_file_w_token", "protocol"};
+                this->m_serializer << SerializationTokens::open_file_w_token << filename;
+            }
+            void write(std::string s) override {
+                tracing::Span span{"write_file_token", "protocol"};
+                this->m_serializer << SerializationTokens::write_file_token << s;
+            }
+            void close_output() override {
+                tracing::Span span{"end_token", "protocol"};
+                this->m_serializer << SerializationTokens::end_token;
+            }
 
             void close() override {
                 this->m_serializer << SerializationTokens::end_token;
@@ -87,12 +150,16 @@ namespace knn {
 
     /**
      * The DefaultTerminalIO implements the DefaultIO interface on files.
+     * Input files are mapped into memory and their lines read straight out of the mapping, and output files are
+     * written through a large buffer, so local runs over big files aren't bound by per-line stream overhead.
+     * As with file streams, a file which can't be opened reads as empty (and one which can't be created is not
+     * written).
      */
     class DefaultTerminalIO : public DefaultIO {
         std::istream& m_input;
         std::ostream& m_output;
-        std::ifstream m_file_input;
-        std::ofstream m_file_output;
+        streams::MappedFile m_file_input;
+        streams::FileWriter m_file_output;
 
         public:
             DefaultTerminalIO(std::istream& input=std::cin, std::ostream& output=std::cout) :
@@ -101,16 +168,34 @@ namespace knn {
             DefaultTerminalIO& operator<<(std::string s) override { this->m_output << s; return *this; }
             DefaultTerminalIO& operator>>(std::string& s) override { this->m_input >> s; return *this; }
 
-            void open_input(std::string filename) override { this->m_file_input = std::ifstream(filename); }
+            void open_input(std::string filename) override {
+                try {
+                    this->m_file_input.open(filename);
+                } catch (std::ios_base::failure& e) { }
+            }
             std::string read() override {
-                std::string s;
-                std::getline(this->m_file_input, s);
-                return s;
+                streams::LineView line;
+                if (!this->m_file_input.read_line(line)) return "";
+                return line.str();
             }
             void close_input() override { this->m_file_input.close(); }
 
-            void open_output(std::string filename) override { this->m_file_output = std::ofstream(filename); }
-            void write(std::string s) override { this->m_file_output << s; }
+            void open_input_stream(std::string filename) override { this->open_input(filename); }
+            std::string read_stream() override { return this->read(); }
+            void close_input_stream() override { this->close_input(); }
+
+            /**
+             * Reads a Data Set from a local file, which is sparse if it has a libsvm extension (see is_sparse_file).
+             */
+            FeatureSet* read_dataset(std::string filename, std::function<void(size_t)> reserve=nullptr,
+                    PointSink* sink=nullptr) override;
+
+            void open_output(std::string filename) override {
+                try {
+                    this->m_file_output.open(filename);
+                } catch (std::ios_base::failure& e) { }
+            }
+            void write(std::string s) override { this->m_file_output.write(s); }
             void close_output() override { this->m_file_output.close(); }
 
             void close() override { }
@@ -135,11 +220,17 @@ namespace knn {
 
             /**
              * Starts the CLI.
-             * @param dataset       The datatset.
-             * @param dio           The IO device to use.
-             * @param exit_name     What to display for the exit option.
+             * Commands run under the calling thread's cancellation token (if it has one). A command which is
+             * cancelled by its deadline reports it and returns to the menu, while a cancelled token ends the CLI.
+             * @param dataset           The datatset.
+             * @param dio               The IO device to use.
+             * @param exit_name         What to display for the exit option.
+             * @param command_timeout   The deadline of every command, 0 for none.
+             * @return                  Whether the CLI ended in the middle of a command (because it was cancelled,
+             *                          or its input failed), rather than between commands.
              */
-            void start(/*dubdset* dataset, */DefaultIO& dio, std::string exit_name="exit");
+            bool start(/*dubdset* dataset, */DefaultIO& dio, std::string exit_name="exit",
+                    std::chrono::milliseconds command_timeout=std::chrono::milliseconds(0));
 
             /**
              * This class must be public so Command-derived classes can access it.
@@ -148,16 +239,16 @@ namespace knn {
             struct Settings {
                 DefaultIO& dio;                                 // The io device to use
                 int k_value;                                    // The k value to use in the algorithm
-                dubdset* data_set;                              // The data set
-                double (*distance_metric)(const dubdpoint*, const dubdpoint*);
+                std::shared_ptr<const FeatureSet> data_set;     // The data set (shared if it is preloaded)
+                size_t distance_metric;                         // The index of the metric in distances::metric_names
                 std::string distance_metric_name;
                 std::string test_file;                          // The file to test the database with (classified)
                 bool is_classified;                             // Whether or not the data has been classified already
                 std::vector<std::string> classified_names;      // A vector of the classified names
+                accounting::Account account;                    // The memory charged to the session
 
-                Settings(DefaultIO& io, int k,
-                        double (*distance)(const dubdpoint*, const dubdpoint*), std::string distance_name) :
-                    dio(io), k_value(k), data_set(nullptr), distance_metric(distance),
+                Settings(DefaultIO& io, int k, std::string distance_name) :
+                    dio(io), k_value(k), distance_metric(distances::metric_index(distance_name)),
                     distance_metric_name(distance_name), is_classified(false) { }
             };
     };
@@ -185,9 +276,25 @@ namespace knn {
     };
     
     class Upload_Files : public Command {
+        Reduction m_reduction;
+        const Catalog* m_catalog;
+        std::vector<streams::Address> m_shards;
+        bool m_exact_match;
+
         public:
-            Upload_Files(std::string description) :
-                Command(description) { }
+            /**
+             * @param description   The description of the command.
+             * @param reduction     How uploaded train files are reduced to fewer dimensions.
+             * @param catalog       The preloaded Data Sets sessions may attach to instead of uploading (may be null).
+             * @param shards        The workers uploaded train files are partitioned across (none to keep them in
+             *                      the session), which reduce them themselves.
+             * @param exact_match   Whether uploaded train files are indexed, so test points which are part of them
+             *                      are classified by their label (see FeatureSet::exact_class).
+             */
+            Upload_Files(std::string description, Reduction reduction=Reduction(), const Catalog* catalog=nullptr,
+                    std::vector<streams::Address> shards=std::vector<streams::Address>(), bool exact_match=false) :
+                Command(description), m_reduction(reduction), m_catalog(catalog), m_shards(shards),
+                m_exact_match(exact_match) { }
 
             void execute(CLI::Settings& settings) override;
     };
@@ -231,5 +338,27 @@ namespace knn {
 
             void execute(CLI::Settings& settings) override;
     };
-}
 
+    /**
+     * Classifies the test file and the train file (leave-one-out) for every combination of K and distance
+     * metric in a single pass, and writes a report of the predictions and confusion matrices.
+     */
+    class Sweep_Settings : public Command {
+        public:
+            Sweep_Settings(std::string description) :
+                Command(description) { }
+
+            void execute(CLI::Settings& settings) override;
+    };
+
+    /**
+     * Displays the metrics of the server.
+     */
+    class Display_Statistics : public Command {
+        public:
+            Display_Statistics(std::string description) :
+                Command(description) { }
+
+            void execute(CLI::Settings& settings) override;
+    };
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cmath>
+#include <cstdint>
 #include "knn.h"
 
 typedef knn::DataSet<misc::array<double>> dubdset;
@@ -30,5 +31,189 @@ namespace distances {
      * @return double the manhattan distance between the two points.
      */
     double manhattan_distance(const dubdpoint* p1, const dubdpoint* p2);
+
+    /**
+     * Returns the cosine distance (1 - the cosine similarity) between the two points.
+     * @param p1 first point.
+     * @param p2 second point.
+     * @return double the cosine distance between the two points (1 if either of them is 0).
+     */
+    double cosine_distance(const dubdpoint* p1, const dubdpoint* p2);
+
+    /**
+     * Returns the inner product distance (the negated inner product) between the two points, so the points with
+     * the largest inner products are the nearest.
+     * @param p1 first point.
+     * @param p2 second point.
+     * @return double the negated inner product of the two points.
+     */
+    double inner_product_distance(const dubdpoint* p1, const dubdpoint* p2);
+
+    /**
+     * The number of metrics computed by all_distances, and their names in the order they are computed.
+     */
+    const size_t num_metrics = 5;
+    const std::string metric_names[num_metrics] = {"EUC", "MAN", "CHE", "COS", "DOT"};
+
+    /**
+     * The indices of the metrics which are computed from inner products (and the norms of the points).
+     */
+    const size_t cosine_metric = 3;
+    const size_t inner_product_metric = 4;
+
+    /**
+     * Computes the distances between the two points relative to every metric in a single pass.
+     * @param p1 first point.
+     * @param p2 second point.
+     * @param out array of num_metrics doubles, receives the distances in the order of metric_names.
+     */
+    void all_distances(const dubdpoint* p1, const dubdpoint* p2, double* out);
+
+    /**
+     * The types features are accumulated in. Differences of T's are computed as diff_type and summed as
+     * sum_type, which are wide enough to hold them exactly for the integer types.
+     * The kernels sum blocks of up to block_size features in block_type first, which is narrower than sum_type for
+     * the integer types but still holds the sum of a block exactly, so the loops over a block vectorize; every
+     * block's sum is then widened and added to the sum_type total.
+     */
+    template <typename T>
+    struct accumulator {
+        typedef double diff_type;
+        typedef double sum_type;
+        typedef double block_type;
+        static const size_t block_size = (size_t)-1;
+    };
+
+    /* Squared differences and products of int16_t's reach 2^32, so their blocks are summed in doubles, which
+     * hold integers of up to 2^53 exactly */
+    template <>
+    struct accumulator<int16_t> {
+        typedef int32_t diff_type;
+        typedef int64_t sum_type;
+        typedef double block_type;
+        static const size_t block_size = 1 << 20;
+    };
+
+    /* Differences of uint8_t's fit in an int16_t, and their squares and products are below 2^16, so 32767 of them
+     * fit in an int32_t */
+    template <>
+    struct accumulator<uint8_t> {
+        typedef int16_t diff_type;
+        typedef int64_t sum_type;
+        typedef int32_t block_type;
+        static const size_t block_size = 32767;
+    };
+
+    /**
+     * Distance kernels over contiguous arrays of n features.
+     * The loops have no dependencies between iterations other than the reduction, so the compiler vectorizes them
+     * under "omp simd" (so the server, bench and batch builds use -fopenmp-simd).
+     */
+    template <typename T>
+    double euclidean_kernel(const T* a, const T* b, size_t n);
+
+    template <typename T>
+    double manhattan_kernel(const T* a, const T* b, size_t n);
+
+    template <typename T>
+    double chebyshev_kernel(const T* a, const T* b, size_t n);
+
+    template <typename T>
+    double dot_kernel(const T* a, const T* b, size_t n);
+
+    template <typename T>
+    double norm_kernel(const T* a, size_t n);
+
+    /**
+     * Computes every metric in a single pass, given the norms of a and b (see norm_kernel).
+     */
+    template <typename T>
+    void all_kernel(const T* a, const T* b, size_t n, double norm_a, double norm_b, double* out);
+
+    /**
+     * Distance kernels over sparse points, given as their nonzero features (indices in increasing order, and their
+     * values). They merge the nonzeros of both points, so they cost as many steps as the points have nonzeros,
+     * however wide the points are. The norm of a sparse point is the norm_kernel of its values.
+     */
+    template <typename T>
+    double sparse_euclidean_kernel(const uint32_t* ai, const T* av, size_t an, const uint32_t* bi, const T* bv, size_t bn);
+
+    template <typename T>
+    double sparse_manhattan_kernel(const uint32_t* ai, const T* av, size_t an, const uint32_t* bi, const T* bv, size_t bn);
+
+    template <typename T>
+    double sparse_chebyshev_kernel(const uint32_t* ai, const T* av, size_t an, const uint32_t* bi, const T* bv, size_t bn);
+
+    template <typename T>
+    double sparse_dot_kernel(const uint32_t* ai, const T* av, size_t an, const uint32_t* bi, const T* bv, size_t bn);
+
+    /**
+     * Computes every metric in a single merge, given the norms of a and b.
+     */
+    template <typename T>
+    void sparse_all_kernel(const uint32_t* ai, const T* av, size_t an, const uint32_t* bi, const T* bv, size_t bn,
+            double norm_a, double norm_b, double* out);
+
+    /**
+     * Converts the inner product of two points to the distance of an inner product metric.
+     * @param metric    cosine_metric or inner_product_metric.
+     * @param dot       The inner product of the points.
+     * @param norm_a    The norm of the first point.
+     * @param norm_b    The norm of the second point.
+     */
+    inline double from_dot(size_t metric, double dot, double norm_a, double norm_b) {
+        if (metric == inner_product_metric) return -dot;
+        if (norm_a == 0 || norm_b == 0) return 1.0;
+        return 1.0 - dot / (norm_a * norm_b);
+    }
+
+    /**
+     * The distance functions of Data Points whose features are T's.
+     * @throws std::invalid_argument if the points differ in length.
+     */
+    template <typename T>
+    double euclidean(const knn::DataPoint<misc::array<T>>* p1, const knn::DataPoint<misc::array<T>>* p2);
+
+    template <typename T>
+    double manhattan(const knn::DataPoint<misc::array<T>>* p1, const knn::DataPoint<misc::array<T>>* p2);
+
+    template <typename T>
+    double chebyshev(const knn::DataPoint<misc::array<T>>* p1, const knn::DataPoint<misc::array<T>>* p2);
+
+    template <typename T>
+    double cosine(const knn::DataPoint<misc::array<T>>* p1, const knn::DataPoint<misc::array<T>>* p2);
+
+    template <typename T>
+    double inner_product(const knn::DataPoint<misc::array<T>>* p1, const knn::DataPoint<misc::array<T>>* p2);
+
+    template <typename T>
+    void all(const knn::DataPoint<misc::array<T>>* p1, const knn::DataPoint<misc::array<T>>* p2, double* out);
+
+    /**
+     * @param metric    The index of the metric in metric_names, other than the inner product metrics.
+     * @return          The kernel of the metric.
+     */
+    template <typename T>
+    double (*metric_kernel(size_t metric))(const T*, const T*, size_t);
+
+    /**
+     * @param metric    The index of the metric in metric_names, other than the inner product metrics.
+     * @return          The sparse kernel of the metric.
+     */
+    template <typename T>
+    double (*sparse_metric_kernel(size_t metric))(const uint32_t*, const T*, size_t, const uint32_t*, const T*, size_t);
+
+    /**
+     * @param metric    The index of the metric in metric_names.
+     * @return          The distance function of the metric for Data Points whose features are T's.
+     */
+    template <typename T>
+    double (*metric_function(size_t metric))(const knn::DataPoint<misc::array<T>>*, const knn::DataPoint<misc::array<T>>*);
+
+    /**
+     * @return The index of a metric in metric_names, or num_metrics if there is no such metric.
+     */
+    size_t metric_index(const std::string& name);
 }
 
+#include "distances.tpp"
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+namespace threading {
+    /**
+     * Parks threads waiting for a condition which is published without a lock (eg. a lock-free queue becoming
+     * non-empty), on a futex.
+     * A waiter calls prepare_wait, checks the condition again, and then calls cancel_wait if it holds or
+     * wait otherwise. A notifier makes the condition hold and then calls notify. A notify that happens after
+     * prepare_wait makes the wait return immediately, so no wakeup is lost between the check and the wait.
+     * Notifying makes no system call while nobody waits, or while every waiter has already been woken up (and is
+     * bound to check the condition again).
+     */
+    class EventCount {
+        std::atomic<uint32_t> m_epoch;
+        std::atomic<uint32_t> m_waiters;    // The number of threads between prepare_wait and returning from wait
+        std::atomic<uint32_t> m_woken;      // The number of those which were woken up and haven't returned yet
+
+        /**
+         * Withdraws the calling thread from the waiters.
+         */
+        void leave();
+
+        public:
+            EventCount() : m_epoch(0), m_waiters(0), m_woken(0) { }
+
+            EventCount(const EventCount&) = delete;
+            EventCount& operator=(const EventCount&) = delete;
+
+            /**
+             * Announces that the calling thread is about to wait.
+             * @return              The key to pass to wait.
+             */
+            uint32_t prepare_wait();
+
+            /**
+             * Withdraws a prepare_wait after the condition turned out to hold.
+             */
+            void cancel_wait();
+
+            /**
+             * Blocks until notified after the prepare_wait which returned key (maybe spuriously).
+             */
+            void wait(uint32_t key);
+
+            /**
+             * Wakes up one waiting thread.
+             */
+            void notify();
+
+            /**
+             * Wakes up every waiting thread.
+             */
+            void notify_all();
+    };
+
+    /**
+     * Hints the CPU that the calling thread is spinning.
+     */
+    inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#else
+        std::this_thread::yield();
+#endif
+    }
+
+    /**
+     * @return The number of times to poll for work before parking. Spinning only pays off if whoever produces
+     *         the work can run meanwhile, so there is none on a single CPU.
+     */
+    inline unsigned int spin_polls() {
+        return std::thread::hardware_concurrency() > 1 ? 128 : 0;
+    }
+}
@@ -0,0 +1,295 @@
+#pragma once
+
+#include "knn.h"
+#include "knn-io.h"
+#include "distances.h"
+
+namespace knn {
+    /**
+     * One query of a batch: the nearest class to a point among its k nearest neighbors relative to a metric.
+     */
+    struct BatchQuery {
+        int k;
+        const dubdpoint* point;
+        size_t metric;
+    };
+
+    /**
+     * Receives the Data Points of an upload as they are read, in place of a Data Set keeping them (see
+     * DefaultIO::read_dataset), eg. to send them on to other processes.
+     */
+    class PointSink {
+        public:
+            virtual ~PointSink() { }
+
+            /**
+             * Called once, before the first Data Point.
+             * @param feature_type  The type the features would be stored as (f64, f32, i16 or u8).
+             */
+            virtual void begin(const std::string& feature_type) =0;
+
+            virtual void add(const misc::array<double>& features, const std::string& class_name) =0;
+    };
+
+    /**
+     * A Data Set whose features are stored as one of several types (double, float, int16_t or uint8_t), chosen
+     * per Data Set. Queries are given as doubles and converted to the features' type, and distances are accumulated
+     * in types wide enough for them (see distances::accumulator).
+     * Metrics are given by their index in distances::metric_names. The norms of the Data Points are computed once,
+     * when the Feature Set is constructed, so the inner product metrics cost a single inner product per point.
+     */
+    class FeatureSet {
+        public:
+            virtual ~FeatureSet() { }
+
+            /**
+             * @return The name of the type of the features (f64, f32, i16 or u8, or sparse).
+             */
+            virtual std::string feature_type() const =0;
+
+            /**
+             * @return Whether the Data Points are stored sparsely (see SparseFeatureSet), in which case the Feature
+             *         Set is neither reduced nor sharded, which would store every feature.
+             */
+            virtual bool is_sparse() const { return false; }
+
+            virtual size_t size() const =0;
+
+            /**
+             * @return The number of features of every Data Point (0 if the Data Set is empty).
+             */
+            virtual size_t dims() const =0;
+
+            /**
+             * @return The features of the i-th Data Point, as doubles.
+             */
+            virtual misc::array<double> features(size_t i) const =0;
+
+            /**
+             * @return The number of bytes used by the Data Set and its Data Points.
+             */
+            virtual size_t memory_usage() const =0;
+
+            /**
+             * @return The class of the i-th Data Point.
+             */
+            virtual std::string class_type(size_t i) const =0;
+
+            /**
+             * Gets the class name of the nearest class to a point.
+             * @throws          std::invalid_argument if the point's values don't fit in the features' type.
+             */
+            virtual std::string get_nearest_class(int k, const dubdpoint* p, size_t metric) const =0;
+
+            /**
+             * Gets the class name of the nearest class to the i-th Data Point (which is one of its own neighbors).
+             */
+            virtual std::string get_nearest_class(int k, size_t i, size_t metric) const =0;
+
+            /**
+             * Gets the class name of the nearest class to a sparse point. Feature Sets of dense Data Points expand
+             * it to dims() features.
+             * @throws          std::invalid_argument if the point has a nonzero feature past dims(), or its values
+             *                  don't fit in the features' type.
+             */
+            virtual std::string get_nearest_class(int k, const SparseVector& p, size_t metric) const {
+                CartDataPoint<double> q(p.dense(this->dims()));
+                return this->get_nearest_class(k, &q, metric);
+            }
+
+            /**
+             * Gets the indices of the k nearest neighbors of a point relative to every metric (see
+             * DataSet::get_k_nearest_indices).
+             * @throws          std::invalid_argument if the point's values don't fit in the features' type.
+             */
+            virtual std::vector<std::vector<int>> get_k_nearest_indices(int k, const dubdpoint* p) const =0;
+
+            /**
+             * Gets the indices of the k nearest neighbors of the i-th Data Point relative to every metric, leaving
+             * the point itself out.
+             */
+            virtual std::vector<std::vector<int>> get_k_nearest_indices(int k, size_t i) const =0;
+
+            /**
+             * Gets the indices of the k nearest neighbors of a point relative to a single metric.
+             * @throws          std::invalid_argument if the point's values don't fit in the features' type.
+             */
+            virtual std::vector<int> get_k_nearest_indices(int k, const dubdpoint* p, size_t metric) const =0;
+
+            /**
+             * Ranks candidate neighbors of a point by their distance from it.
+             * @param k             The number of neighbors to keep.
+             * @param p             The point.
+             * @param candidates    Indices of Data Points.
+             * @param metric        The metric to rank by.
+             * @return              The indices of the (at most) k nearest candidates, sorted from nearest to farthest.
+             * @throws              std::invalid_argument if the point's values don't fit in the features' type.
+             */
+            virtual std::vector<int> rerank(int k, const dubdpoint* p, const std::vector<int>& candidates,
+                    size_t metric) const =0;
+
+            /**
+             * Ranks candidate neighbors of the i-th Data Point by their distance from it.
+             */
+            virtual std::vector<int> rerank(int k, size_t i, const std::vector<int>& candidates, size_t metric) const =0;
+
+            /**
+             * @return The distances of Data Points from a point relative to a metric, in the order of indices.
+             * @throws          std::invalid_argument if the point's values don't fit in the features' type.
+             */
+            virtual std::vector<double> distances(const dubdpoint* p, const std::vector<int>& indices, size_t metric) const =0;
+
+            /**
+             * @see DataSet::vote
+             */
+            virtual std::string vote(const std::vector<int>& indices, int k) const =0;
+
+            /**
+             * Gets the nearest class among the nearest neighbors of a point, counting their votes the way
+             * get_nearest_class counts them for the metric: in a map for the metrics scanned by
+             * DataSet::get_nearest_class, and by DataSet::vote for the inner product metrics.
+             * @param indices   The indices of the (at most) k nearest neighbors, sorted from nearest to farthest.
+             */
+            std::string metric_vote(const std::vector<int>& indices, int k, size_t metric) const;
+
+            /**
+             * Gets the nearest classes of several points at once, as get_nearest_class would (up to ties in the
+             * votes). Feature Sets which can answer the whole batch in a single pass over their Data Points do so.
+             * @throws          std::invalid_argument if any of the points' values don't fit in the features' type.
+             */
+            virtual std::vector<std::string> get_nearest_classes(const std::vector<BatchQuery>& queries) const {
+                std::vector<std::string> classes;
+                for (const BatchQuery& q : queries) classes.push_back(this->get_nearest_class(q.k, q.point, q.metric));
+                return classes;
+            }
+
+            /**
+             * Indexes the Data Points by their features, so exact_class finds them without a scan (see
+             * DataSet::build_index). Feature Sets which can't index their Data Points ignore it.
+             */
+            virtual void index_exact_matches() { }
+
+            /**
+             * Gets the class of a Data Point whose features equal a point's, so a point which is already labeled
+             * needn't be classified.
+             * @return          The Data Point's class, "" if there is none (or the Feature Set isn't indexed).
+             */
+            virtual std::string exact_class(const dubdpoint* p) const { return ""; }
+
+        protected:
+            /**
+             * Gets the most common class among neighbors, counted the way DataSet::get_nearest_class counts them.
+             */
+            std::string tally(const std::vector<int>& indices) const;
+    };
+
+    /**
+     * A FeatureSet whose features are T's.
+     */
+    template <typename T>
+    class TypedFeatureSet : public FeatureSet {
+        DataSet<misc::array<T>>* m_data_set;
+        std::vector<double> m_norms;                    // The norm of every Data Point
+
+        public:
+            /**
+             * @param data_set      The Data Set, which is owned (and deleted) by the Feature Set.
+             */
+            TypedFeatureSet(DataSet<misc::array<T>>* data_set);
+            ~TypedFeatureSet() { delete this->m_data_set; }
+
+            TypedFeatureSet(const TypedFeatureSet&) = delete;
+            TypedFeatureSet& operator=(const TypedFeatureSet&) = delete;
+
+            std::string feature_type() const override { return feature_name<T>(); }
+            size_t size() const override { return this->m_data_set->size(); }
+            size_t dims() const override { return this->size() > 0 ? this->data(0).length() : 0; }
+            misc::array<double> features(size_t i) const override;
+            size_t memory_usage() const override {
+                return sizeof(*this) + this->m_norms.capacity() * sizeof(double) + this->m_data_set->memory_usage();
+            }
+            std::string class_type(size_t i) const override { return this->m_data_set->get_data()[i]->class_type(); }
+
+            std::string get_nearest_class(int k, const dubdpoint* p, size_t metric) const override;
+            std::string get_nearest_class(int k, size_t i, size_t metric) const override;
+            std::vector<std::vector<int>> get_k_nearest_indices(int k, const dubdpoint* p) const override;
+            std::vector<std::vector<int>> get_k_nearest_indices(int k, size_t i) const override;
+            std::vector<int> get_k_nearest_indices(int k, const dubdpoint* p, size_t metric) const override;
+            std::vector<int> rerank(int k, const dubdpoint* p, const std::vector<int>& candidates, size_t metric) const override;
+            std::vector<int> rerank(int k, size_t i, const std::vector<int>& candidates, size_t metric) const override;
+            std::vector<double> distances(const dubdpoint* p, const std::vector<int>& indices, size_t metric) const override;
+
+            std::string vote(const std::vector<int>& indices, int k) const override {
+                return this->m_data_set->vote(indices, k);
+            }
+
+            /**
+             * Scans the Data Points in blocks small enough to stay in cache while every query of the batch is
+             * compared with them, so the Data Set is read from memory once per batch rather than once per query.
+             */
+            std::vector<std::string> get_nearest_classes(const std::vector<BatchQuery>& queries) const override;
+
+            void index_exact_matches() override { this->m_data_set->build_index(); }
+            std::string exact_class(const dubdpoint* p) const override;
+
+        private:
+            /**
+             * A neighbor of a query, ordered by distance only (as DataSet::select_k_nearest orders them, so ties
+             * are kept the same way).
+             */
+            struct Neighbor {
+                int index;
+                double distance;
+
+                bool operator<(const Neighbor& other) const { return this->distance < other.distance; }
+            };
+
+            /**
+             * The bytes of Data Points scanned per block by get_nearest_classes.
+             */
+            static const size_t block_bytes = 64 * 1024;
+
+            /**
+             * Converts the data of a point to the features' type.
+             */
+            static misc::array<T> convert(const dubdpoint* p);
+
+            const misc::array<T>& data(size_t i) const { return this->m_data_set->get_data()[i]->data(); }
+
+            /**
+             * @return The distance of the i-th Data Point from a query, given its features and norm.
+             */
+            double distance(const misc::array<T>& q, double norm, size_t i, size_t metric) const;
+
+            /**
+             * Gets the nearest class to a query, given its features and norm.
+             */
+            std::string nearest_class(int k, const misc::array<T>& q, double norm, size_t metric) const;
+
+            /**
+             * Gets the indices of the k nearest neighbors of a query relative to every metric, given its features
+             * and norm.
+             * @param exclude       The index of a Data Point to skip, -1 to skip none.
+             */
+            std::vector<std::vector<int>> all_nearest_indices(int k, const misc::array<T>& q, double norm, int exclude) const;
+
+            /**
+             * Gets the indices of the k nearest neighbors of a query relative to a single metric.
+             */
+            std::vector<int> nearest_indices(int k, const misc::array<T>& q, double norm, size_t metric) const;
+
+            /**
+             * Ranks candidates by their distance from a query, given its features and norm.
+             */
+            std::vector<int> rank(int k, const misc::array<T>& q, double norm, const std::vector<int>& candidates,
+                    size_t metric) const;
+    };
+
+    /**
+     * Wraps a Data Set in a Feature Set (which takes ownership of it).
+     */
+    template <typename T>
+    FeatureSet* make_feature_set(DataSet<misc::array<T>>* data_set) { return new TypedFeatureSet<T>(data_set); }
+}
+
+#include "feature-set.tpp"
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+namespace threading {
+    /**
+     * Lock-free bounded queue for any number of producers and consumers (Vyukov's array queue).
+     * Every cell carries a sequence number which tells whether it is ready to be pushed to or popped from on the
+     * current lap of the ring, so producers and consumers only contend on the head and tail counters.
+     * Neither operation blocks: a push to a full queue and a pop from an empty queue fail instead.
+     */
+    template <typename T>
+    class MPMCQueue {
+        static const size_t cache_line = 64;
+
+        struct Cell {
+            std::atomic<size_t> sequence;
+            T data;
+        };
+
+        Cell* m_cells;
+        size_t m_mask;
+
+        /* The counters are written by different threads, so they are kept on separate cache lines */
+        char m_pad0[cache_line];
+        std::atomic<size_t> m_head;     // The position of the next push
+        char m_pad1[cache_line];
+        std::atomic<size_t> m_tail;     // The position of the next pop
+        char m_pad2[cache_line];
+
+        public:
+            /**
+             * Constructor for an MPMCQueue.
+             * @param capacity      The maximal number of items in the queue, rounded up to a power of two.
+             */
+            MPMCQueue(size_t capacity);
+            ~MPMCQueue() { delete[] this->m_cells; }
+
+            MPMCQueue(const MPMCQueue&) = delete;
+            MPMCQueue& operator=(const MPMCQueue&) = delete;
+
+            /**
+             * Pushes an item to the queue.
+             * @param item          The item to push.
+             * @return              False if the queue is full (and the item was not pushed).
+             */
+            bool try_push(T item);
+
+            /**
+             * Pops the oldest item from the queue.
+             * @param item          Receives the popped item.
+             * @return              False if the queue is empty.
+             */
+            bool try_pop(T& item);
+
+            size_t capacity() const { return this->m_mask + 1; }
+    };
+}
+
+#include "mpmc-queue.tpp"
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace placement {
+    /**
+     * The NUMA nodes of the machine and the CPUs of each which the process may run on.
+     * Machines without NUMA information (or with a single node) have a single node holding every CPU.
+     */
+    class Topology {
+        std::vector<std::vector<int>> m_nodes;      // The CPUs of every node, nodes without usable CPUs left out
+        std::vector<int> m_node_ids;                // The id of every node (as numbered by the kernel)
+
+        public:
+            /**
+             * Detects the topology from /sys/devices/system/node, restricted to the process' CPU affinity.
+             */
+            static Topology detect();
+
+            size_t nodes() const { return this->m_nodes.size(); }
+            size_t cpus() const;
+            const std::vector<int>& node_cpus(size_t node) const { return this->m_nodes[node]; }
+
+            /**
+             * @return The index (in this topology) of the node of a CPU, 0 if the CPU is unknown.
+             */
+            size_t node_of(int cpu) const;
+
+            /**
+             * @return The node the calling thread is running on.
+             */
+            size_t current_node() const;
+
+            /**
+             * @return A description of the topology for logging (eg. "2 NUMA nodes, 32 CPUs (node 0: 0-15, node 1: 16-31)").
+             */
+            std::string describe() const;
+    };
+
+    /**
+     * How worker threads are placed:
+     * + none : threads run wherever the scheduler puts them
+     * + cores : every thread is pinned to a single CPU, round-robin over the CPUs
+     * + nodes : every thread is pinned to the CPUs of a single node, round-robin over the nodes, so the Data Sets
+     *   a session allocates (which are placed on first touch) are on the node of the threads which scan them
+     */
+    enum Policy { none, cores, nodes };
+
+    /**
+     * @throws std::invalid_argument if the name isn't a policy.
+     */
+    Policy parse_policy(const std::string& name);
+    std::string policy_name(Policy policy);
+
+    /**
+     * Pins the calling thread to a set of CPUs.
+     * @return Whether the thread was pinned.
+     */
+    bool pin_thread(const std::vector<int>& cpus);
+
+    /**
+     * Places the calling thread as the i-th worker by a policy.
+     * @return Whether the thread was placed (always true for none).
+     */
+    bool place_worker(Policy policy, const Topology& topology, size_t i);
+}
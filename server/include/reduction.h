@@ -0,0 +1,161 @@
+#pragma once
+
+#include "feature-set.h"
+
+#include <algorithm>
+
+namespace knn {
+    /**
+     * How uploaded Data Sets are reduced to fewer dimensions.
+     */
+    struct Reduction {
+        enum Method { none, pca, gaussian, sparse };
+
+        Method method;
+        size_t dims;            // The number of dimensions to reduce to (0 to choose them by variance)
+        double variance;        // For PCA, the ratio of the variance to keep if dims is 0
+        size_t rerank;          // Queries rerank rerank * k candidates on the original features
+
+        static const size_t max_rerank = 1024;
+
+        Reduction() : method(none), dims(0), variance(0), rerank(4) { }
+
+        /**
+         * Parses a reduction of the form method:target, where method is pca, gaussian or sparse and target is
+         * a number of dimensions, or for PCA a ratio of variance below 1 (eg. pca:0.95).
+         * @throws          std::invalid_argument if the reduction is malformed.
+         */
+        static Reduction parse(const std::string& reduction);
+    };
+
+    /**
+     * A linear map x -> W(x - mean) onto fewer dimensions.
+     */
+    class Projection {
+        size_t m_input_dims;
+        size_t m_output_dims;
+        std::vector<double> m_mean;
+        std::vector<double> m_matrix;           // output_dims x input_dims, row-major
+
+        public:
+            Projection() : m_input_dims(0), m_output_dims(0) { }
+
+            /**
+             * Fits a projection onto the principal components of a Data Set, computed by power iteration with
+             * deflation on its covariance matrix.
+             * @param data_set      The Data Set.
+             * @param dims          The number of components to keep, 0 to keep as many as needed for variance.
+             * @param variance      The ratio of the total variance the kept components should explain.
+             */
+            static Projection pca(const FeatureSet& data_set, size_t dims, double variance);
+
+            /**
+             * Creates a random projection, whose entries are Gaussian (N(0, 1/output_dims)) or sparse
+             * (sqrt(3/output_dims) times +1 or -1 with probability 1/6 each, and 0 otherwise).
+             */
+            static Projection random(size_t input_dims, size_t output_dims, bool sparse, unsigned seed=1);
+
+            size_t input_dims() const { return this->m_input_dims; }
+            size_t output_dims() const { return this->m_output_dims; }
+
+            /**
+             * @return Whether points are centered before they are projected, which doesn't preserve their angles.
+             */
+            bool centered() const {
+                for (double x : this->m_mean) if (x != 0) return true;
+                return false;
+            }
+
+            misc::array<double> apply(const misc::array<double>& x) const;
+
+            size_t memory_usage() const {
+                return sizeof(*this) + (this->m_mean.capacity() + this->m_matrix.capacity()) * sizeof(double);
+            }
+    };
+
+    /**
+     * A Feature Set whose queries scan a projection of it onto fewer dimensions, and then rerank the nearest
+     * candidates on the original features.
+     * Queries (and the points of the Data Set) are projected with the same Projection, so the candidates of every
+     * query are found consistently. The inner product metrics are only scanned in the projection if it isn't
+     * centered, and otherwise scan the original features.
+     */
+    class ReducedFeatureSet : public FeatureSet {
+        FeatureSet* m_original;
+        FeatureSet* m_reduced;
+        Projection m_projection;
+        size_t m_rerank;
+
+        public:
+            /**
+             * @param original      The Feature Set, which is owned (and deleted) by the Reduced Feature Set.
+             * @param projection    The projection to scan in.
+             * @param rerank        The number of candidates reranked per neighbor.
+             */
+            ReducedFeatureSet(FeatureSet* original, const Projection& projection, size_t rerank);
+            ~ReducedFeatureSet();
+
+            ReducedFeatureSet(const ReducedFeatureSet&) = delete;
+            ReducedFeatureSet& operator=(const ReducedFeatureSet&) = delete;
+
+            std::string feature_type() const override { return this->m_original->feature_type(); }
+            size_t size() const override { return this->m_original->size(); }
+            size_t dims() const override { return this->m_original->dims(); }
+            misc::array<double> features(size_t i) const override { return this->m_original->features(i); }
+            size_t memory_usage() const override;
+            std::string class_type(size_t i) const override { return this->m_original->class_type(i); }
+
+            std::string get_nearest_class(int k, const dubdpoint* p, size_t metric) const override;
+            std::string get_nearest_class(int k, size_t i, size_t metric) const override;
+            std::vector<std::vector<int>> get_k_nearest_indices(int k, const dubdpoint* p) const override;
+            std::vector<std::vector<int>> get_k_nearest_indices(int k, size_t i) const override;
+            std::vector<int> get_k_nearest_indices(int k, const dubdpoint* p, size_t metric) const override;
+
+            std::vector<int> rerank(int k, const dubdpoint* p, const std::vector<int>& candidates, size_t metric) const override {
+                return this->m_original->rerank(k, p, candidates, metric);
+            }
+            std::vector<int> rerank(int k, size_t i, const std::vector<int>& candidates, size_t metric) const override {
+                return this->m_original->rerank(k, i, candidates, metric);
+            }
+
+            std::vector<double> distances(const dubdpoint* p, const std::vector<int>& indices, size_t metric) const override {
+                return this->m_original->distances(p, indices, metric);
+            }
+
+            std::string vote(const std::vector<int>& indices, int k) const override {
+                return this->m_original->vote(indices, k);
+            }
+
+            void index_exact_matches() override { this->m_original->index_exact_matches(); }
+            std::string exact_class(const dubdpoint* p) const override { return this->m_original->exact_class(p); }
+
+        private:
+            /**
+             * @return The features of the i-th Data Point in the projection.
+             */
+            misc::array<double> projected(size_t i) const { return this->m_reduced->features(i); }
+
+            /**
+             * @return The number of candidates to rerank for k neighbors, at most every Data Point.
+             */
+            int candidates(int k) const {
+                size_t candidates = (size_t)std::max(k, 0) * this->m_rerank;
+                return (int)std::min(candidates, this->size());
+            }
+
+            /**
+             * @return Whether the nearest neighbors relative to a metric are found in the projection.
+             */
+            bool scans_projection(size_t metric) const {
+                return metric < distances::cosine_metric || !this->m_projection.centered();
+            }
+    };
+
+    /**
+     * Reduces a Feature Set as configured.
+     * @param data_set      The Feature Set, which is owned by the reduced Feature Set (and deleted if reducing fails).
+     * @param reduction     The reduction.
+     * @return              The reduced Feature Set, or data_set if the reduction wouldn't reduce its dimensions.
+     */
+    FeatureSet* reduce(FeatureSet* data_set, const Reduction& reduction);
+}
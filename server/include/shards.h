@@ -0,0 +1,128 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include "feature-set.h"
+#include "reduction.h"
+
+namespace knn {
+    /**
+     * Thrown when a shard fails: its worker can't be reached, drops the connection or can't hold its Data Points.
+     */
+    class ShardFailure : public std::runtime_error {
+        public:
+            ShardFailure(const std::string& what) : std::runtime_error(what) { }
+    };
+
+    /**
+     * Parses a comma-separated list of the ip:port addresses of shard workers.
+     * @throws std::invalid_argument if the list is malformed.
+     */
+    std::vector<streams::Address> parse_shards(const std::string& shards);
+
+    /**
+     * Serves a coordinator's connection as one shard of its Data Set, until the coordinator closes it (which
+     * also cancels a query in progress).
+     * @param socket        The connection.
+     * @param reduction     How the shard is reduced once it is loaded.
+     */
+    void serve_shard(streams::TCPSocket socket, Reduction reduction);
+
+    /**
+     * A Feature Set partitioned across worker processes (knnserver --worker), the i-th Data Point going to the
+     * shard i % N. Queries are sent to every shard, and the shards' top-k lists are merged by distance, so they find
+     * the same neighbors as a single Feature Set would. The class names are kept locally, so votes don't reach the
+     * shards.
+     * It is loaded as a PointSink: every Data Point is sent on to its shard as it is added, so the coordinator only
+     * ever holds the classes, however large the upload.
+     * A shard whose connection fails fails every later query (with a ShardFailure) rather than leaving its Data
+     * Points out of the results.
+     */
+    class ShardedFeatureSet : public FeatureSet, public PointSink {
+        struct Shard;
+
+        std::vector<std::unique_ptr<Shard>> m_shards;
+        std::vector<std::string> m_classes;
+        std::string m_feature_type;
+        size_t m_dims;
+        bool m_loading;                         // Whether the shards were sent their load requests
+        std::function<void(size_t)> m_reserve;
+        mutable std::mutex m_mutex;
+        mutable std::string m_failure;          // Why the shards failed (empty if they didn't)
+
+        public:
+            /**
+             * Connects to the workers. The Data Points are then added (see PointSink), and finish ends the upload.
+             * @param workers       The addresses of the workers.
+             * @param reserve       If given, called with the number of bytes kept for every Data Point (its class)
+             *                      before it is added. It may throw to stop the upload.
+             * @throws              ShardFailure if a worker can't be reached.
+             */
+            ShardedFeatureSet(const std::vector<streams::Address>& workers, std::function<void(size_t)> reserve=nullptr);
+            ~ShardedFeatureSet();
+
+            /**
+             * Sets the type the shards store the features as (f64 if it isn't set).
+             */
+            void begin(const std::string& feature_type) override { this->m_feature_type = feature_type; }
+
+            /**
+             * Sends a Data Point on to its shard.
+             * @throws              ShardFailure if the shard's connection fails.
+             */
+            void add(const misc::array<double>& features, const std::string& class_name) override;
+
+            /**
+             * Ends the upload, once every Data Point is added.
+             * @throws              ShardFailure if a shard fails or can't hold its Data Points.
+             */
+            void finish();
+
+            ShardedFeatureSet(const ShardedFeatureSet&) = delete;
+            ShardedFeatureSet& operator=(const ShardedFeatureSet&) = delete;
+
+            std::string feature_type() const override { return this->m_feature_type; }
+            size_t size() const override { return this->m_classes.size(); }
+            size_t dims() const override { return this->m_dims; }
+            misc::array<double> features(size_t i) const override;
+            size_t memory_usage() const override;
+            std::string class_type(size_t i) const override { return this->m_classes[i]; }
+
+            std::string get_nearest_class(int k, const dubdpoint* p, size_t metric) const override;
+            std::string get_nearest_class(int k, size_t i, size_t metric) const override;
+            std::vector<std::vector<int>> get_k_nearest_indices(int k, const dubdpoint* p) const override;
+            std::vector<std::vector<int>> get_k_nearest_indices(int k, size_t i) const override;
+            std::vector<int> get_k_nearest_indices(int k, const dubdpoint* p, size_t metric) const override;
+            std::vector<int> rerank(int k, const dubdpoint* p, const std::vector<int>& candidates, size_t metric) const override;
+            std::vector<int> rerank(int k, size_t i, const std::vector<int>& candidates, size_t metric) const override;
+            std::vector<double> distances(const dubdpoint* p, const std::vector<int>& indices, size_t metric) const override;
+            std::string vote(const std::vector<int>& indices, int k) const override;
+
+        private:
+            /**
+             * Sends every shard its load request, which the Data Points then follow.
+             */
+            void start_loading();
+
+            /**
+             * Sends a request to every shard, and then receives the response of every shard a request was sent to.
+             * @param send          Called as send(shard, serializer) to write the request of each shard, returns
+             *                      whether it wrote one.
+             * @param receive       Called as receive(shard, serializer) to read the response of each shard.
+             * @throws              ShardFailure if a shard fails, std::invalid_argument if a shard rejects the
+             *                      request as invalid (once every shard has responded).
+             */
+            void exchange(std::function<bool(size_t, streams::Serializer&)> send,
+                    std::function<void(size_t, streams::Serializer&)> receive) const;
+
+            /**
+             * Gets the k nearest neighbors of a point from every shard and merges them.
+             * @param metric        The index of the metric, or num_metrics for every metric.
+             * @param exclude       The index of a Data Point to leave out of its own neighbors (in which case
+             *                      p is its features), -1 to leave none out.
+             * @return              For each metric, the indices of the k nearest neighbors, nearest first.
+             */
+            std::vector<std::vector<int>> query(int k, const dubdpoint* p, size_t metric, int exclude) const;
+    };
+}
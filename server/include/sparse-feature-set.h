@@ -0,0 +1,88 @@
+#pragma once
+
+#include "feature-set.h"
+
+namespace knn {
+    /**
+     * A Feature Set of sparse Data Points (see SparseDataSet), for Data Sets which are mostly zeros. Distances are
+     * computed by the sparse kernels of distances, which merge the nonzeros of the query and of a Data Point, so
+     * both the memory of the Feature Set and the cost of a scan are proportional to its number of nonzeros. The
+     * norms of the Data Points are computed once, as TypedFeatureSet computes them.
+     * Dense queries are reduced to their nonzeros before the scan. Unlike DataSet::get_nearest_class, every metric
+     * breaks ties in the vote by the nearest neighbor (see vote).
+     */
+    class SparseFeatureSet : public FeatureSet {
+        SparseDataSet* m_data_set;
+        std::vector<double> m_norms;                    // The norm of every Data Point
+
+        public:
+            /**
+             * @param data_set      The Data Set, which is owned (and deleted) by the Feature Set.
+             */
+            SparseFeatureSet(SparseDataSet* data_set);
+            ~SparseFeatureSet() { delete this->m_data_set; }
+
+            SparseFeatureSet(const SparseFeatureSet&) = delete;
+            SparseFeatureSet& operator=(const SparseFeatureSet&) = delete;
+
+            std::string feature_type() const override { return "sparse"; }
+            bool is_sparse() const override { return true; }
+            size_t size() const override { return this->m_data_set->size(); }
+            size_t dims() const override { return this->m_data_set->dims(); }
+            misc::array<double> features(size_t i) const override;
+            size_t memory_usage() const override {
+                return sizeof(*this) + this->m_norms.capacity() * sizeof(double) + this->m_data_set->memory_usage();
+            }
+            std::string class_type(size_t i) const override { return this->m_data_set->class_type(i); }
+
+            std::string get_nearest_class(int k, const dubdpoint* p, size_t metric) const override;
+            std::string get_nearest_class(int k, size_t i, size_t metric) const override;
+            std::string get_nearest_class(int k, const SparseVector& p, size_t metric) const override;
+            std::vector<std::vector<int>> get_k_nearest_indices(int k, const dubdpoint* p) const override;
+            std::vector<std::vector<int>> get_k_nearest_indices(int k, size_t i) const override;
+            std::vector<int> get_k_nearest_indices(int k, const dubdpoint* p, size_t metric) const override;
+            std::vector<int> rerank(int k, const dubdpoint* p, const std::vector<int>& candidates, size_t metric) const override;
+            std::vector<int> rerank(int k, size_t i, const std::vector<int>& candidates, size_t metric) const override;
+            std::vector<double> distances(const dubdpoint* p, const std::vector<int>& indices, size_t metric) const override;
+            std::string vote(const std::vector<int>& indices, int k) const override;
+
+        private:
+            static SparseRow row(const SparseVector& p) { return SparseRow{p.indices.data(), p.values.data(), p.nnz()}; }
+
+            /**
+             * @return The norm of a sparse point.
+             */
+            static double norm(const SparseRow& q) { return distances::norm_kernel(q.values, q.nnz); }
+
+            /**
+             * @return The distance of the i-th Data Point from a query, given its nonzeros and norm.
+             */
+            double distance(const SparseRow& q, double norm, size_t i, size_t metric) const;
+
+            /**
+             * Gets the indices of the k nearest neighbors relative to several metrics at once (as
+             * DataSet::select_k_nearest does).
+             * @param distances     Called as distances(i, out) to write the distances of the i-th Data Point.
+             */
+            template <typename D>
+            std::vector<std::vector<int>> select_k_nearest(int k, D distances, size_t num_metrics, int exclude=-1) const;
+
+            /**
+             * Gets the indices of the k nearest neighbors of a query relative to every metric, given its nonzeros
+             * and norm.
+             * @param exclude       The index of a Data Point to skip, -1 to skip none.
+             */
+            std::vector<std::vector<int>> all_nearest_indices(int k, const SparseRow& q, double norm, int exclude) const;
+
+            /**
+             * Gets the indices of the k nearest neighbors of a query relative to a single metric.
+             */
+            std::vector<int> nearest_indices(int k, const SparseRow& q, double norm, size_t metric) const;
+
+            /**
+             * Ranks candidates by their distance from a query, given its nonzeros and norm.
+             */
+            std::vector<int> rank(int k, const SparseRow& q, double norm, const std::vector<int>& candidates,
+                    size_t metric) const;
+    };
+}
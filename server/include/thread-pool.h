@@ -1,11 +1,13 @@
 #pragma once
 
 #include <thread>
-#include <mutex>
+#include <atomic>
 #include <functional>
-#include <condition_variable>
 #include <vector>
-#include <queue>
+
+#include "metrics.h"
+#include "mpmc-queue.h"
+#include "event-count.h"
 
 namespace threading {
     /**
@@ -33,23 +35,39 @@ namespace threading {
  
     /**
      * Thread pool for synchronous execution of tasks.
+     * Jobs are queued on a lock-free bounded queue. Idle threads spin on it briefly, and then park until a job
+     * is added.
      */
     class ThreadPool {
-        bool should_terminate;
-        std::mutex jobs_mutex;
-        std::condition_variable mutex_condition;
+        std::atomic<bool> should_terminate;
+        unsigned int spin_limit;            // The number of empty polls before a thread parks
         std::vector<std::thread> threads;
-        std::queue<Job> jobs;
+        MPMCQueue<Job> jobs;
+        EventCount jobs_added;
+        metrics::Gauge& queue_depth;        // The number of jobs waiting for a thread
+        metrics::Gauge& busy_threads;       // The number of threads running a job
+        std::function<void(unsigned int)> on_start;
+
+        void thread_loop(unsigned int i);
 
-        void thread_loop();
+        /**
+         * Waits for the next job.
+         * @param job           Receives the job.
+         * @return              False if the pool was stopped.
+         */
+        bool next_job(Job& job);
 
         public:
             /**
              * Constructor for a ThreadPool.
              * Begins execution of ThreadPool as well.
              * @param num_threads       The number of threads to pool.
+             * @param on_start          Called by the i-th thread as on_start(i) before it runs any job (eg. to pin it
+             *                          to CPUs), may be null.
+             * @param capacity          The maximal number of jobs waiting for a thread, rounded up to a power of two.
              */
-            ThreadPool(unsigned int num_threads);
+            ThreadPool(unsigned int num_threads, std::function<void(unsigned int)> on_start=nullptr,
+                    size_t capacity=1024);
 
             /**
              * Destructs the thread pool and joins all the threads.
@@ -60,9 +78,11 @@ namespace threading {
              * Adds a job to the pool.
              * @param job           The job/function to run.
              * @param params        The parameters to pass to the job.
+             * @return              False if the queue of jobs is full (and the job was not added), so the caller
+             *                      can back off or reject the work.
              */
             template <typename... Params>
-            void add_job(void (*job)(Params...), Params... params);
+            bool add_job(void (*job)(Params...), Params... params);
 
             /**
              * Stops the thread pool, joining all threads.
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <thread>
+
+#include "cancellation.h"
+
+namespace cancellation {
+    /**
+     * Cancels the tokens of connections whose peer hangs up, so the threads serving them stop working for nobody.
+     * A single thread polls every watched connection for hangups (POLLRDHUP), and is woken up through a pipe
+     * whenever the watched connections change, so hangups are noticed as soon as they arrive.
+     */
+    class Watchdog {
+        struct Watched {
+            Token* token;
+            uint64_t id;            // Tells a connection apart from a later one with the same descriptor
+            bool fired;
+        };
+
+        std::mutex m_mutex;
+        std::map<int, Watched> m_watched;
+        uint64_t m_next_id;
+        int m_wake[2];
+        std::thread m_thread;
+
+        void run();
+        void wake();
+
+        public:
+            Watchdog();
+
+            Watchdog(const Watchdog&) = delete;
+            Watchdog& operator=(const Watchdog&) = delete;
+
+            /**
+             * Starts watching a connection.
+             * @param fd            The connection's descriptor, which must stay open until it is unwatched.
+             * @param token         The token to cancel when the peer hangs up.
+             */
+            void watch(int fd, Token* token);
+
+            /**
+             * Stops watching a connection (unless it was watched again, for another token).
+             */
+            void unwatch(int fd, Token* token);
+    };
+
+    /**
+     * @return The watchdog of the process, whose thread is started on first use.
+     */
+    Watchdog& watchdog();
+
+    /**
+     * Watches a connection for the watch's lifetime.
+     */
+    class Watch {
+        int m_fd;
+        Token* m_token;
+
+        public:
+            Watch(int fd, Token* token) : m_fd(fd), m_token(token) { watchdog().watch(fd, token); }
+            ~Watch() { watchdog().unwatch(this->m_fd, this->m_token); }
+
+            Watch(const Watch&) = delete;
+            Watch& operator=(const Watch&) = delete;
+    };
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+namespace threading {
+    template <typename T>
+    bool BoundedQueue<T>::push(T item) {
+        {
+            std::unique_lock<std::mutex> lock{this->m_mutex};
+            this->m_not_full.wait(lock, [this] {
+                    return this->m_items.size() < this->m_capacity || this->m_closed;
+                });
+
+            if (this->m_closed) return false;
+            this->m_items.push(std::move(item));
+        }
+
+        this->m_not_empty.notify_one();
+        return true;
+    }
+
+    template <typename T>
+    bool BoundedQueue<T>::pop(T& item) {
+        {
+            std::unique_lock<std::mutex> lock{this->m_mutex};
+            this->m_not_empty.wait(lock, [this] {
+                    return !this->m_items.empty() || this->m_closed;
+                });
+
+            if (this->m_items.empty()) return false;
+            item = std::move(this->m_items.front());
+            this->m_items.pop();
+        }
+
+        this->m_not_full.notify_one();
+        return true;
+    }
+
+    template <typename T>
+    void BoundedQueue<T>::close() {
+        {
+            std::unique_lock<std::mutex> lock{this->m_mutex};
+            this->m_closed = true;
+        }
+
+        this->m_not_full.notify_all();
+        this->m_not_empty.notify_all();
+    }
+}
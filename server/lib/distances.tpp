@@ -0,0 +1,305 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdlib>
+#include <stdexcept>
+#include <type_traits>
+
+namespace distances {
+    /*
+     * The compiler may only vectorize (reorder) a floating point reduction under "omp simd". The sums of the integer
+     * types are exact in every order, and narrow within a block (see accumulator), so their loops vectorize too.
+     */
+
+    /**
+     * Sums term(i) over [0, n), a block of accumulator<T>::block_size at a time.
+     */
+    template <typename T, typename F>
+    typename accumulator<T>::sum_type blocked_sum(size_t n, F term) {
+        typedef typename accumulator<T>::sum_type S;
+        typedef typename accumulator<T>::block_type B;
+        S sum = 0;
+
+        for (size_t start = 0; start < n; start += std::min(n - start, accumulator<T>::block_size)) {
+            size_t end = start + std::min(n - start, accumulator<T>::block_size);
+            B block = 0;
+            if (std::is_floating_point<B>::value) {
+                #pragma omp simd reduction(+:block)
+                for (size_t i = start; i < end; i++) block += term(i);
+            } else {
+                for (size_t i = start; i < end; i++) block += term(i);
+            }
+            sum += (S)block;
+        }
+
+        return sum;
+    }
+
+    template <typename T>
+    double euclidean_kernel(const T* a, const T* b, size_t n) {
+        typedef typename accumulator<T>::diff_type D;
+        typedef typename accumulator<T>::block_type B;
+
+        // Don't need to take sqrt since sqrt(x) < sqrt(y) iff x < y
+        return (double)blocked_sum<T>(n, [a, b](size_t i) {
+                D diff = (D)a[i] - (D)b[i];
+                return (B)diff * (B)diff;
+            });
+    }
+
+    template <typename T>
+    double manhattan_kernel(const T* a, const T* b, size_t n) {
+        typedef typename accumulator<T>::diff_type D;
+        typedef typename accumulator<T>::block_type B;
+        return (double)blocked_sum<T>(n, [a, b](size_t i) { return (B)std::abs((D)a[i] - (D)b[i]); });
+    }
+
+    template <typename T>
+    double chebyshev_kernel(const T* a, const T* b, size_t n) {
+        typedef typename accumulator<T>::diff_type D;
+        D max = 0;
+        auto term = [a, b](size_t i) { return (D)std::abs((D)a[i] - (D)b[i]); };
+
+        if (std::is_floating_point<T>::value) {
+            #pragma omp simd reduction(max:max)
+            for (size_t i = 0; i < n; i++) max = std::max(max, term(i));
+        } else {
+            for (size_t i = 0; i < n; i++) max = std::max(max, term(i));
+        }
+
+        return (double)max;
+    }
+
+    template <typename T>
+    double dot_kernel(const T* a, const T* b, size_t n) {
+        typedef typename accumulator<T>::diff_type D;
+        typedef typename accumulator<T>::block_type B;
+
+        /* The products of the integer types fit in an int, which is what their diff_type is multiplied in */
+        return (double)blocked_sum<T>(n, [a, b](size_t i) { return (B)((D)a[i] * (D)b[i]); });
+    }
+
+    template <typename T>
+    double norm_kernel(const T* a, size_t n) {
+        return std::sqrt(dot_kernel(a, a, n));
+    }
+
+    template <typename T>
+    void all_kernel(const T* a, const T* b, size_t n, double norm_a, double norm_b, double* out) {
+        typedef typename accumulator<T>::diff_type D;
+        typedef typename accumulator<T>::sum_type S;
+        typedef typename accumulator<T>::block_type B;
+        S euc = 0;
+        S man = 0;
+        D che = 0;
+        S dot = 0;
+        auto step = [a, b](size_t i, B& euc, B& man, D& che, B& dot) {
+            D diff = std::abs((D)a[i] - (D)b[i]);
+            euc += (B)diff * (B)diff;
+            man += (B)diff;
+            che = std::max(che, diff);
+            dot += (B)((D)a[i] * (D)b[i]);
+        };
+
+        /* As blocked_sum, for the three sums at once */
+        for (size_t start = 0; start < n; start += std::min(n - start, accumulator<T>::block_size)) {
+            size_t end = start + std::min(n - start, accumulator<T>::block_size);
+            B block_euc = 0;
+            B block_man = 0;
+            B block_dot = 0;
+            if (std::is_floating_point<B>::value) {
+                #pragma omp simd reduction(+:block_euc, block_man, block_dot) reduction(max:che)
+                for (size_t i = start; i < end; i++) step(i, block_euc, block_man, che, block_dot);
+            } else {
+                for (size_t i = start; i < end; i++) step(i, block_euc, block_man, che, block_dot);
+            }
+
+            euc += (S)block_euc;
+            man += (S)block_man;
+            dot += (S)block_dot;
+        }
+
+        out[0] = (double)euc;
+        out[1] = (double)man;
+        out[2] = (double)che;
+        out[cosine_metric] = from_dot(cosine_metric, (double)dot, norm_a, norm_b);
+        out[inner_product_metric] = from_dot(inner_product_metric, (double)dot, norm_a, norm_b);
+    }
+
+    /**
+     * Calls f(a, b) with the values of both sparse points at every index either of them has a nonzero at (a value
+     * is 0 where its point has none).
+     */
+    template <typename T, typename F>
+    inline void sparse_merge(const uint32_t* ai, const T* av, size_t an, const uint32_t* bi, const T* bv, size_t bn, F f) {
+        size_t i = 0;
+        size_t j = 0;
+
+        while (i < an && j < bn) {
+            if (ai[i] == bi[j]) f(av[i++], bv[j++]);
+            else if (ai[i] < bi[j]) f(av[i++], (T)0);
+            else f((T)0, bv[j++]);
+        }
+        for (; i < an; i++) f(av[i], (T)0);
+        for (; j < bn; j++) f((T)0, bv[j]);
+    }
+
+    template <typename T>
+    double sparse_euclidean_kernel(const uint32_t* ai, const T* av, size_t an, const uint32_t* bi, const T* bv, size_t bn) {
+        typedef typename accumulator<T>::diff_type D;
+        typedef typename accumulator<T>::sum_type S;
+        S sum = 0;
+
+        sparse_merge(ai, av, an, bi, bv, bn, [&sum](T a, T b) {
+                D diff = (D)a - (D)b;
+                sum += (S)diff * diff;
+            });
+
+        return (double)sum;
+    }
+
+    template <typename T>
+    double sparse_manhattan_kernel(const uint32_t* ai, const T* av, size_t an, const uint32_t* bi, const T* bv, size_t bn) {
+        typedef typename accumulator<T>::diff_type D;
+        typedef typename accumulator<T>::sum_type S;
+        S sum = 0;
+
+        sparse_merge(ai, av, an, bi, bv, bn, [&sum](T a, T b) { sum += std::abs((D)a - (D)b); });
+
+        return (double)sum;
+    }
+
+    template <typename T>
+    double sparse_chebyshev_kernel(const uint32_t* ai, const T* av, size_t an, const uint32_t* bi, const T* bv, size_t bn) {
+        typedef typename accumulator<T>::diff_type D;
+        D max = 0;
+
+        sparse_merge(ai, av, an, bi, bv, bn, [&max](T a, T b) { max = std::max(max, (D)std::abs((D)a - (D)b)); });
+
+        return (double)max;
+    }
+
+    template <typename T>
+    double sparse_dot_kernel(const uint32_t* ai, const T* av, size_t an, const uint32_t* bi, const T* bv, size_t bn) {
+        typedef typename accumulator<T>::diff_type D;
+        typedef typename accumulator<T>::sum_type S;
+        S sum = 0;
+        size_t i = 0;
+        size_t j = 0;
+
+        /* Only the indices both points have nonzeros at contribute */
+        while (i < an && j < bn) {
+            if (ai[i] == bi[j]) sum += (S)((D)av[i++] * (D)bv[j++]);
+            else if (ai[i] < bi[j]) i++;
+            else j++;
+        }
+
+        return (double)sum;
+    }
+
+    template <typename T>
+    void sparse_all_kernel(const uint32_t* ai, const T* av, size_t an, const uint32_t* bi, const T* bv, size_t bn,
+            double norm_a, double norm_b, double* out) {
+        typedef typename accumulator<T>::diff_type D;
+        typedef typename accumulator<T>::sum_type S;
+        S euc = 0;
+        S man = 0;
+        D che = 0;
+        S dot = 0;
+
+        sparse_merge(ai, av, an, bi, bv, bn, [&](T a, T b) {
+                D diff = std::abs((D)a - (D)b);
+                euc += (S)diff * diff;
+                man += diff;
+                che = std::max(che, diff);
+                dot += (S)((D)a * (D)b);
+            });
+
+        out[0] = (double)euc;
+        out[1] = (double)man;
+        out[2] = (double)che;
+        out[cosine_metric] = from_dot(cosine_metric, (double)dot, norm_a, norm_b);
+        out[inner_product_metric] = from_dot(inner_product_metric, (double)dot, norm_a, norm_b);
+    }
+
+    template <typename T>
+    double euclidean(const knn::DataPoint<misc::array<T>>* p1, const knn::DataPoint<misc::array<T>>* p2) {
+        const misc::array<T>& a = p1->data();
+        const misc::array<T>& b = p2->data();
+        a.assert_comparable(b);         // Check that both arrays are of a comparable length.
+        return euclidean_kernel(a.data(), b.data(), a.length());
+    }
+
+    template <typename T>
+    double manhattan(const knn::DataPoint<misc::array<T>>* p1, const knn::DataPoint<misc::array<T>>* p2) {
+        const misc::array<T>& a = p1->data();
+        const misc::array<T>& b = p2->data();
+        a.assert_comparable(b);
+        return manhattan_kernel(a.data(), b.data(), a.length());
+    }
+
+    template <typename T>
+    double chebyshev(const knn::DataPoint<misc::array<T>>* p1, const knn::DataPoint<misc::array<T>>* p2) {
+        const misc::array<T>& a = p1->data();
+        const misc::array<T>& b = p2->data();
+        a.assert_comparable(b);
+        return chebyshev_kernel(a.data(), b.data(), a.length());
+    }
+
+    template <typename T>
+    double cosine(const knn::DataPoint<misc::array<T>>* p1, const knn::DataPoint<misc::array<T>>* p2) {
+        const misc::array<T>& a = p1->data();
+        const misc::array<T>& b = p2->data();
+        a.assert_comparable(b);
+        return from_dot(cosine_metric, dot_kernel(a.data(), b.data(), a.length()),
+                norm_kernel(a.data(), a.length()), norm_kernel(b.data(), b.length()));
+    }
+
+    template <typename T>
+    double inner_product(const knn::DataPoint<misc::array<T>>* p1, const knn::DataPoint<misc::array<T>>* p2) {
+        const misc::array<T>& a = p1->data();
+        const misc::array<T>& b = p2->data();
+        a.assert_comparable(b);
+        return -dot_kernel(a.data(), b.data(), a.length());
+    }
+
+    template <typename T>
+    void all(const knn::DataPoint<misc::array<T>>* p1, const knn::DataPoint<misc::array<T>>* p2, double* out) {
+        const misc::array<T>& a = p1->data();
+        const misc::array<T>& b = p2->data();
+        a.assert_comparable(b);
+        all_kernel(a.data(), b.data(), a.length(), norm_kernel(a.data(), a.length()), norm_kernel(b.data(), b.length()), out);
+    }
+
+    template <typename T>
+    double (*metric_kernel(size_t metric))(const T*, const T*, size_t) {
+        switch (metric) {
+            case 0: return euclidean_kernel<T>;
+            case 1: return manhattan_kernel<T>;
+            case 2: return chebyshev_kernel<T>;
+            default: throw std::invalid_argument("no kernel for distance metric");
+        }
+    }
+
+    template <typename T>
+    double (*sparse_metric_kernel(size_t metric))(const uint32_t*, const T*, size_t, const uint32_t*, const T*, size_t) {
+        switch (metric) {
+            case 0: return sparse_euclidean_kernel<T>;
+            case 1: return sparse_manhattan_kernel<T>;
+            case 2: return sparse_chebyshev_kernel<T>;
+            default: throw std::invalid_argument("no kernel for distance metric");
+        }
+    }
+
+    template <typename T>
+    double (*metric_function(size_t metric))(const knn::DataPoint<misc::array<T>>*, const knn::DataPoint<misc::array<T>>*) {
+        switch (metric) {
+            case 0: return euclidean<T>;
+            case 1: return manhattan<T>;
+            case 2: return chebyshev<T>;
+            case cosine_metric: return cosine<T>;
+            case inner_product_metric: return inner_product<T>;
+            default: throw std::invalid_argument("unknown distance metric");
+        }
+    }
+}
@@ -0,0 +1,213 @@
+#pragma once
+
+#include <algorithm>
+#include <queue>
+
+namespace knn {
+    template <typename T>
+    TypedFeatureSet<T>::TypedFeatureSet(DataSet<misc::array<T>>* data_set) : m_data_set(data_set) {
+        this->m_norms.reserve(data_set->size());
+        for (size_t i = 0; i < data_set->size(); i++) {
+            const misc::array<T>& x = this->data(i);
+            this->m_norms.push_back(distances::norm_kernel(x.data(), x.length()));
+        }
+    }
+
+    template <typename T>
+    misc::array<T> TypedFeatureSet<T>::convert(const dubdpoint* p) {
+        const misc::array<double>& data = p->data();
+        misc::array<T> features(data.length());
+
+        for (size_t i = 0; i < data.length(); i++) {
+            features[i] = to_feature<T>(data[i]);
+        }
+
+        return features;
+    }
+
+    template <typename T>
+    misc::array<double> TypedFeatureSet<T>::features(size_t i) const {
+        const misc::array<T>& x = this->data(i);
+        misc::array<double> features(x.length());
+        for (size_t j = 0; j < x.length(); j++) features[j] = x[j];
+        return features;
+    }
+
+    template <typename T>
+    double TypedFeatureSet<T>::distance(const misc::array<T>& q, double norm, size_t i, size_t metric) const {
+        const misc::array<T>& x = this->data(i);
+        q.assert_comparable(x);
+
+        if (metric == distances::cosine_metric || metric == distances::inner_product_metric) {
+            return distances::from_dot(metric, distances::dot_kernel(q.data(), x.data(), x.length()), norm, this->m_norms[i]);
+        }
+        return distances::metric_kernel<T>(metric)(q.data(), x.data(), x.length());
+    }
+
+    template <typename T>
+    std::string TypedFeatureSet<T>::nearest_class(int k, const misc::array<T>& q, double norm, size_t metric) const {
+        if (metric != distances::cosine_metric && metric != distances::inner_product_metric) {
+            CartDataPoint<T> p(q);
+            return this->m_data_set->get_nearest_class(k, &p, distances::metric_function<T>(metric));
+        }
+
+        std::vector<int> indices = this->nearest_indices(k, q, norm, metric);
+        tracing::Span span{"vote", "knn"};
+        return this->m_data_set->vote(indices, k);
+    }
+
+    template <typename T>
+    std::vector<int> TypedFeatureSet<T>::nearest_indices(int k, const misc::array<T>& q, double norm, size_t metric) const {
+        return this->m_data_set->template select_k_nearest<double>(k, [this, &q, norm, metric](size_t i, double* out) {
+                out[0] = this->distance(q, norm, i, metric);
+            }, 1)[0];
+    }
+
+    template <typename T>
+    std::vector<int> TypedFeatureSet<T>::rank(int k, const misc::array<T>& q, double norm, const std::vector<int>& candidates,
+            size_t metric) const {
+        tracing::Span span{"rerank", "knn"};
+        std::vector<std::pair<double, int>> ranked;
+        for (int i : candidates) ranked.push_back(std::make_pair(this->distance(q, norm, i, metric), i));
+
+        size_t kept = std::min((size_t)k, ranked.size());
+        std::partial_sort(ranked.begin(), ranked.begin() + kept, ranked.end());
+
+        std::vector<int> indices;
+        for (size_t j = 0; j < kept; j++) indices.push_back(ranked[j].second);
+        return indices;
+    }
+
+    template <typename T>
+    std::vector<std::vector<int>> TypedFeatureSet<T>::all_nearest_indices(int k, const misc::array<T>& q, double norm,
+            int exclude) const {
+        return this->m_data_set->template select_k_nearest<double>(k, [this, &q, norm](size_t i, double* out) {
+                const misc::array<T>& x = this->data(i);
+                q.assert_comparable(x);
+                distances::all_kernel(q.data(), x.data(), x.length(), norm, this->m_norms[i], out);
+            }, distances::num_metrics, exclude);
+    }
+
+    template <typename T>
+    std::string TypedFeatureSet<T>::get_nearest_class(int k, const dubdpoint* p, size_t metric) const {
+        misc::array<T> q = convert(p);
+        return this->nearest_class(k, q, distances::norm_kernel(q.data(), q.length()), metric);
+    }
+
+    template <typename T>
+    std::string TypedFeatureSet<T>::get_nearest_class(int k, size_t i, size_t metric) const {
+        return this->nearest_class(k, this->data(i), this->m_norms[i], metric);
+    }
+
+    template <typename T>
+    std::string TypedFeatureSet<T>::exact_class(const dubdpoint* p) const {
+        if (!this->m_data_set->indexed()) return "";
+
+        /* A point whose values don't fit in the features' type can't equal any of the Data Points */
+        try {
+            CartDataPoint<T> q(convert(p));
+            return this->m_data_set->get_class(&q);
+        } catch (std::invalid_argument& e) {
+            return "";
+        }
+    }
+
+    template <typename T>
+    std::vector<std::vector<int>> TypedFeatureSet<T>::get_k_nearest_indices(int k, const dubdpoint* p) const {
+        misc::array<T> q = convert(p);
+        return this->all_nearest_indices(k, q, distances::norm_kernel(q.data(), q.length()), -1);
+    }
+
+    template <typename T>
+    std::vector<std::vector<int>> TypedFeatureSet<T>::get_k_nearest_indices(int k, size_t i) const {
+        return this->all_nearest_indices(k, this->data(i), this->m_norms[i], i);
+    }
+
+    template <typename T>
+    std::vector<int> TypedFeatureSet<T>::get_k_nearest_indices(int k, const dubdpoint* p, size_t metric) const {
+        misc::array<T> q = convert(p);
+        return this->nearest_indices(k, q, distances::norm_kernel(q.data(), q.length()), metric);
+    }
+
+    template <typename T>
+    std::vector<int> TypedFeatureSet<T>::rerank(int k, const dubdpoint* p, const std::vector<int>& candidates,
+            size_t metric) const {
+        misc::array<T> q = convert(p);
+        return this->rank(k, q, distances::norm_kernel(q.data(), q.length()), candidates, metric);
+    }
+
+    template <typename T>
+    std::vector<int> TypedFeatureSet<T>::rerank(int k, size_t i, const std::vector<int>& candidates, size_t metric) const {
+        return this->rank(k, this->data(i), this->m_norms[i], candidates, metric);
+    }
+
+    template <typename T>
+    std::vector<double> TypedFeatureSet<T>::distances(const dubdpoint* p, const std::vector<int>& indices,
+            size_t metric) const {
+        misc::array<T> q = convert(p);
+        double norm = distances::norm_kernel(q.data(), q.length());
+
+        std::vector<double> result;
+        for (int i : indices) result.push_back(this->distance(q, norm, i, metric));
+        return result;
+    }
+
+    template <typename T>
+    std::vector<std::string> TypedFeatureSet<T>::get_nearest_classes(const std::vector<BatchQuery>& queries) const {
+        tracing::Span span{"batch_scan", "knn", std::to_string(queries.size()) + " queries"};
+
+        std::vector<misc::array<T>> features;
+        std::vector<double> norms;
+        features.reserve(queries.size());
+        for (const BatchQuery& q : queries) {
+            features.push_back(convert(q.point));
+            norms.push_back(distances::norm_kernel(features.back().data(), features.back().length()));
+        }
+
+        size_t rows = std::max<size_t>(16, block_bytes / std::max<size_t>(1, this->dims() * sizeof(T)));
+        std::vector<std::priority_queue<Neighbor>> nearest(queries.size());
+
+        /* Every query visits the points in order, so each one keeps the same neighbors as a scan of its own */
+        for (size_t block = 0; block < this->size(); block += rows) {
+            cancellation::check();
+            size_t end = std::min(this->size(), block + rows);
+
+            for (size_t j = 0; j < queries.size(); j++) {
+                std::priority_queue<Neighbor>& heap = nearest[j];
+                int k = queries[j].k;
+
+                for (size_t i = block; i < end; i++) {
+                    double d = this->distance(features[j], norms[j], i, queries[j].metric);
+                    if ((int)heap.size() < k) heap.push(Neighbor{(int)i, d});
+                    else if (d < heap.top().distance) {
+                        heap.pop();
+                        heap.push(Neighbor{(int)i, d});
+                    }
+                }
+            }
+        }
+
+        std::vector<std::string> classes;
+        for (size_t j = 0; j < queries.size(); j++) {
+            std::vector<int> indices(nearest[j].size());
+            for (size_t m = indices.size(); m > 0; m--) {
+                indices[m - 1] = nearest[j].top().index;
+                nearest[j].pop();
+            }
+
+            classes.push_back(this->metric_vote(indices, queries[j].k, queries[j].metric));
+        }
+
+        return classes;
+    }
+
+    inline std::string FeatureSet::metric_vote(const std::vector<int>& indices, int k, size_t metric) const {
+        /* The metrics scanned by DataSet::get_nearest_class count their votes in a map */
+        bool tallied = metric != distances::cosine_metric && metric != distances::inner_product_metric;
+        return tallied ? this->tally(indices) : this->vote(indices, k);
+    }
+
+    inline std::string FeatureSet::tally(const std::vector<int>& indices) const {
+        return tally_classes(indices.size(), [this, &indices](size_t j) { return this->class_type(indices[j]); });
+    }
+}
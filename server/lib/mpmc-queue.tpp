@@ -0,0 +1,74 @@
+#pragma once
+
+namespace threading {
+    template <typename T>
+    MPMCQueue<T>::MPMCQueue(size_t capacity) : m_head(0), m_tail(0) {
+        size_t size = 2;
+        while (size < capacity) size <<= 1;
+
+        this->m_cells = new Cell[size];
+        this->m_mask = size - 1;
+
+        /* Cell i is free for the push at position i */
+        for (size_t i = 0; i < size; i++) {
+            this->m_cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    template <typename T>
+    bool MPMCQueue<T>::try_push(T item) {
+        Cell* cell;
+        size_t position = this->m_head.load(std::memory_order_relaxed);
+
+        while (true) {
+            cell = &this->m_cells[position & this->m_mask];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            ptrdiff_t lap = (ptrdiff_t)sequence - (ptrdiff_t)position;
+
+            if (lap == 0) {
+                /* The cell is free, claim the position */
+                if (this->m_head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+            } else if (lap < 0) {
+                /* The cell still holds the item pushed a lap ago */
+                return false;
+            } else {
+                /* Another producer claimed the position */
+                position = this->m_head.load(std::memory_order_relaxed);
+            }
+        }
+
+        cell->data = std::move(item);
+        cell->sequence.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    template <typename T>
+    bool MPMCQueue<T>::try_pop(T& item) {
+        Cell* cell;
+        size_t position = this->m_tail.load(std::memory_order_relaxed);
+
+        while (true) {
+            cell = &this->m_cells[position & this->m_mask];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            ptrdiff_t lap = (ptrdiff_t)sequence - (ptrdiff_t)(position + 1);
+
+            if (lap == 0) {
+                /* The cell holds an item, claim the position */
+                if (this->m_tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+            } else if (lap < 0) {
+                /* Nothing was pushed to the cell yet */
+                return false;
+            } else {
+                /* Another consumer claimed the position */
+                position = this->m_tail.load(std::memory_order_relaxed);
+            }
+        }
+
+        item = std::move(cell->data);
+
+        /* Don't hold on to whatever the item owns until the cell is reused */
+        cell->data = T();
+        cell->sequence.store(position + this->m_mask + 1, std::memory_order_release);
+        return true;
+    }
+}
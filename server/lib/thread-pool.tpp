@@ -1,26 +1,26 @@
 #pragma once
 
 namespace threading {
-    ThreadPool::ThreadPool(unsigned int num_threads) : should_terminate{false} {
+    ThreadPool::ThreadPool(unsigned int num_threads, std::function<void(unsigned int)> on_start, size_t capacity) :
+        should_terminate{false},
+        spin_limit(spin_polls()),
+        jobs(capacity),
+        queue_depth(metrics::registry().gauge("knn_pool_queue_depth")),
+        busy_threads(metrics::registry().gauge("knn_pool_busy_threads")),
+        on_start(on_start) {
         this->threads.resize(num_threads);
 
         /* Have all the threads run on the thread loop */
         for (unsigned int i = 0; i < num_threads; i++) {
-            this->threads[i] = std::thread(&ThreadPool::thread_loop, this);
+            this->threads[i] = std::thread(&ThreadPool::thread_loop, this, i);
         }
     }
 
     void ThreadPool::end() {
-        /* Block so the lock is released at the end. */
-        {
-            /* Lock the should_terminate so it can change it.
-             * If this wasnt done, then a badly placed context switch could allow another job to be run. */
-            std::unique_lock<std::mutex> lock{this->jobs_mutex};
-            this->should_terminate = true;
-        }
+        this->should_terminate.store(true);
 
         /* Unblock all of the threads */
-        this->mutex_condition.notify_all();
+        this->jobs_added.notify_all();
 
         /* Join the threads */
         for (std::thread& thread : this->threads) {
@@ -29,35 +29,54 @@ namespace threading {
     }
 
     template <typename... Params>
-    void ThreadPool::add_job(void (*job)(Params...), Params... params) {
-        {
-            /* Lock the jobs queue since it is shared readable/writable memory */
-            std::unique_lock<std::mutex> lock{this->jobs_mutex};
-            this->jobs.push(Job(job, params...));
-        }
+    bool ThreadPool::add_job(void (*job)(Params...), Params... params) {
+        if (!this->jobs.try_push(Job(job, params...))) return false;
+        this->queue_depth.add();
 
-        /* Notify one of the threads waiting for a job that one is ready. */
-        this->mutex_condition.notify_one();
+        /* Wake up one of the threads waiting for a job, if any is parked. */
+        this->jobs_added.notify();
+        return true;
     }
 
-    void ThreadPool::thread_loop() {
+    bool ThreadPool::next_job(Job& job) {
+        unsigned int polls = 0;
+
         while (true) {
-            Job job;
+            if (this->should_terminate.load(std::memory_order_acquire)) return false;
+            if (this->jobs.try_pop(job)) return true;
 
-            {
-                std::unique_lock<std::mutex> lock{this->jobs_mutex};
-                this->mutex_condition.wait(lock, [this] {
-                        return !this->jobs.empty() || this->should_terminate;
-                    });
+            if (polls++ < this->spin_limit) {
+                cpu_relax();
+                continue;
+            }
 
-                if (this->should_terminate) return;
+            /* Check again after announcing the wait, so a job added in between isn't missed */
+            uint32_t key = this->jobs_added.prepare_wait();
+            if (this->should_terminate.load(std::memory_order_acquire)) {
+                this->jobs_added.cancel_wait();
+                return false;
+            }
+            if (this->jobs.try_pop(job)) {
+                this->jobs_added.cancel_wait();
+                return true;
+            }
 
-                job = this->jobs.front();
-                this->jobs.pop();
-            }   // Unlock the lock
+            this->jobs_added.wait(key);
+            polls = 0;
+        }
+    }
 
+    void ThreadPool::thread_loop(unsigned int i) {
+        if (this->on_start) this->on_start(i);
+
+        while (true) {
+            Job job;
+            if (!this->next_job(job)) return;
+
+            this->queue_depth.sub();
+            this->busy_threads.add();
             job();
+            this->busy_threads.sub();
         }
     }
 }
-
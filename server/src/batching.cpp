@@ -0,0 +1,73 @@
+#include "batching.h"
+
+namespace knn {
+    std::string BatchedFeatureSet::get_nearest_class(int k, const dubdpoint* p, size_t metric) const {
+        Pending pending{BatchQuery{k, p, metric}, std::chrono::steady_clock::now(), "", nullptr, false};
+
+        std::unique_lock<std::mutex> lock{this->m_mutex};
+        this->m_pending.push_back(&pending);
+        if (this->m_pending.size() >= this->m_batching.max_queries) this->m_full.notify_one();
+
+        while (!pending.done) {
+            if (this->m_scanning) {
+                this->m_answered.wait(lock);
+                continue;
+            }
+
+            /* Lead the next batch: let queries join it until the oldest one has waited for the window */
+            this->m_scanning = true;
+            this->m_full.wait_until(lock, this->m_pending.front()->arrived + this->m_batching.window, [this]() {
+                    return this->m_pending.size() >= this->m_batching.max_queries;
+                });
+
+            size_t n = std::min(this->m_pending.size(), this->m_batching.max_queries);
+            std::vector<Pending*> batch(this->m_pending.begin(), this->m_pending.begin() + n);
+            this->m_pending.erase(this->m_pending.begin(), this->m_pending.begin() + n);
+
+            lock.unlock();
+            this->answer(batch);
+            lock.lock();
+
+            for (Pending* answered : batch) answered->done = true;
+            this->m_scanning = false;
+            this->m_answered.notify_all();
+        }
+
+        if (pending.error) std::rethrow_exception(pending.error);
+        return pending.result;
+    }
+
+    void BatchedFeatureSet::answer(const std::vector<Pending*>& batch) const {
+        static metrics::Histogram& batch_queries = metrics::registry().histogram("knn_batch_queries");
+        static metrics::Histogram& batch_time = metrics::registry().histogram("knn_batch_scan_ns");
+        metrics::Timer timer{batch_time};
+        perf::Scope counted{perf::scan_scope};
+        batch_queries.record(batch.size());
+
+        /* The batch serves several sessions, so it isn't cancelled with the session of the thread scanning it */
+        cancellation::Attach detach{nullptr};
+
+        std::vector<BatchQuery> queries;
+        for (Pending* pending : batch) queries.push_back(pending->query);
+
+        try {
+            std::vector<std::string> classes = this->m_data_set->get_nearest_classes(queries);
+            for (size_t i = 0; i < batch.size(); i++) batch[i]->result = classes[i];
+        } catch (std::exception& e) {
+            /* A bad query (eg. out of the range of the features' type) only fails its own session */
+            for (Pending* pending : batch) {
+                try {
+                    pending->result = this->m_data_set->get_nearest_class(pending->query.k, pending->query.point,
+                            pending->query.metric);
+                } catch (...) {
+                    pending->error = std::current_exception();
+                }
+            }
+        }
+    }
+
+    FeatureSet* batch(FeatureSet* data_set, const Batching& batching) {
+        if (!batching.enabled()) return data_set;
+        return new BatchedFeatureSet(data_set, batching);
+    }
+}
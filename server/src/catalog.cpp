@@ -0,0 +1,206 @@
+#include "catalog.h"
+#include "sparse-feature-set.h"
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <dirent.h>
+#include <sys/stat.h>
+
+namespace {
+    struct Entry {
+        std::string name;
+        std::string path;
+        knn::UploadFormat format;   // The type the features are stored as (as if uploaded in this format)
+        size_t node;                // The node the Data Set is replicated on
+        knn::FeatureSet* data_set;
+        std::string error;
+
+        Entry(std::string n, std::string p, knn::UploadFormat f=knn::float64_upload) :
+            name(n), path(p), format(f), node(0), data_set(nullptr) { }
+    };
+
+    bool is_directory(const std::string& path) {
+        struct stat info;
+        return stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+    }
+
+    /**
+     * @return The .csv (and sparse .svm or .libsvm) files of a directory, named after the file without its extension.
+     */
+    std::vector<Entry> list_directory(const std::string& path) {
+        DIR* dir = opendir(path.c_str());
+        if (dir == nullptr) throw std::ios_base::failure("failed to open directory " + path);
+
+        std::vector<Entry> entries;
+        for (struct dirent* file = readdir(dir); file != nullptr; file = readdir(dir)) {
+            std::string name = file->d_name;
+            size_t dot = name.rfind('.');
+            if (dot == 0 || dot == std::string::npos || (name.substr(dot) != ".csv" && !knn::is_sparse_file(name))) continue;
+            entries.push_back(Entry(name.substr(0, dot), path + "/" + name));
+        }
+
+        closedir(dir);
+        return entries;
+    }
+
+    /**
+     * @return The files listed by a manifest of "name path [type]" lines, where type is the feature type f64 (the
+     *         default), f32, i16 or u8 (blank lines and lines starting with # are skipped).
+     */
+    std::vector<Entry> read_manifest(const std::string& path) {
+        std::ifstream manifest(path);
+        if (!manifest) throw std::ios_base::failure("failed to open manifest " + path);
+
+        size_t slash = path.rfind('/');
+        std::string base = slash == std::string::npos ? "" : path.substr(0, slash + 1);
+
+        std::vector<Entry> entries;
+        std::string line;
+        for (size_t number = 1; std::getline(manifest, line); number++) {
+            std::istringstream fields(line);
+            std::string name, file, type, extra;
+            if (!(fields >> name) || name[0] == '#') continue;
+            if (!(fields >> file) || (fields >> type && fields >> extra)) {
+                throw std::invalid_argument(path + " line " + std::to_string(number) + ": expected \"name path [type]\"");
+            }
+
+            knn::UploadFormat format = knn::float64_upload;
+            if (type != "") {
+                try {
+                    format = knn::parse_upload_format(type);
+                } catch (std::invalid_argument& e) {
+                    format = knn::text_upload;
+                }
+
+                /* Only the binary formats name a feature type */
+                if (format == knn::text_upload || format == knn::sparse_upload) {
+                    throw std::invalid_argument(path + " line " + std::to_string(number) + ": unknown feature type " +
+                            type + " (expected f64, f32, i16 or u8)");
+                }
+            }
+
+            entries.push_back(Entry(name, file[0] == '/' ? file : base + file, format));
+        }
+
+        return entries;
+    }
+
+    template <typename T>
+    knn::FeatureSet* read_dense(std::function<std::string(std::string&)> getline) {
+        return knn::make_feature_set(knn::initialize_dataset<T>(getline, knn::parse_feature<T>));
+    }
+
+    knn::FeatureSet* load_file(const std::string& path, knn::UploadFormat format, const knn::Reduction& reduction,
+            bool exact_match) {
+        std::ifstream file(path);
+        if (!file) throw std::ios_base::failure("failed to open " + path);
+
+        auto getline = [&file](std::string& s) -> std::string {
+            if (!std::getline(file, s)) s = "";
+            return s;
+        };
+
+        /* Sparse Data Sets are not reduced, which would store every feature */
+        if (knn::is_sparse_file(path)) {
+            if (format != knn::float64_upload) throw std::invalid_argument("sparse datasets are stored as f64");
+            return new knn::SparseFeatureSet(knn::read_sparse_dataset(getline));
+        }
+
+        knn::FeatureSet* feature_set;
+        switch (format) {
+            case knn::float32_upload: feature_set = read_dense<float>(getline); break;
+            case knn::int16_upload: feature_set = read_dense<int16_t>(getline); break;
+            case knn::uint8_upload: feature_set = read_dense<uint8_t>(getline); break;
+            default: feature_set = read_dense<double>(getline);
+        }
+
+        feature_set = knn::reduce(feature_set, reduction);
+        if (exact_match) feature_set->index_exact_matches();
+        return feature_set;
+    }
+} // anonymous
+
+namespace knn {
+    void Catalog::load(const std::string& path, const Reduction& reduction, bool replicate, const Batching& batching,
+            bool exact_match) {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<Entry> files = is_directory(path) ? list_directory(path) : read_manifest(path);
+
+        /* Every replica is loaded by a thread on its node, so its memory is first touched there */
+        size_t replicas = replicate ? this->m_topology.nodes() : 1;
+        std::vector<Entry> entries;
+        for (const Entry& file : files) {
+            for (size_t node = 0; node < replicas; node++) {
+                entries.push_back(file);
+                entries.back().node = node;
+            }
+        }
+
+        std::mutex log_mutex;
+        std::atomic<size_t> next{0};
+        auto worker = [&]() {
+            for (size_t i = next++; i < entries.size(); i = next++) {
+                Entry& entry = entries[i];
+                if (replicas > 1) placement::pin_thread(this->m_topology.node_cpus(entry.node));
+                auto loading = std::chrono::steady_clock::now();
+
+                try {
+                    entry.data_set = batch(load_file(entry.path, entry.format, reduction, exact_match), batching);
+                } catch (std::exception& e) {
+                    entry.error = entry.name + ": " + e.what();
+                    continue;
+                }
+
+                double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - loading).count();
+                std::lock_guard<std::mutex> lock{log_mutex};
+                std::cout << "Loaded dataset " << entry.name << " (" << entry.data_set->size() << " points, " <<
+                    entry.data_set->dims() << " " << entry.data_set->feature_type() << " features, " <<
+                    entry.data_set->memory_usage() << " bytes) in " << ms << " ms" <<
+                    (replicas > 1 ? " on node " + std::to_string(entry.node) : "") << std::endl;
+            }
+        };
+
+        size_t workers = std::min<size_t>(entries.size(), std::max(1u, std::thread::hardware_concurrency()));
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < workers; i++) threads.push_back(std::thread(worker));
+        for (std::thread& thread : threads) thread.join();
+
+        /* Keep the Data Sets that loaded only if all of them did, so a bad file stops the server */
+        std::string error;
+        for (Entry& entry : entries) {
+            if (error == "" && entry.error != "") error = entry.error;
+            if (error == "" && this->m_data_sets[entry.name].size() != entry.node) error = entry.name + ": duplicate dataset name";
+            if (error == "" && entry.data_set != nullptr) {
+                try {
+                    accounting::global_budget().reserve(accounting::dataset_memory, entry.data_set->memory_usage());
+                    this->m_data_sets[entry.name].push_back(std::shared_ptr<const FeatureSet>(entry.data_set));
+                    continue;
+                } catch (accounting::QuotaExceeded& e) {
+                    error = entry.name + ": " + e.what();
+                }
+            }
+            delete entry.data_set;
+        }
+        if (error != "") throw std::invalid_argument(error);
+
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "Loaded " << files.size() << " datasets" << (replicas > 1 ? " (" + std::to_string(replicas) +
+            " replicas each)" : "") << " in " << ms << " ms" << std::endl;
+    }
+
+    std::shared_ptr<const FeatureSet> Catalog::get(const std::string& name) const {
+        auto it = this->m_data_sets.find(name);
+        if (it == this->m_data_sets.end() || it->second.empty()) return nullptr;
+        return it->second[this->m_topology.current_node() % it->second.size()];
+    }
+
+    std::vector<std::string> Catalog::names() const {
+        std::vector<std::string> names;
+        for (auto& entry : this->m_data_sets) names.push_back(entry.first);
+        return names;
+    }
+}
@@ -1,8 +1,11 @@
 #include "cli.h"
 #include "knn-io.h"
+#include "bounded-queue.h"
 
 #include <set>
 #include <vector>
+#include <thread>
+#include <exception>
 
 namespace std {
     string getline(knn::DefaultIO& dio, string& s) {
@@ -11,11 +14,229 @@ namespace std {
     }
 }
 
+namespace {
+    /**
+     * Formats a confusion matrix, where every row is given in percentages of its true class.
+     * @param true_names            The true class of every point.
+     * @param classified_names      The class every point was classified as.
+     * @return                      The confusion matrix, one row per line.
+     */
+    std::string confusion_matrix(const std::vector<std::string>& true_names, const std::vector<std::string>& classified_names) {
+        std::set<std::string> classes;
+
+        // Add the names of the classes to the classes set.
+        for (size_t i = 0; i < true_names.size(); i++) {
+            classes.insert(classified_names[i]);
+            classes.insert(true_names[i]);
+        }
+    
+        std::unordered_map<std::string, size_t> class_order;
+        std::unordered_map<size_t, std::string> order_class;
+        size_t i = 0;
+        size_t* true_count = new size_t[classes.size()]();
+        size_t**  confusion_matrix = new size_t*[classes.size()]();
+    
+        /* Order the classes, and allocate confusion matrix */
+        for (std::string class_name : classes) {
+            confusion_matrix[i] = new size_t[classes.size()]();
+            class_order[class_name] = i;
+            order_class[i] = class_name;
+            i++;
+        }
+    
+        /* Compute the confusion matrix */
+        for (size_t i = 0; i < true_names.size(); i++) {
+            confusion_matrix[class_order[true_names[i]]][class_order[classified_names[i]]]++;
+            true_count[class_order[true_names[i]]]++;
+        }
+    
+        /* Format the confusion matrix */
+        std::string matrix;
+        std::string end_line = "\t\t| ";
+        for (size_t i = 0; i < classes.size(); i++) {
+            std::string line = order_class[i] + "\t";
+            end_line += order_class[i] + " | ";
+            for (size_t j = 0; j < classes.size(); j++) {
+                std::string num;
+                if (true_count[i] > 0) num = std::to_string((100 * confusion_matrix[i][j]) / true_count[i]) + "%";
+                else num = "NaN";
+                line += std::string("|\t") + num + "\t";
+            }
+
+            matrix += line + "|\n";
+    
+            delete[] confusion_matrix[i];
+        }
+
+        matrix += end_line + "\n";
+    
+        delete[] confusion_matrix;
+        delete[] true_count;
+
+        return matrix;
+    }
+
+    /**
+     * @return A function passing the points of an upload stored as T's on to a sink (null without a sink).
+     */
+    template <typename T>
+    std::function<void(const knn::CartDataPoint<T>&)> divert(knn::PointSink* sink) {
+        if (sink == nullptr) return nullptr;
+
+        sink->begin(knn::feature_name<T>());
+        return [sink](const knn::CartDataPoint<T>& point) {
+            const misc::array<T>& data = point.data();
+            misc::array<double> features(data.length());
+            for (size_t j = 0; j < data.length(); j++) features[j] = (double)data[j];
+            sink->add(features, point.class_type());
+        };
+    }
+
+    /**
+     * Replaces the data set of the settings, releasing the previous one.
+     * The dataset memory charged to the session's account is set to the exact size of the new data set, unless
+     * it is shared (preloaded), in which case it isn't charged to the session.
+     * @param settings          The settings whose data set to replace.
+     * @param data_set          The new data set (may be null).
+     * @param shared            Whether the data set is shared with other sessions.
+     * @throws                  accounting::QuotaExceeded if the new data set doesn't fit in the quota (it is released).
+     */
+    void replace_data_set(knn::CLI::Settings& settings, std::shared_ptr<const knn::FeatureSet> data_set, bool shared) {
+        static metrics::Gauge& datasets = metrics::registry().gauge("knn_datasets");
+        static metrics::Gauge& points = metrics::registry().gauge("knn_dataset_points");
+        static metrics::Histogram& upload_points = metrics::registry().histogram("knn_upload_points");
+
+        if (settings.data_set != nullptr) {
+            datasets.sub();
+            points.sub(settings.data_set->size());
+            settings.data_set = nullptr;
+        }
+
+        /* Points are charged as they are read, so only the difference from the exact size is left */
+        size_t charged = settings.account.used(accounting::dataset_memory);
+        size_t bytes = data_set != nullptr && !shared ? data_set->memory_usage() : 0;
+        if (bytes > charged) {
+            try {
+                settings.account.charge(accounting::dataset_memory, bytes - charged);
+            } catch (...) {
+                settings.account.release(accounting::dataset_memory, charged);
+                throw;
+            }
+        } else settings.account.release(accounting::dataset_memory, charged - bytes);
+
+        settings.data_set = data_set;
+
+        if (data_set != nullptr) {
+            datasets.add();
+            points.add(data_set->size());
+            if (!shared) upload_points.record(data_set->size());
+        }
+    }
+
+    /**
+     * Replaces the data set of the settings with a data set owned by the session.
+     * @see replace_data_set
+     */
+    void replace_data_set(knn::CLI::Settings& settings, knn::FeatureSet* data_set) {
+        replace_data_set(settings, std::shared_ptr<const knn::FeatureSet>(data_set), false);
+    }
+
+    /**
+     * A line of a test file, parsed as a point of the Data Set it is classified against: a dense point, or a
+     * sparse point in libsvm format if the Data Set is sparse.
+     */
+    struct Query {
+        std::unique_ptr<knn::CartDataPoint<double>> point;
+        knn::SparseVector sparse;
+
+        Query(const std::string& line, const knn::FeatureSet& data_set) {
+            if (data_set.is_sparse()) {
+                std::string label;
+                knn::parse_sparse_point(line, false, label, this->sparse);
+            } else this->point.reset(knn::get_point<double>(line, knn::parse_feature<double>, false));
+        }
+
+        /**
+         * @return The query as a dense point of the Data Set's dims (for the queries a Feature Set only takes dense).
+         */
+        std::unique_ptr<knn::CartDataPoint<double>> dense(const knn::FeatureSet& data_set) {
+            if (this->point) return std::move(this->point);
+            return std::unique_ptr<knn::CartDataPoint<double>>(new knn::CartDataPoint<double>(this->sparse.dense(data_set.dims())));
+        }
+    };
+} // anonymous
+
 namespace knn {
     double stod(std::string s) { return std::stod(s); }
 
-    void CLI::start(DefaultIO& io_device, std::string exit_name) {
-        CLI::Settings settings{io_device, 5, distances::euclidean_distance, "EUC"};
+    FeatureSet* DefaultSocketIO::read_dataset(std::string filename, std::function<void(size_t)> reserve, PointSink* sink) {
+        tracing::Span span{"upload_dataset_token", "protocol"};
+        this->m_serializer << SerializationTokens::upload_dataset_token << filename;
+
+        uint32_t format;
+        this->m_serializer >> format;
+        streams::little_endian(format);
+
+        switch (format) {
+            case float64_upload:
+                return make_feature_set(receive_columns<double, double>(this->m_serializer, reserve, divert<double>(sink)));
+            case float32_upload:
+                return make_feature_set(receive_columns<float, float>(this->m_serializer, reserve, divert<float>(sink)));
+            case int16_upload:
+                return make_feature_set(receive_columns<int16_t, int16_t>(this->m_serializer, reserve, divert<int16_t>(sink)));
+            case uint8_upload:
+                return make_feature_set(receive_columns<uint8_t, uint8_t>(this->m_serializer, reserve, divert<uint8_t>(sink)));
+            case text_upload: break;
+            case sparse_upload: break;
+            default: throw std::ios_base::failure("unknown upload format");
+        }
+
+        auto getline = [this](std::string& s) -> std::string {
+            s = this->read();
+            return s;
+        };
+
+        /* A malformed line ends the upload too, so the recipient stays in sync */
+        FeatureSet* data_set;
+        try {
+            if (format == sparse_upload) data_set = new SparseFeatureSet(read_sparse_dataset(getline, reserve));
+            else data_set = make_feature_set(initialize_dataset(getline, stod, reserve, divert<double>(sink)));
+        } catch (...) {
+            this->close_input();
+            throw;
+        }
+        this->close_input();
+        return data_set;
+    }
+
+    FeatureSet* DefaultTerminalIO::read_dataset(std::string filename, std::function<void(size_t)> reserve, PointSink* sink) {
+        this->open_input(filename);
+
+        /* The lines are copied straight out of the mapping, with no stream buffering in between */
+        auto getline = [this](std::string& s) -> std::string {
+            streams::LineView line;
+            if (this->m_file_input.read_line(line)) s.assign(line.data, line.length);
+            else s.clear();
+            return s;
+        };
+
+        FeatureSet* data_set;
+        try {
+            if (is_sparse_file(filename)) data_set = new SparseFeatureSet(read_sparse_dataset(getline, reserve));
+            else data_set = make_feature_set(initialize_dataset(getline, stod, reserve, divert<double>(sink)));
+        } catch (...) {
+            this->close_input();
+            throw;
+        }
+        this->close_input();
+        return data_set;
+    }
+
+    bool CLI::start(DefaultIO& io_device, std::string exit_name, std::chrono::milliseconds command_timeout) {
+        static metrics::Counter& cancelled_commands = metrics::registry().counter("knn_cancelled_commands");
+        CLI::Settings settings{io_device, 5, "EUC"};
+        cancellation::Token* token = cancellation::current();
+        bool interrupted = false;       // Whether a command is being executed
     
         while (true) {
             int i = 1;
@@ -41,9 +262,32 @@ namespace knn {
                 if (choice <= 0 || choice > (int)this->m_commands.size() + 1)
                     settings.dio << "\e[31;1mInvalid Command\e[0m\n";
                 else if (choice == (int)this->m_commands.size() + 1) break;
-                else this->m_commands.at(choice-1)->execute(settings);
+                else {
+                    Command* command = this->m_commands.at(choice-1);
+                    metrics::Timer timer{metrics::registry().histogram("knn_command_duration_ns",
+                            "command=\"" + command->get_description() + "\"")};
+                    tracing::Span span{"command", "command", command->get_description()};
+                    perf::Scope counted{perf::command_scope};
+                    cancellation::Deadline deadline{command_timeout};
+                    interrupted = true;
+                    command->execute(settings);
+                    interrupted = false;
+                }
             } catch (std::ios_base::failure e) {
                 break;
+            } catch (ShardFailure& e) {
+                interrupted = false;
+                settings.dio << std::string("\e[31;1m") + e.what() + "\e[0m\n";
+            } catch (cancellation::Cancelled& e) {
+                cancelled_commands.add();
+                if (token != nullptr && token->cancelled()) break;      // Nobody is left to tell
+                interrupted = false;
+
+                try {
+                    settings.dio << std::string("\e[31;1mCommand cancelled: ") + e.what() + "\e[0m\n";
+                } catch (std::ios_base::failure& e) {
+                    break;
+                }
             }
         }
 
@@ -51,14 +295,22 @@ namespace knn {
             settings.dio.close();
         } catch (std::ios_base::failure e) { }
 
-        if (settings.data_set != nullptr) delete settings.data_set;
+        replace_data_set(settings, nullptr);
+        return interrupted;
     }
     
     void Upload_Files::execute(CLI::Settings& settings) {
         // while loop to ensure valid input
         while (true) {
             // open train file
-            settings.dio << "Please upload your local train CSV file. (Enter ! to skip)\n";
+            if (this->m_catalog == nullptr || this->m_catalog->empty()) {
+                settings.dio << "Please upload your local train CSV file. (Enter ! to skip)\n";
+            } else {
+                std::string names;
+                for (const std::string& name : this->m_catalog->names()) names += (names == "" ? "" : ", ") + name;
+                settings.dio << "Please upload your local train CSV file. (Enter ! to skip, or @name to use a preloaded "
+                    "dataset: " + names + ")\n";
+            }
             std::string train_path;
             settings.dio >> train_path;
     
@@ -69,15 +321,52 @@ namespace knn {
                     settings.dio << "You haven't uploaded a train file previously.\n";
                     continue;
                 }
+            } else if (train_path[0] == '@' && this->m_catalog != nullptr) {
+                std::shared_ptr<const FeatureSet> data_set = this->m_catalog->get(train_path.substr(1));
+                if (data_set == nullptr) {
+                    settings.dio << "\e[31;1mNo preloaded dataset named " + train_path.substr(1) + "\e[0m\n";
+                    continue;
+                }
+
+                replace_data_set(settings, data_set, true);
+                settings.dio << "Attached to " + train_path.substr(1) + "\n";
             } else {
-                if (settings.data_set != nullptr) delete settings.data_set;
+                replace_data_set(settings, nullptr);
+                auto fail = [&settings](const std::string& message) {
+                    replace_data_set(settings, nullptr);
+                    settings.is_classified = false;
+                    settings.dio << "\e[31;1m" + message + "\e[0m\n";
+                };
+
+                try {
+                    auto reserve = [&settings](size_t bytes) { settings.account.charge(accounting::dataset_memory, bytes); };
 
-                settings.dio.open_input(train_path);
-                settings.data_set = initialize_dataset([&settings](std::string& s) -> std::string {
-                        s = settings.dio.read();
-                        return s;
-                    }, stod);
-                settings.dio.close_input();
+                    /* Sharded uploads are sent on to the workers as they are read, keeping only their classes here */
+                    std::unique_ptr<ShardedFeatureSet> sharded;
+                    if (!this->m_shards.empty()) sharded.reset(new ShardedFeatureSet(this->m_shards, reserve));
+                    FeatureSet* data_set = settings.dio.read_dataset(train_path, reserve, sharded.get());
+
+                    /* Sparse Data Sets are neither reduced nor sharded, which would store every feature */
+                    if (!data_set->is_sparse()) {
+                        if (sharded == nullptr) data_set = reduce(data_set, this->m_reduction);
+                        else {
+                            delete data_set;
+                            sharded->finish();
+                            data_set = sharded.release();
+                        }
+                    }
+                    if (this->m_exact_match) data_set->index_exact_matches();
+                    replace_data_set(settings, data_set);
+                } catch (accounting::QuotaExceeded& e) {
+                    fail(std::string("Upload rejected: ") + e.what());
+                    return;
+                } catch (ShardFailure& e) {
+                    fail(std::string("Upload failed: ") + e.what());
+                    return;
+                } catch (std::invalid_argument& e) {
+                    fail(std::string("Upload failed: ") + e.what());
+                    return;
+                }
 
                 settings.dio << "Upload complete\n";
             }
@@ -99,9 +388,6 @@ namespace knn {
                   std::to_string(settings.k_value) + ", distance metric = " +
                   settings.distance_metric_name + "\n";
 
-        std::map<std::string, double (*)(const dubdpoint*, const dubdpoint*)> distance_map =
-            {{"EUC", distances::euclidean_distance}, {"MAN", distances::manhattan_distance}, {"CHE", distances::chebyshev_distance}};
-        
         while (true) {
             int k;
             std::string s_k;
@@ -115,15 +401,16 @@ namespace knn {
                 continue;
             }
     
-            // check if distance metric is EUC, MAN or CHE
-            if (distance_map.find(distance_metric) == distance_map.end()) {
+            // check if distance metric is one of distances::metric_names
+            size_t metric = distances::metric_index(distance_metric);
+            if (metric == distances::num_metrics) {
                 settings.dio << "\e[31;1mInvalid distance metric, please try again\e[0m\n";
                 continue;
             }
     
             // valid values
             settings.k_value = k;
-            settings.distance_metric = distance_map[distance_metric];
+            settings.distance_metric = metric;
             settings.distance_metric_name = distance_metric;
             settings.is_classified = false;
             break;
@@ -131,21 +418,122 @@ namespace knn {
     }
 
     void Classify_Data::execute(CLI::Settings& settings) {
+        if (settings.data_set == nullptr) {
+            settings.dio << "\e[31;1mHaven't uploaded a train file yet!\e[0m\n";
+            return;
+        }
+
+        const size_t queue_size = 256;
+        threading::BoundedQueue<std::string> lines{queue_size};
+        threading::BoundedQueue<Query*> points{queue_size};
+        threading::BoundedQueue<std::string> results{queue_size};
+
+        /* The first error raised by any of the stages */
+        std::mutex error_mutex;
+        std::exception_ptr error;
+        auto fail = [&]() {
+            {
+                std::unique_lock<std::mutex> lock{error_mutex};
+                if (!error) error = std::current_exception();
+            }
+            lines.close();
+            points.close();
+            results.close();
+        };
+
         settings.classified_names = std::vector<std::string>();
+        settings.account.release(accounting::result_memory, settings.account.used(accounting::result_memory));
+        settings.is_classified = false;
+        settings.dio.open_input_stream(settings.test_file);
 
-        settings.dio.open_input(settings.test_file);
-    
-        while (true) {
-            std::string output = settings.dio.read();
-            if (output == "") break;
-    
-            CartDataPoint<double>* dp = knn::get_point<double>(output, stod, false);
-            settings.classified_names.push_back(settings.data_set->get_nearest_class(settings.k_value, dp, settings.distance_metric));
-    
-            delete dp;
-        }
+        /* The stages trace into the session's trace (and count into its counters), and are cancelled with the
+         * session's command */
+        tracing::Session* trace = tracing::current_session();
+        perf::Session* counters = perf::current_session();
+        cancellation::Token* token = cancellation::current();
 
-        settings.dio.close_input();
+        /* Receive the lines of the test file as they arrive. Lines keep being received (and dropped) after a
+         * failure downstream, so the stream ends where the client expects it to. */
+        std::thread receiver([&]() {
+            tracing::Attach attach{trace};
+            try {
+                while (true) {
+                    std::string line = settings.dio.read_stream();
+                    if (line == "") break;
+                    lines.push(line);
+                }
+            } catch (...) { fail(); }
+            lines.close();
+        });
+
+        /* Parse the lines into points */
+        std::thread parser([&]() {
+            tracing::Attach attach{trace};
+            tracing::Span span{"parse", "pipeline"};
+            std::string line;
+            try {
+                while (lines.pop(line)) {
+                    Query* query = new Query(line, *settings.data_set);
+                    if (!points.push(query)) { delete query; break; }
+                }
+            } catch (...) { fail(); }
+            points.close();
+        });
+
+        /* Classify the points, labeling those which are part of the train file (if it is indexed) without a scan */
+        static metrics::Counter& exact_matches = metrics::registry().counter("knn_exact_matches");
+        std::thread classifier([&]() {
+            tracing::Attach attach{trace};
+            perf::Attach count{counters};
+            cancellation::Attach cancel{token};
+            tracing::Span span{"classify", "pipeline"};
+            Query* q;
+            try {
+                while (points.pop(q)) {
+                    std::unique_ptr<Query> query{q};
+                    cancellation::check();
+
+                    /* Only dense Data Sets are indexed for exact matches */
+                    std::string class_name;
+                    if (query->point) class_name = settings.data_set->exact_class(query->point.get());
+
+                    if (class_name != "") exact_matches.add();
+                    else if (query->point) class_name = settings.data_set->get_nearest_class(settings.k_value, query->point.get(), settings.distance_metric);
+                    else class_name = settings.data_set->get_nearest_class(settings.k_value, query->sparse, settings.distance_metric);
+                    settings.account.charge(accounting::result_memory, sizeof(std::string) + accounting::heap_usage(class_name));
+                    if (!results.push(class_name)) break;
+                }
+            } catch (...) { fail(); }
+            while (points.pop(q)) delete q;
+            results.close();
+        });
+
+        /* Send the results back as they complete */
+        std::string class_name;
+        try {
+            while (results.pop(class_name)) {
+                settings.classified_names.push_back(class_name);
+                settings.dio << std::to_string(settings.classified_names.size()) + ".\t" + class_name + "\n";
+            }
+        } catch (...) { fail(); }
+
+        receiver.join();
+        parser.join();
+        classifier.join();
+        settings.dio.close_input_stream();
+
+        if (error) {
+            try {
+                std::rethrow_exception(error);
+            } catch (std::ios_base::failure& e) {
+                throw;
+            } catch (cancellation::Cancelled& e) {
+                throw;
+            } catch (std::exception& e) {
+                settings.dio << std::string("\e[31;1mClassification failed: ") + e.what() + "\e[0m\n";
+                return;
+            }
+        }
 
         settings.is_classified = true;
     }
@@ -156,6 +544,7 @@ namespace knn {
             return;
         }
 
+        tracing::Span span{"result_transfer", "command"};
         int length = settings.classified_names.size();
         for (int i = 0; i < length; i++) {
             settings.dio << std::to_string(i + 1) + ".\t" + settings.classified_names[i] + "\n";
@@ -174,6 +563,7 @@ namespace knn {
         settings.dio << "Please type the path for saving the results.\n";
         settings.dio >> results_path;
         settings.dio.open_output(results_path);
+        tracing::Span span{"result_transfer", "command"};
     
         int length = settings.classified_names.size();
         for (int i = 0; i < length; i++) {
@@ -186,60 +576,179 @@ namespace knn {
     void Display_Confusion_Matrix::execute(CLI::Settings& settings) {
         std::vector<std::string> classified_names;
         std::vector<std::string> true_names;
-        std::set<std::string> classes;
 
-        for (auto dp : settings.data_set->get_data()) {
+        for (size_t i = 0; i < settings.data_set->size(); i++) {
             // Classify the train file relative to itself.
-            std::string classified_name = settings.data_set->get_nearest_class(settings.k_value, dp, settings.distance_metric);
-            classified_names.push_back(classified_name);
-            true_names.push_back(dp->class_type());
+            classified_names.push_back(settings.data_set->get_nearest_class(settings.k_value, i, settings.distance_metric));
+            true_names.push_back(settings.data_set->class_type(i));
+        }
+
+        settings.dio << confusion_matrix(true_names, classified_names);
+    }
 
-            // Add the names of the classes to the classes set.
-            classes.insert(classified_name);
-            classes.insert(dp->class_type());
+    void Sweep_Settings::execute(CLI::Settings& settings) {
+        if (settings.data_set == nullptr) {
+            settings.dio << "\e[31;1mHaven't uploaded a train file yet!\e[0m\n";
+            return;
         }
-    
-        std::unordered_map<std::string, size_t> class_order;
-        std::unordered_map<size_t, std::string> order_class;
-        size_t i = 0;
-        size_t* true_count = new size_t[classes.size()]();
-        size_t**  confusion_matrix = new size_t*[classes.size()]();
-    
-        /* Order the classes, and allocate confusion matrix */
-        for (std::string class_name : classes) {
-            confusion_matrix[i] = new size_t[classes.size()]();
-            class_order[class_name] = i;
-            order_class[i] = class_name;
-            i++;
+
+        const int max_k = 10;
+        const size_t metrics = distances::num_metrics;
+        const size_t train_size = settings.data_set->size();
+
+        /* The accuracies are percentages of the train points */
+        if (train_size == 0) {
+            settings.dio << "\e[31;1mThe train file has no points to sweep!\e[0m\n";
+            return;
         }
-    
-        /* Compute the confusion matrix */
-        for (size_t i = 0; i < true_names.size(); i++) {
-            confusion_matrix[class_order[true_names[i]]][class_order[classified_names[i]]]++;
-            true_count[class_order[true_names[i]]]++;
+
+        /* predictions[m][k - 1][i] is the class of the i-th point relative to the m-th metric and K = k */
+        typedef std::vector<std::vector<std::vector<std::string>>> Predictions;
+        Predictions train_predictions(metrics, std::vector<std::vector<std::string>>(max_k));
+        Predictions test_predictions(metrics, std::vector<std::vector<std::string>>(max_k));
+        std::vector<std::string> true_names;
+
+        /* The predictions are charged to the session for as long as the sweep runs */
+        accounting::Charge charge{settings.account, accounting::result_memory};
+        try {
+            charge.add(train_size * (metrics * max_k + 1) * sizeof(std::string));
+        } catch (accounting::QuotaExceeded& e) {
+            settings.dio << std::string("\e[31;1mSweep rejected: ") + e.what() + "\e[0m\n";
+            return;
         }
-    
-        /* Print the confusion matrix */
-        std::string end_line = "\t\t| ";
-        for (size_t i = 0; i < classes.size(); i++) {
-            std::string line = order_class[i] + "\t";
-            end_line += order_class[i] + " | ";
-            for (size_t j = 0; j < classes.size(); j++) {
-                std::string num;
-                if (true_count[i] > 0) num = std::to_string((100 * confusion_matrix[i][j]) / true_count[i]) + "%";
-                else num = "NaN";
-                line += std::string("|\t") + num + "\t";
+
+        /* Classify the train file relative to itself, leaving each point out of its own neighbors */
+        for (size_t i = 0; i < train_size; i++) {
+            std::vector<std::vector<int>> nearest = settings.data_set->get_k_nearest_indices(max_k, i);
+            true_names.push_back(settings.data_set->class_type(i));
+
+            for (size_t m = 0; m < metrics; m++) {
+                for (int k = 1; k <= max_k; k++) {
+                    train_predictions[m][k - 1].push_back(settings.data_set->vote(nearest[m], k));
+                }
             }
+        }
 
-            settings.dio << line + "|\n";
-    
-            delete[] confusion_matrix[i];
+        /* Classify the test file, if one was uploaded */
+        size_t test_size = 0;
+        if (settings.test_file != "") {
+            settings.dio.open_input(settings.test_file);
+
+            while (true) {
+                std::string output = settings.dio.read();
+                if (output == "") break;
+
+                try {
+                    charge.add(metrics * max_k * sizeof(std::string));
+                } catch (accounting::QuotaExceeded& e) {
+                    settings.dio.close_input();
+                    settings.dio << std::string("\e[31;1mSweep rejected: ") + e.what() + "\e[0m\n";
+                    return;
+                }
+
+                std::vector<std::vector<int>> nearest;
+                try {
+                    std::unique_ptr<CartDataPoint<double>> dp = Query(output, *settings.data_set).dense(*settings.data_set);
+                    nearest = settings.data_set->get_k_nearest_indices(max_k, dp.get());
+                } catch (std::ios_base::failure& e) {
+                    throw;
+                } catch (cancellation::Cancelled& e) {
+                    settings.dio.close_input();
+                    throw;
+                } catch (std::exception& e) {
+                    settings.dio.close_input();
+                    settings.dio << std::string("\e[31;1mSweep failed: ") + e.what() + "\e[0m\n";
+                    return;
+                }
+
+                for (size_t m = 0; m < metrics; m++) {
+                    for (int k = 1; k <= max_k; k++) {
+                        test_predictions[m][k - 1].push_back(settings.data_set->vote(nearest[m], k));
+                    }
+                }
+
+                test_size++;
+            }
+
+            settings.dio.close_input();
         }
 
-        settings.dio << end_line + "\n";
-    
-        delete[] confusion_matrix;
-        delete[] true_count;
+        /* Compute the leave-one-out accuracies and display them */
+        std::vector<std::vector<size_t>> correct(metrics, std::vector<size_t>(max_k, 0));
+        size_t best_m = 0;
+        int best_k = 1;
+
+        std::string header = "K";
+        for (size_t m = 0; m < metrics; m++) header += "\t" + distances::metric_names[m];
+        settings.dio << "Leave-one-out accuracy:\n" + header + "\n";
+
+        for (int k = 1; k <= max_k; k++) {
+            std::string line = std::to_string(k);
+
+            for (size_t m = 0; m < metrics; m++) {
+                for (size_t i = 0; i < true_names.size(); i++) {
+                    if (train_predictions[m][k - 1][i] == true_names[i]) correct[m][k - 1]++;
+                }
+                if (correct[m][k - 1] > correct[best_m][best_k - 1]) {
+                    best_m = m;
+                    best_k = k;
+                }
+
+                line += "\t" + std::to_string((100 * correct[m][k - 1]) / true_names.size()) + "%";
+            }
+
+            settings.dio << line + "\n";
+        }
+
+        settings.dio << "Best parameters: K = " + std::to_string(best_k) + ", distance metric = " +
+            distances::metric_names[best_m] + "\n";
+
+        /* Write the full report */
+        std::string report_path;
+        settings.dio << "Please type the path for saving the sweep report.\n";
+        settings.dio >> report_path;
+        settings.dio.open_output(report_path);
+
+        settings.dio.write("K,metric,accuracy\n");
+        for (int k = 1; k <= max_k; k++) {
+            for (size_t m = 0; m < metrics; m++) {
+                settings.dio.write(std::to_string(k) + "," + distances::metric_names[m] + "," +
+                        std::to_string((100 * correct[m][k - 1]) / true_names.size()) + "%\n");
+            }
+        }
+
+        for (int k = 1; k <= max_k; k++) {
+            for (size_t m = 0; m < metrics; m++) {
+                settings.dio.write("\nConfusion matrix for K = " + std::to_string(k) + ", distance metric = " +
+                        distances::metric_names[m] + "\n");
+                settings.dio.write(confusion_matrix(true_names, train_predictions[m][k - 1]));
+            }
+        }
+
+        if (test_size > 0) {
+            std::string columns = "\nindex";
+            for (int k = 1; k <= max_k; k++) {
+                for (size_t m = 0; m < metrics; m++) {
+                    columns += ",K=" + std::to_string(k) + " " + distances::metric_names[m];
+                }
+            }
+            settings.dio.write(columns + "\n");
+
+            for (size_t i = 0; i < test_size; i++) {
+                std::string line = std::to_string(i + 1);
+                for (int k = 1; k <= max_k; k++) {
+                    for (size_t m = 0; m < metrics; m++) {
+                        line += "," + test_predictions[m][k - 1][i];
+                    }
+                }
+                settings.dio.write(line + "\n");
+            }
+        }
+
+        settings.dio.close_output();
     }
-}
 
+    void Display_Statistics::execute(CLI::Settings& settings) {
+        settings.dio << metrics::registry().render();
+    }
+}
@@ -0,0 +1,66 @@
+#include "event-count.h"
+
+#include <climits>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace threading {
+    namespace {
+        uint32_t* futex_word(std::atomic<uint32_t>& word) {
+            return reinterpret_cast<uint32_t*>(&word);
+        }
+
+        void futex_wake(std::atomic<uint32_t>& word, int count) {
+            syscall(SYS_futex, futex_word(word), FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+        }
+    }
+
+    uint32_t EventCount::prepare_wait() {
+        this->m_waiters.fetch_add(1, std::memory_order_seq_cst);
+
+        /* Order the announcement before the waiter checks the condition again (pairs with the fence in notify) */
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return this->m_epoch.load(std::memory_order_acquire);
+    }
+
+    void EventCount::leave() {
+        /* Whichever waiter leaves first takes the wakeup; any other one woken up by the same notify checks the
+         * condition again anyway, so the count may only err on the side of waking up more threads */
+        uint32_t woken = this->m_woken.load(std::memory_order_relaxed);
+        while (woken > 0 && !this->m_woken.compare_exchange_weak(woken, woken - 1, std::memory_order_seq_cst)) { }
+
+        this->m_waiters.fetch_sub(1, std::memory_order_seq_cst);
+    }
+
+    void EventCount::cancel_wait() {
+        this->leave();
+    }
+
+    void EventCount::wait(uint32_t key) {
+        /* Returns at once (EAGAIN) if the epoch moved on since prepare_wait */
+        syscall(SYS_futex, futex_word(this->m_epoch), FUTEX_WAIT_PRIVATE, key, nullptr, nullptr, 0);
+        this->leave();
+    }
+
+    void EventCount::notify() {
+        /* Order publishing the condition before looking for waiters */
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        /* Only wake up another waiter if there are more waiters than ones already woken up, which check the
+         * condition again before waiting */
+        uint32_t woken = this->m_woken.load(std::memory_order_seq_cst);
+        do {
+            if (woken >= this->m_waiters.load(std::memory_order_seq_cst)) return;
+        } while (!this->m_woken.compare_exchange_weak(woken, woken + 1, std::memory_order_seq_cst));
+
+        this->m_epoch.fetch_add(1, std::memory_order_release);
+        futex_wake(this->m_epoch, 1);
+    }
+
+    void EventCount::notify_all() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        this->m_epoch.fetch_add(1, std::memory_order_release);
+        futex_wake(this->m_epoch, INT_MAX);
+    }
+}
@@ -0,0 +1,179 @@
+#include "placement.h"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <pthread.h>
+#include <sched.h>
+#include <dirent.h>
+
+namespace {
+    /**
+     * Parses a kernel CPU list (eg. "0-3,8-11").
+     */
+    std::vector<int> parse_cpu_list(const std::string& list) {
+        std::vector<int> cpus;
+        std::stringstream ranges(list);
+        std::string range;
+
+        while (std::getline(ranges, range, ',')) {
+            if (range.find_first_of("0123456789") == std::string::npos) continue;
+
+            size_t dash = range.find('-');
+            int first = std::stoi(range.substr(0, dash));
+            int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+            for (int cpu = first; cpu <= last; cpu++) cpus.push_back(cpu);
+        }
+
+        return cpus;
+    }
+
+    /**
+     * Formats CPUs as a kernel CPU list.
+     */
+    std::string format_cpu_list(const std::vector<int>& cpus) {
+        std::string list;
+        for (size_t i = 0; i < cpus.size(); i++) {
+            size_t j = i;
+            while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1) j++;
+
+            if (list != "") list += ",";
+            list += std::to_string(cpus[i]);
+            if (j > i) list += "-" + std::to_string(cpus[j]);
+            i = j;
+        }
+
+        return list;
+    }
+
+    /**
+     * @return The CPUs the process may run on.
+     */
+    std::vector<int> allowed_cpus() {
+        std::vector<int> cpus;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+
+        if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+            for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) if (CPU_ISSET(cpu, &set)) cpus.push_back(cpu);
+        }
+
+        return cpus;
+    }
+} // anonymous
+
+namespace placement {
+    Topology Topology::detect() {
+        Topology topology;
+        std::vector<int> allowed = allowed_cpus();
+
+        std::vector<int> ids;
+        if (DIR* dir = opendir("/sys/devices/system/node")) {
+            for (struct dirent* entry = readdir(dir); entry != nullptr; entry = readdir(dir)) {
+                std::string name = entry->d_name;
+                if (name.compare(0, 4, "node") == 0 && name.size() > 4 &&
+                        name.find_first_not_of("0123456789", 4) == std::string::npos) {
+                    ids.push_back(std::stoi(name.substr(4)));
+                }
+            }
+            closedir(dir);
+        }
+        std::sort(ids.begin(), ids.end());
+
+        for (int id : ids) {
+            std::ifstream file("/sys/devices/system/node/node" + std::to_string(id) + "/cpulist");
+            std::string list;
+            std::getline(file, list);
+
+            std::vector<int> cpus;
+            for (int cpu : parse_cpu_list(list)) {
+                if (std::find(allowed.begin(), allowed.end(), cpu) != allowed.end()) cpus.push_back(cpu);
+            }
+
+            if (!cpus.empty()) {
+                topology.m_nodes.push_back(cpus);
+                topology.m_node_ids.push_back(id);
+            }
+        }
+
+        /* Without NUMA information, the machine is a single node */
+        if (topology.m_nodes.empty()) {
+            if (allowed.empty()) {
+                for (unsigned int cpu = 0; cpu < std::max(1u, std::thread::hardware_concurrency()); cpu++) allowed.push_back(cpu);
+            }
+            topology.m_nodes.push_back(allowed);
+            topology.m_node_ids.push_back(0);
+        }
+
+        return topology;
+    }
+
+    size_t Topology::cpus() const {
+        size_t cpus = 0;
+        for (const std::vector<int>& node : this->m_nodes) cpus += node.size();
+        return cpus;
+    }
+
+    size_t Topology::node_of(int cpu) const {
+        for (size_t node = 0; node < this->m_nodes.size(); node++) {
+            if (std::find(this->m_nodes[node].begin(), this->m_nodes[node].end(), cpu) != this->m_nodes[node].end()) return node;
+        }
+        return 0;
+    }
+
+    size_t Topology::current_node() const {
+        if (this->m_nodes.size() == 1) return 0;
+        int cpu = sched_getcpu();
+        return cpu < 0 ? 0 : this->node_of(cpu);
+    }
+
+    std::string Topology::describe() const {
+        std::string description = std::to_string(this->nodes()) + " NUMA node" + (this->nodes() == 1 ? "" : "s") + ", " +
+            std::to_string(this->cpus()) + " CPU" + (this->cpus() == 1 ? "" : "s") + " (";
+
+        for (size_t node = 0; node < this->m_nodes.size(); node++) {
+            if (node > 0) description += ", ";
+            description += "node " + std::to_string(this->m_node_ids[node]) + ": " + format_cpu_list(this->m_nodes[node]);
+        }
+
+        return description + ")";
+    }
+
+    Policy parse_policy(const std::string& name) {
+        if (name == "none") return none;
+        if (name == "cores") return cores;
+        if (name == "nodes") return nodes;
+        throw std::invalid_argument("unknown placement policy: " + name);
+    }
+
+    std::string policy_name(Policy policy) {
+        switch (policy) {
+            case cores: return "cores";
+            case nodes: return "nodes";
+            default: return "none";
+        }
+    }
+
+    bool pin_thread(const std::vector<int>& cpus) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu : cpus) CPU_SET(cpu, &set);
+        return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+    }
+
+    bool place_worker(Policy policy, const Topology& topology, size_t i) {
+        switch (policy) {
+            case cores: {
+                size_t cpu = i % topology.cpus();
+                for (size_t node = 0; node < topology.nodes(); node++) {
+                    if (cpu < topology.node_cpus(node).size()) return pin_thread({topology.node_cpus(node)[cpu]});
+                    cpu -= topology.node_cpus(node).size();
+                }
+                return false;
+            }
+            case nodes: return pin_thread(topology.node_cpus(i % topology.nodes()));
+            default: return true;
+        }
+    }
+}
@@ -0,0 +1,248 @@
+#include "reduction.h"
+#include <cmath>
+#include <random>
+
+namespace {
+    /**
+     * @return The norm of a vector.
+     */
+    double norm(const std::vector<double>& v) {
+        double sum = 0;
+        for (double x : v) sum += x * x;
+        return std::sqrt(sum);
+    }
+
+    /**
+     * Multiplies a symmetric n x n matrix by a vector.
+     */
+    void multiply(const std::vector<double>& matrix, const std::vector<double>& v, std::vector<double>& out) {
+        size_t n = v.size();
+        for (size_t i = 0; i < n; i++) {
+            double sum = 0;
+            for (size_t j = 0; j < n; j++) sum += matrix[i * n + j] * v[j];
+            out[i] = sum;
+        }
+    }
+} // anonymous
+
+namespace knn {
+    Reduction Reduction::parse(const std::string& reduction) {
+        size_t colon = reduction.find(':');
+        if (colon == std::string::npos) throw std::invalid_argument("malformed reduction: " + reduction);
+
+        Reduction result;
+        std::string method = reduction.substr(0, colon);
+        if (method == "pca") result.method = pca;
+        else if (method == "gaussian") result.method = gaussian;
+        else if (method == "sparse") result.method = sparse;
+        else throw std::invalid_argument("unknown reduction method: " + method);
+
+        double target = std::stod(reduction.substr(colon + 1));
+        if (target <= 0) throw std::invalid_argument("malformed reduction target: " + reduction);
+
+        if (target < 1) {
+            if (result.method != pca) throw std::invalid_argument("only pca can keep a ratio of variance");
+            result.variance = target;
+        } else result.dims = (size_t)target;
+
+        return result;
+    }
+
+    Projection Projection::pca(const FeatureSet& data_set, size_t dims, double variance) {
+        tracing::Span span{"fit_pca", "knn"};
+        size_t n = data_set.dims();
+        size_t rows = data_set.size();
+        Projection projection;
+        projection.m_input_dims = n;
+        projection.m_mean.assign(n, 0);
+
+        for (size_t i = 0; i < rows; i++) {
+            misc::array<double> x = data_set.features(i);
+            for (size_t j = 0; j < n; j++) projection.m_mean[j] += x[j] / rows;
+        }
+
+        /* The covariance matrix (only its upper triangle is accumulated) */
+        std::vector<double> covariance(n * n, 0);
+        std::vector<double> centered(n);
+        for (size_t i = 0; i < rows; i++) {
+            misc::array<double> x = data_set.features(i);
+            for (size_t j = 0; j < n; j++) centered[j] = x[j] - projection.m_mean[j];
+            for (size_t a = 0; a < n; a++) {
+                for (size_t b = a; b < n; b++) covariance[a * n + b] += centered[a] * centered[b] / rows;
+            }
+        }
+
+        double total = 0;
+        for (size_t a = 0; a < n; a++) {
+            for (size_t b = 0; b < a; b++) covariance[a * n + b] = covariance[b * n + a];
+            total += covariance[a * n + a];
+        }
+
+        /* Find the principal components one by one, removing each from the covariance matrix once found */
+        const size_t max_iterations = 500;
+        std::mt19937 random(1);
+        std::normal_distribution<double> normal;
+        std::vector<double> v(n);
+        std::vector<double> next(n);
+        double explained = 0;
+
+        while (projection.m_output_dims < n) {
+            if (dims > 0 && projection.m_output_dims >= dims) break;
+            if (dims == 0 && explained >= variance * total) break;
+
+            for (double& x : v) x = normal(random);
+            double length = norm(v);
+            for (double& x : v) x /= length;
+
+            double eigenvalue = 0;
+            for (size_t iteration = 0; iteration < max_iterations; iteration++) {
+                multiply(covariance, v, next);
+                double next_eigenvalue = norm(next);
+                if (next_eigenvalue == 0) break;
+
+                for (size_t j = 0; j < n; j++) v[j] = next[j] / next_eigenvalue;
+                bool converged = std::abs(next_eigenvalue - eigenvalue) <= 1e-10 * next_eigenvalue;
+                eigenvalue = next_eigenvalue;
+                if (converged) break;
+            }
+
+            /* The rest of the variance is numerical noise */
+            if (eigenvalue <= 1e-12 * total) break;
+
+            for (size_t a = 0; a < n; a++) {
+                for (size_t b = 0; b < n; b++) covariance[a * n + b] -= eigenvalue * v[a] * v[b];
+            }
+
+            projection.m_matrix.insert(projection.m_matrix.end(), v.begin(), v.end());
+            projection.m_output_dims++;
+            explained += eigenvalue;
+        }
+
+        return projection;
+    }
+
+    Projection Projection::random(size_t input_dims, size_t output_dims, bool sparse, unsigned seed) {
+        Projection projection;
+        projection.m_input_dims = input_dims;
+        projection.m_output_dims = output_dims;
+        projection.m_mean.assign(input_dims, 0);
+        projection.m_matrix.resize(input_dims * output_dims);
+
+        std::mt19937 random(seed);
+        std::normal_distribution<double> normal(0, 1 / std::sqrt((double)output_dims));
+        std::uniform_int_distribution<int> die(1, 6);
+        double scale = std::sqrt(3.0 / output_dims);
+
+        for (double& w : projection.m_matrix) {
+            if (!sparse) w = normal(random);
+            else {
+                int roll = die(random);
+                w = roll == 1 ? scale : roll == 2 ? -scale : 0;
+            }
+        }
+
+        return projection;
+    }
+
+    misc::array<double> Projection::apply(const misc::array<double>& x) const {
+        if (x.length() != this->m_input_dims) {
+            throw std::invalid_argument("Arrays of incomparable lengths (" + std::to_string(x.length()) + " and " +
+                    std::to_string(this->m_input_dims) + ")");
+        }
+
+        misc::array<double> y(this->m_output_dims);
+        for (size_t r = 0; r < this->m_output_dims; r++) {
+            const double* row = &this->m_matrix[r * this->m_input_dims];
+            double sum = 0;
+            for (size_t j = 0; j < this->m_input_dims; j++) sum += row[j] * (x[j] - this->m_mean[j]);
+            y[r] = sum;
+        }
+
+        return y;
+    }
+
+    ReducedFeatureSet::ReducedFeatureSet(FeatureSet* original, const Projection& projection, size_t rerank) :
+        m_original(original), m_reduced(nullptr), m_projection(projection), m_rerank(rerank) {
+        tracing::Span span{"project_dataset", "knn"};
+        DataSet<misc::array<double>>* reduced = new DataSet<misc::array<double>>();
+
+        for (size_t i = 0; i < original->size(); i++) {
+            CartDataPoint<double> point(original->class_type(i), projection.apply(original->features(i)));
+            reduced->add(&point);
+        }
+
+        this->m_reduced = make_feature_set(reduced);
+    }
+
+    ReducedFeatureSet::~ReducedFeatureSet() {
+        delete this->m_reduced;
+        delete this->m_original;
+    }
+
+    size_t ReducedFeatureSet::memory_usage() const {
+        return sizeof(*this) + this->m_original->memory_usage() + this->m_reduced->memory_usage() +
+            this->m_projection.memory_usage();
+    }
+
+    std::vector<int> ReducedFeatureSet::get_k_nearest_indices(int k, const dubdpoint* p, size_t metric) const {
+        if (!this->scans_projection(metric)) return this->m_original->get_k_nearest_indices(k, p, metric);
+
+        CartDataPoint<double> projection(this->m_projection.apply(p->data()));
+        std::vector<int> candidates = this->m_reduced->get_k_nearest_indices(this->candidates(k), &projection, metric);
+        return this->m_original->rerank(k, p, candidates, metric);
+    }
+
+    std::string ReducedFeatureSet::get_nearest_class(int k, const dubdpoint* p, size_t metric) const {
+        return this->m_original->vote(this->get_k_nearest_indices(k, p, metric), k);
+    }
+
+    std::string ReducedFeatureSet::get_nearest_class(int k, size_t i, size_t metric) const {
+        if (!this->scans_projection(metric)) return this->m_original->get_nearest_class(k, i, metric);
+
+        CartDataPoint<double> projection(this->projected(i));
+        std::vector<int> candidates = this->m_reduced->get_k_nearest_indices(this->candidates(k), &projection, metric);
+        return this->m_original->vote(this->m_original->rerank(k, i, candidates, metric), k);
+    }
+
+    std::vector<std::vector<int>> ReducedFeatureSet::get_k_nearest_indices(int k, const dubdpoint* p) const {
+        CartDataPoint<double> projection(this->m_projection.apply(p->data()));
+        std::vector<std::vector<int>> candidates = this->m_reduced->get_k_nearest_indices(this->candidates(k), &projection);
+
+        for (size_t m = 0; m < candidates.size(); m++) {
+            if (this->scans_projection(m)) candidates[m] = this->m_original->rerank(k, p, candidates[m], m);
+            else candidates[m] = this->m_original->get_k_nearest_indices(k, p, m);
+        }
+        return candidates;
+    }
+
+    std::vector<std::vector<int>> ReducedFeatureSet::get_k_nearest_indices(int k, size_t i) const {
+        std::vector<std::vector<int>> candidates = this->m_reduced->get_k_nearest_indices(this->candidates(k), i);
+        std::vector<std::vector<int>> original;
+
+        for (size_t m = 0; m < candidates.size(); m++) {
+            if (this->scans_projection(m)) candidates[m] = this->m_original->rerank(k, i, candidates[m], m);
+            else {
+                if (original.empty()) original = this->m_original->get_k_nearest_indices(k, i);
+                candidates[m] = original[m];
+            }
+        }
+        return candidates;
+    }
+
+    FeatureSet* reduce(FeatureSet* data_set, const Reduction& reduction) {
+        size_t dims = data_set->dims();
+        if (reduction.method == Reduction::none || data_set->size() == 0 || reduction.dims >= dims) return data_set;
+
+        try {
+            Projection projection = reduction.method == Reduction::pca ?
+                Projection::pca(*data_set, reduction.dims, reduction.variance) :
+                Projection::random(dims, reduction.dims, reduction.method == Reduction::sparse);
+
+            if (projection.output_dims() == 0 || projection.output_dims() >= dims) return data_set;
+            return new ReducedFeatureSet(data_set, projection, reduction.rerank);
+        } catch (...) {
+            delete data_set;
+            throw;
+        }
+    }
+}
@@ -2,52 +2,405 @@
 #include "cli.h"
 #include <csignal>
 #include "thread-pool.h"
+#include "watchdog.h"
 #include <map>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <poll.h>
+#include <unistd.h>
 
 using namespace streams;
 using namespace threading;
 using namespace knn;
 
-void thread_job(Address addr, CLI cli,/* dubdset* dataset,*/ TCPSocket client) {
-    DefaultSocketIO dio{&client};
-    cli.start(dio);
+/* The directory session traces are written to, empty if tracing is disabled */
+std::string trace_dir;
+std::atomic<size_t> session_count{0};
+
+/* Sessions end after idle_timeout seconds without input, and commands are cancelled after command_timeout (0 for
+ * neither) */
+int idle_timeout = 0;
+std::chrono::milliseconds command_timeout{0};
+
+/**
+ * Serves a session over a connection (a TCPSocket, UnixSocket or SharedMemoryStream).
+ */
+template <typename S>
+void thread_job(Address addr, CLI cli,/* dubdset* dataset,*/ S client) {
+    static metrics::Gauge& active_sessions = metrics::registry().gauge("knn_active_sessions");
+    static metrics::Histogram& session_bytes_sent = metrics::registry().histogram("knn_session_bytes_sent");
+    static metrics::Histogram& session_bytes_received = metrics::registry().histogram("knn_session_bytes_received");
+
+    std::unique_ptr<tracing::Session> trace;
+    if (trace_dir != "") trace.reset(new tracing::Session());
+    perf::Session counters;
+
+    active_sessions.add();
+    {
+        /* The session's work is cancelled as soon as the client hangs up */
+        cancellation::Token token;
+        cancellation::Attach cancel{&token};
+        cancellation::Watch watch{client.get_fd(), &token};
+
+        tracing::Attach attach{trace.get()};
+        perf::Attach count{perf::enabled() ? &counters : nullptr};
+        tracing::Span span{"session", "session", addr.ip + ":" + std::to_string(addr.port)};
+        DefaultSocketIO dio{&client};
+        bool interrupted = false;
+        try {
+            if (idle_timeout > 0) client.set_receive_timeout(idle_timeout);
+            interrupted = cli.start(dio, "exit", command_timeout);
+        } catch (std::ios_base::failure& e) { }
+
+        /* The token is also cancelled once the client closes the connection after a normal exit */
+        if (interrupted && token.cancelled()) {
+            std::cout << addr.ip << ":" << addr.port << " hung up, cancelled the session." << std::endl;
+        }
+    }
     try { client.close(); } catch (std::ios_base::failure e) { }
-    std::cout << "Session with " << addr.ip << ":" << addr.port << " has ended." << std::endl;
+    active_sessions.sub();
+
+    if (trace) {
+        trace->dump(trace_dir + "/session-" + std::to_string(session_count++) + "-" + addr.ip + "-" +
+                std::to_string(addr.port) + ".json");
+    }
+
+    session_bytes_sent.record(client.bytes_sent());
+    session_bytes_received.record(client.bytes_received());
+    std::cout << "Session with " << addr.ip << ":" << addr.port << " has ended (" << client.bytes_received() <<
+        " bytes in, " << client.bytes_sent() << " bytes out)." << std::endl;
+
+    if (perf::enabled()) {
+        std::cout << "Session with " << addr.ip << ":" << addr.port << " counted " <<
+            counters.counts(perf::command_scope).describe() << " in " << counters.scopes(perf::command_scope) <<
+            " commands and " << counters.counts(perf::scan_scope).describe() << " in " <<
+            counters.scopes(perf::scan_scope) << " scans." << std::endl;
+    }
+}
+
+/**
+ * Serves the metrics in plain text (over HTTP, so they may be scraped) to every connection.
+ * @param server        A listening socket.
+ */
+void serve_metrics(TCPSocket server) {
+    while (true) {
+        try {
+            TCPSocket client = server.accept_connection();
+
+            /* Read (and ignore) the request */
+            size_t size = 4096;
+            delete[] client.receive(size, false);
+
+            std::string body = metrics::registry().render();
+            std::string response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+                std::to_string(body.size()) + "\r\n\r\n" + body;
+            client.send(response.c_str(), response.size());
+            client.close();
+        } catch (std::ios_base::failure& e) { }
+    }
+}
+
+/**
+ * Drops a connection the thread pool has no room for.
+ * @param client        The connection.
+ */
+template <typename S>
+void reject(S client) {
+    static metrics::Counter& rejected = metrics::registry().counter("knn_rejected_connections");
+    rejected.add();
+
+    Address addr = client.get_address();
+    std::cout << "\e[31;1mToo many pending connections, dropping " << addr.ip << ":" << addr.port << "\e[0m" <<
+        std::endl;
+    try { client.close(); } catch (std::ios_base::failure& e) { }
+}
+
+/**
+ * A Unix-domain socket local clients connect to, for sessions over it or over shared memory set up through it.
+ */
+struct LocalListener {
+    UnixSocket socket;
+    std::string path;
+    bool shared_memory;
+};
+
+/* The paths local clients connect to, which are removed when the server is interrupted */
+std::string local_paths[2];
+std::atomic<int> local_path_count{0};
+
+void remove_local_paths(int signal) {
+    for (int i = 0; i < local_path_count; i++) unlink(local_paths[i].c_str());
+    std::signal(signal, SIG_DFL);
+    std::raise(signal);
+}
+
+/**
+ * Binds a socket to a path and listens on it (see LocalListener).
+ */
+LocalListener listen_locally(const std::string& path, bool shared_memory) {
+    LocalListener listener{UnixSocket(), path, shared_memory};
+    listener.socket.bind_to(path);
+    local_paths[local_path_count++] = path;
+    listener.socket.listening(10);
+
+    std::signal(SIGINT, remove_local_paths);
+    std::signal(SIGTERM, remove_local_paths);
+    std::cout << "Listening on " << path << (shared_memory ? " for shared memory connections" : "") << std::endl;
+    return listener;
+}
+
+/**
+ * Accepts a connection on a listener (which has one pending) and assigns a thread to its session.
+ */
+void accept_locally(LocalListener& listener, ThreadPool& thread_pool, CLI cli) {
+    try {
+        UnixSocket client = listener.socket.accept_connection();
+        Address addr = client.get_address();
+        std::cout << addr.ip << ":" << addr.port << " has connected" <<
+            (listener.shared_memory ? " through shared memory." : ".") << std::endl;
+
+        if (!listener.shared_memory) {
+            if (!thread_pool.add_job(thread_job<UnixSocket>, addr, cli, client)) reject(client);
+            return;
+        }
+
+        SharedMemoryStream stream{client};
+        if (!thread_pool.add_job(thread_job<SharedMemoryStream>, addr, cli, stream)) reject(stream);
+    } catch (std::ios_base::failure& e) {
+        std::cout << "\e[31;1mFailed to accept a local connection:\e[0m " << e.what() << std::endl;
+    }
+}
+
+/**
+ * Closes a listener and removes its path, so no more local clients connect.
+ */
+void stop_listening(LocalListener& listener) {
+    try { listener.socket.close(); } catch (std::ios_base::failure& e) { }
+    unlink(listener.path.c_str());
+}
+
+void usage(const char* name) {
+    std::cout << "\e[31;1mUsage:\e[0m " << name << " <ip> <port> [--metrics-port port] [--trace-dir dir]"
+              << " [--session-quota size] [--global-quota size] [--reduce method:target] [--rerank n]"
+              << " [--datasets dir|manifest] [--worker] [--shards ip:port,...] [--placement none|cores|nodes]"
+              << " [--replicate-datasets] [--idle-timeout seconds] [--command-timeout seconds]"
+              << " [--batch-window microseconds] [--batch-size n] [--exact-match] [--perf-counters]"
+              << " [--unix path] [--shm path] [--parallel-scan points] [--scan-threads n]" << std::endl;
+    std::exit(1);
 }
 
 int main(int argc, char** argv) {
-    if (argc < 3) {
-        std::cout << "\e[31;1mUsage:\e[0m " << argv[0] << " <ip> <port>" << std::endl;
-        std::exit(1);
+    if (argc < 3) usage(argv[0]);
+
+    int metrics_port = 0;
+    Reduction reduction;
+    std::string datasets_path;
+    bool worker = false;
+    std::vector<Address> shards;
+    placement::Policy policy = placement::none;
+    bool replicate = false;
+    bool exact_match = false;
+    bool perf_counters = false;
+    std::string unix_path;
+    std::string shm_path;
+    Batching batching;
+    for (int i = 3; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--worker" || arg == "--replicate-datasets" || arg == "--exact-match" || arg == "--perf-counters") {
+            if (arg == "--worker") worker = true;
+            else if (arg == "--replicate-datasets") replicate = true;
+            else if (arg == "--exact-match") exact_match = true;
+            else perf_counters = true;
+            continue;
+        }
+        if (i + 1 >= argc) usage(argv[0]);
+
+        if (arg == "--metrics-port") metrics_port = strtol(argv[++i], NULL, 0);
+        else if (arg == "--trace-dir") trace_dir = argv[++i];
+        else if (arg == "--session-quota" || arg == "--global-quota") {
+            size_t quota = 0;
+            try {
+                quota = accounting::parse_size(argv[++i]);
+            } catch (std::exception& e) {
+                usage(argv[0]);
+            }
+
+            if (arg == "--session-quota") accounting::set_session_limit(quota);
+            else accounting::global_budget().set_limit(quota);
+        }
+        else if (arg == "--reduce") {
+            size_t rerank = reduction.rerank;
+            try {
+                reduction = Reduction::parse(argv[++i]);
+            } catch (std::exception& e) {
+                usage(argv[0]);
+            }
+            reduction.rerank = rerank;
+        }
+        else if (arg == "--rerank") {
+            long rerank = strtol(argv[++i], NULL, 0);
+            if (rerank < 1 || rerank > (long)Reduction::max_rerank) usage(argv[0]);
+            reduction.rerank = rerank;
+        }
+        else if (arg == "--datasets") datasets_path = argv[++i];
+        else if (arg == "--parallel-scan") {
+            long points = strtol(argv[++i], NULL, 0);
+            if (points < 0) usage(argv[0]);
+            parallel::set_threshold(points);
+        }
+        else if (arg == "--scan-threads") {
+            long threads = strtol(argv[++i], NULL, 0);
+            if (threads < 1) usage(argv[0]);
+            parallel::set_max_threads(threads);
+        }
+        else if (arg == "--unix") unix_path = argv[++i];
+        else if (arg == "--shm") shm_path = argv[++i];
+        else if (arg == "--idle-timeout") {
+            idle_timeout = strtol(argv[++i], NULL, 0);
+            if (idle_timeout < 0) usage(argv[0]);
+        }
+        else if (arg == "--command-timeout") {
+            double seconds = strtod(argv[++i], NULL);
+            if (seconds < 0) usage(argv[0]);
+            command_timeout = std::chrono::milliseconds((long long)(seconds * 1000));
+        }
+        else if (arg == "--batch-window") {
+            long microseconds = strtol(argv[++i], NULL, 0);
+            if (microseconds < 0) usage(argv[0]);
+            batching.window = std::chrono::microseconds(microseconds);
+        }
+        else if (arg == "--batch-size") {
+            long queries = strtol(argv[++i], NULL, 0);
+            if (queries < 1) usage(argv[0]);
+            batching.max_queries = queries;
+        }
+        else if (arg == "--placement") {
+            try {
+                policy = placement::parse_policy(argv[++i]);
+            } catch (std::exception& e) {
+                usage(argv[0]);
+            }
+        }
+        else if (arg == "--shards") {
+            try {
+                shards = parse_shards(argv[++i]);
+            } catch (std::exception& e) {
+                usage(argv[0]);
+            }
+        }
+        else usage(argv[0]);
+    }
+
+    if (perf_counters) {
+        std::string reason;
+        if (perf::enable(reason)) std::cout << "Counting hardware events of every command and scan" << std::endl;
+        else std::cout << "\e[31;1mHardware counters are unavailable:\e[0m " << reason << std::endl;
+    }
+
+    placement::Topology topology = placement::Topology::detect();
+    std::cout << "Topology: " << topology.describe() << ", placement: " << placement::policy_name(policy) <<
+        (replicate && topology.nodes() > 1 ? ", datasets replicated on every node" : "") << std::endl;
+
+    /* Preloaded datasets are ready before the first session connects */
+    Catalog catalog{topology};
+    if (datasets_path != "") {
+        try {
+            catalog.load(datasets_path, reduction, replicate, batching, exact_match);
+        } catch (std::exception& e) {
+            std::cout << "\e[31;1mFailed to load datasets:\e[0m " << e.what() << std::endl;
+            std::exit(1);
+        }
     }
 
     TCPSocket server = TCPSocket(argv[1], strtol(argv[2], NULL, 0));
     server.listening(10);
+
+    /* The metrics are only served locally */
+    if (metrics_port > 0) {
+        TCPSocket metrics_server = TCPSocket("127.0.0.1", metrics_port);
+        metrics_server.listening(10);
+        std::thread(serve_metrics, metrics_server).detach();
+    }
     
-    ThreadPool thread_pool{50};
+    /* Sessions allocate their datasets on the threads which scan them, so placing the threads places the memory */
+    std::atomic<bool> placement_failed{false};
+    ThreadPool thread_pool{50, [policy, &topology, &placement_failed](unsigned int i) {
+            if (!placement::place_worker(policy, topology, i) && !placement_failed.exchange(true)) {
+                std::cout << "\e[31;1mFailed to pin worker threads, leaving them unpinned\e[0m" << std::endl;
+            }
+        }};
     
-    Upload_Files com1{"upload an unclassified csv file"};
+    /* The helpers of split scans are placed like the workers, rather than where the worker which started them runs */
+    parallel::set_helper_placement([policy, &topology, &placement_failed](unsigned int i) {
+            if (!placement::place_worker(policy, topology, i) && !placement_failed.exchange(true)) {
+                std::cout << "\e[31;1mFailed to pin worker threads, leaving them unpinned\e[0m" << std::endl;
+            }
+        });
+
+    /* A connection which drops (a client whose session is being cancelled, or a worker of a coordinator) must fail
+     * the send to it, not kill the server */
+    std::signal(SIGPIPE, SIG_IGN);
+
+    Upload_Files com1{"upload an unclassified csv file", reduction, &catalog, shards, exact_match};
     Algorithm_Settings com2{"algorithm settings"};
     Classify_Data com3{"classify data"};
     Display_Results com4{"display results"};
     Download_Results com5{"download results"};
     Display_Confusion_Matrix com6{"display confusion matrix"};
+    Sweep_Settings com7{"sweep all algorithm settings"};
+    Display_Statistics com8{"display server statistics"};
     
+    /* Local clients may skip the TCP stack, through a Unix-domain socket or shared memory set up over one. All the
+     * listeners are polled here, so the server only times out after 5 minutes with no connection on any of them */
+    std::vector<LocalListener> local_listeners;
+    try {
+        if (unix_path != "" && !worker) local_listeners.push_back(listen_locally(unix_path, false));
+        if (shm_path != "" && !worker) local_listeners.push_back(listen_locally(shm_path, true));
+    } catch (std::ios_base::failure& e) {
+        std::cout << "\e[31;1mFailed to listen locally:\e[0m " << e.what() << std::endl;
+        for (int i = 0; i < local_path_count; i++) unlink(local_paths[i].c_str());
+        std::exit(1);
+    }
+
     while (true) {
-        TCPSocket client = server.accept_connection(300); // times out after 5 minutes with no connection
-        if (!client.is_good()) {
+        std::vector<struct pollfd> fds{{server.get_fd(), POLLIN, 0}};
+        for (LocalListener& listener : local_listeners) fds.push_back({listener.socket.get_fd(), POLLIN, 0});
+
+        int num_ready_fds = poll(fds.data(), fds.size(), 300 * 1000); // times out after 5 minutes with no connection
+        if (num_ready_fds == 0) {
             std::cout << "Server timeout exceeded, quitting..." << std::endl;
             break;
+        } else if (num_ready_fds < 0) {
+            if (errno == EINTR) continue;
+            std::cout << "\e[31;1mFailed to poll for connections, quitting:\e[0m errno " << errno << std::endl;
+            break;
+        }
+
+        CLI cli{&com1, &com2, &com3, &com4, &com5, &com6, &com7, &com8};
+        for (size_t i = 0; i < local_listeners.size(); i++) {
+            if (fds[i + 1].revents & POLLIN) accept_locally(local_listeners[i], thread_pool, cli);
         }
+        if (!(fds[0].revents & POLLIN)) continue;
 
+        TCPSocket client = server.accept_connection();
         Address addr = client.get_address();
+
+        // a worker serves a shard of a coordinator's session on each connection.
+        if (worker) {
+            std::cout << addr.ip << ":" << addr.port << " has connected as a coordinator." << std::endl;
+            if (!thread_pool.add_job(serve_shard, client, reduction)) reject(client);
+            continue;
+        }
+
         std::cout << addr.ip << ":" << addr.port << " has connected." << std::endl;
 
         // assigning a thread for each new client.
-        thread_pool.add_job(thread_job, addr, CLI(&com1, &com2, &com3, &com4, &com5, &com6), client);
+        if (!thread_pool.add_job(thread_job<TCPSocket>, addr, cli, client)) reject(client);
     }
 
+    /* No more sessions are accepted while the running ones finish */
+    for (LocalListener& listener : local_listeners) stop_listening(listener);
     thread_pool.end();
     server.close();
 }
-
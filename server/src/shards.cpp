@@ -0,0 +1,466 @@
+#include "shards.h"
+#include "watchdog.h"
+#include <algorithm>
+#include <sstream>
+
+using streams::Address;
+using streams::BufferedStream;
+using streams::Serializer;
+using streams::TCPSocket;
+
+namespace {
+    /**
+     * The requests a coordinator sends its shards. Every request but close_request is answered by a status, and
+     * then by the response if the status is ok_status, or by an error message otherwise.
+     * + load_request(type, points, 0) : loads the shard, every point being sent as (1, features, class) as the
+     *   coordinator reads it
+     * + query_request(k, metric, exclude, point) -> for each metric: n, n x (index, distance)
+     * + features_request(index) -> features
+     * + distances_request(metric, point, n, n x index) -> n x distance
+     */
+    enum ShardRequest : uint32_t {load_request, query_request, features_request, distances_request, close_request};
+
+    enum ShardStatus : uint32_t {ok_status, invalid_status, failed_status};
+
+    template <typename T>
+    knn::DataSet<misc::array<T>>* receive_points(Serializer& s, accounting::Account& account, std::string& error) {
+        std::unique_ptr<knn::DataSet<misc::array<T>>> shard{new knn::DataSet<misc::array<T>>()};
+
+        /* Points keep being received after a rejection, so the connection stays in step with the coordinator */
+        while (true) {
+            uint32_t more;
+            s >> more;
+            if (more == 0) break;
+            if (more != 1) throw std::ios_base::failure("the coordinator ended the upload");
+
+            misc::array<double> features;
+            std::string class_name;
+            s >> features >> class_name;
+            if (error != "") continue;
+
+            misc::array<T> converted(features.length());
+            for (size_t j = 0; j < features.length(); j++) converted[j] = (T)features[j];
+            knn::CartDataPoint<T> point(class_name, converted);
+
+            try {
+                account.charge(accounting::dataset_memory, point.memory_usage() + sizeof(knn::DataPoint<misc::array<T>>*));
+                shard->add(&point);
+            } catch (accounting::QuotaExceeded& e) {
+                error = e.what();
+            }
+        }
+
+        return shard.release();
+    }
+
+    knn::FeatureSet* receive_shard(Serializer& s, const std::string& type, accounting::Account& account,
+            std::string& error) {
+        if (type == knn::feature_name<double>()) return knn::make_feature_set(receive_points<double>(s, account, error));
+        if (type == knn::feature_name<float>()) return knn::make_feature_set(receive_points<float>(s, account, error));
+        if (type == knn::feature_name<int16_t>()) return knn::make_feature_set(receive_points<int16_t>(s, account, error));
+        if (type == knn::feature_name<uint8_t>()) return knn::make_feature_set(receive_points<uint8_t>(s, account, error));
+        throw std::ios_base::failure("unknown feature type " + type);
+    }
+
+    void respond_error(Serializer& s, ShardStatus status, const std::string& message) {
+        s << (uint32_t)status << message;
+    }
+} // anonymous
+
+namespace knn {
+    std::vector<Address> parse_shards(const std::string& shards) {
+        std::vector<Address> addresses;
+        std::stringstream list(shards);
+        std::string shard;
+
+        while (std::getline(list, shard, ',')) {
+            size_t colon = shard.rfind(':');
+            if (colon == std::string::npos || colon == 0) throw std::invalid_argument("malformed shard address: " + shard);
+
+            size_t end;
+            int port = std::stoi(shard.substr(colon + 1), &end);
+            if (end != shard.size() - colon - 1 || port <= 0) throw std::invalid_argument("malformed shard port: " + shard);
+            addresses.push_back(Address{shard.substr(0, colon), port});
+        }
+
+        if (addresses.empty()) throw std::invalid_argument("no shards");
+        return addresses;
+    }
+
+    void serve_shard(TCPSocket socket, Reduction reduction) {
+        cancellation::Token token;
+        cancellation::Attach attach{&token};
+        std::unique_ptr<cancellation::Watch> watch{new cancellation::Watch(socket.get_fd(), &token)};
+
+        BufferedStream stream{&socket};
+        Serializer s;
+        s(&stream);
+
+        accounting::Account account;
+        std::unique_ptr<FeatureSet> data_set;
+
+        try {
+            while (true) {
+                uint32_t request;
+                s >> request;
+                if (request == close_request) break;
+
+                switch (request) {
+                    case load_request: {
+                        std::string type;
+                        s >> type;
+
+                        data_set.reset();
+                        account.release(accounting::dataset_memory, account.used(accounting::dataset_memory));
+
+                        std::string error;
+                        std::unique_ptr<FeatureSet> shard{receive_shard(s, type, account, error)};
+                        if (error != "") {
+                            respond_error(s, failed_status, error);
+                            break;
+                        }
+
+                        data_set.reset(reduce(shard.release(), reduction));
+                        s << (uint32_t)ok_status;
+                        break;
+                    }
+
+                    case query_request: {
+                        int32_t k, exclude;
+                        uint32_t metric;
+                        misc::array<double> features;
+                        s >> k >> metric >> exclude >> features;
+
+                        std::vector<std::vector<int>> indices;
+                        std::vector<std::vector<double>> distances;
+                        try {
+                            if (data_set == nullptr) throw std::invalid_argument("the shard isn't loaded");
+                            if (exclude >= 0) features = data_set->features(exclude);
+                            CartDataPoint<double> p(features);
+
+                            if (metric < distances::num_metrics) indices.push_back(data_set->get_k_nearest_indices(k, &p, metric));
+                            else if (exclude >= 0) indices = data_set->get_k_nearest_indices(k, (size_t)exclude);
+                            else indices = data_set->get_k_nearest_indices(k, &p);
+
+                            for (size_t m = 0; m < indices.size(); m++) {
+                                distances.push_back(data_set->distances(&p, indices[m], indices.size() == 1 ? metric : m));
+                            }
+                        } catch (std::invalid_argument& e) {
+                            respond_error(s, invalid_status, e.what());
+                            break;
+                        }
+
+                        s << (uint32_t)ok_status;
+                        for (size_t m = 0; m < indices.size(); m++) {
+                            s << (uint32_t)indices[m].size();
+                            for (size_t j = 0; j < indices[m].size(); j++) s << (uint32_t)indices[m][j] << distances[m][j];
+                        }
+                        break;
+                    }
+
+                    case features_request: {
+                        uint32_t i;
+                        s >> i;
+
+                        if (data_set == nullptr || i >= data_set->size()) {
+                            respond_error(s, invalid_status, "no such point in the shard");
+                            break;
+                        }
+
+                        s << (uint32_t)ok_status << data_set->features(i);
+                        break;
+                    }
+
+                    case distances_request: {
+                        uint32_t metric, n;
+                        misc::array<double> features;
+                        s >> metric >> features >> n;
+
+                        std::vector<int> indices;
+                        for (uint32_t j = 0; j < n; j++) {
+                            uint32_t i;
+                            s >> i;
+                            indices.push_back(i);
+                        }
+
+                        std::vector<double> distances;
+                        try {
+                            if (data_set == nullptr) throw std::invalid_argument("the shard isn't loaded");
+                            CartDataPoint<double> p(features);
+                            distances = data_set->distances(&p, indices, metric);
+                        } catch (std::invalid_argument& e) {
+                            respond_error(s, invalid_status, e.what());
+                            break;
+                        }
+
+                        s << (uint32_t)ok_status;
+                        for (double distance : distances) s << distance;
+                        break;
+                    }
+
+                    default:
+                        throw std::ios_base::failure("unknown shard request");
+                }
+
+                stream.flush();
+            }
+        } catch (std::ios_base::failure& e) {
+        } catch (cancellation::Cancelled& e) { }     // The coordinator hung up mid-query
+
+        data_set.reset();
+        account.release(accounting::dataset_memory, account.used(accounting::dataset_memory));
+        watch.reset();      // Before the descriptor may be reused
+        try { socket.close(); } catch (std::ios_base::failure& e) { }
+    }
+
+    struct ShardedFeatureSet::Shard {
+        Address address;
+        TCPSocket socket;
+        BufferedStream stream;
+        Serializer serializer;
+
+        Shard(const Address& a) : address(a), socket("0.0.0.0"), stream(&this->socket) {
+            try {
+                this->socket.connect_to(a.ip, a.port);
+            } catch (...) {
+                this->socket.close();
+                throw;
+            }
+            this->serializer(&this->stream);
+        }
+
+        ~Shard() {
+            try { this->socket.close(); } catch (std::ios_base::failure& e) { }
+        }
+
+        std::string name() const { return this->address.ip + ":" + std::to_string(this->address.port); }
+    };
+
+    ShardedFeatureSet::ShardedFeatureSet(const std::vector<Address>& workers, std::function<void(size_t)> reserve) :
+        m_feature_type(feature_name<double>()), m_dims(0), m_loading(false), m_reserve(reserve) {
+        for (const Address& address : workers) {
+            try {
+                this->m_shards.emplace_back(new Shard(address));
+            } catch (std::ios_base::failure& e) {
+                throw ShardFailure("shard " + address.ip + ":" + std::to_string(address.port) + " is unreachable: " + e.what());
+            }
+        }
+    }
+
+    void ShardedFeatureSet::start_loading() {
+        this->m_loading = true;
+        for (std::unique_ptr<Shard>& shard : this->m_shards) {
+            try {
+                shard->serializer << (uint32_t)load_request << this->m_feature_type;
+            } catch (std::ios_base::failure& e) {
+                this->m_failure = "shard " + shard->name() + " failed: " + e.what();
+                throw ShardFailure(this->m_failure);
+            }
+        }
+    }
+
+    /* The Feature Set isn't shared while it is loaded, so the upload doesn't lock */
+    void ShardedFeatureSet::add(const misc::array<double>& features, const std::string& class_name) {
+        if (this->m_failure != "") throw ShardFailure(this->m_failure);
+        if (!this->m_loading) this->start_loading();
+
+        if (this->m_reserve) this->m_reserve(sizeof(std::string) + accounting::heap_usage(class_name));
+        if (this->m_classes.empty()) this->m_dims = features.length();
+
+        Shard& shard = *this->m_shards[this->m_classes.size() % this->m_shards.size()];
+        try {
+            shard.serializer << (uint32_t)1 << features << class_name;
+        } catch (std::ios_base::failure& e) {
+            this->m_failure = "shard " + shard.name() + " failed: " + e.what();
+            throw ShardFailure(this->m_failure);
+        }
+        this->m_classes.push_back(class_name);
+    }
+
+    void ShardedFeatureSet::finish() {
+        tracing::Span span{"distribute_shards", "knn"};
+        if (this->m_failure == "" && !this->m_loading) this->start_loading();
+
+        this->exchange([](size_t shard, Serializer& s) {
+                s << (uint32_t)0;
+                return true;
+            }, [](size_t shard, Serializer& s) { });
+    }
+
+    ShardedFeatureSet::~ShardedFeatureSet() {
+        for (std::unique_ptr<Shard>& shard : this->m_shards) {
+            try {
+                shard->serializer << (uint32_t)close_request;
+                shard->stream.flush();
+            } catch (std::ios_base::failure& e) { }
+        }
+    }
+
+    void ShardedFeatureSet::exchange(std::function<bool(size_t, Serializer&)> send,
+            std::function<void(size_t, Serializer&)> receive) const {
+        static metrics::Histogram& exchange_time = metrics::registry().histogram("knn_shard_exchange_ns");
+        metrics::Timer timer{exchange_time};
+        tracing::Span span{"scatter_gather", "knn"};
+
+        std::unique_lock<std::mutex> lock{this->m_mutex};
+        if (this->m_failure != "") throw ShardFailure(this->m_failure);
+
+        size_t shard = 0;
+        std::vector<bool> sent(this->m_shards.size());
+        std::string invalid;
+        try {
+            for (shard = 0; shard < this->m_shards.size(); shard++) {
+                sent[shard] = send(shard, this->m_shards[shard]->serializer);
+                this->m_shards[shard]->stream.flush();
+            }
+
+            for (shard = 0; shard < this->m_shards.size(); shard++) {
+                if (!sent[shard]) continue;
+
+                Serializer& s = this->m_shards[shard]->serializer;
+                uint32_t status;
+                s >> status;
+
+                if (status == ok_status) receive(shard, s);
+                else {
+                    std::string message;
+                    s >> message;
+                    if (status == invalid_status && invalid == "") invalid = message;
+                    else if (status != invalid_status && this->m_failure == "") {
+                        this->m_failure = "shard " + this->m_shards[shard]->name() + " failed: " + message;
+                    }
+                }
+            }
+        } catch (std::ios_base::failure& e) {
+            this->m_failure = "shard " + this->m_shards[shard]->name() + " failed: " + e.what();
+        }
+
+        if (this->m_failure != "") throw ShardFailure(this->m_failure);
+        if (invalid != "") throw std::invalid_argument(invalid);
+    }
+
+    std::vector<std::vector<int>> ShardedFeatureSet::query(int k, const dubdpoint* p, size_t metric, int exclude) const {
+        size_t n = this->m_shards.size();
+        size_t lists = metric < distances::num_metrics ? 1 : distances::num_metrics;
+        std::vector<std::vector<std::pair<double, int>>> nearest(lists);
+
+        this->exchange([&](size_t shard, Serializer& s) {
+                bool owner = exclude >= 0 && (size_t)exclude % n == shard;
+                s << (uint32_t)query_request << (int32_t)k << (uint32_t)metric <<
+                    (int32_t)(owner ? exclude / n : -1) << (owner ? misc::array<double>(0) : p->data());
+                return true;
+            }, [&](size_t shard, Serializer& s) {
+                for (size_t m = 0; m < lists; m++) {
+                    uint32_t count;
+                    s >> count;
+                    for (uint32_t j = 0; j < count; j++) {
+                        uint32_t i;
+                        double distance;
+                        s >> i >> distance;
+                        nearest[m].push_back(std::make_pair(distance, (int)(i * n + shard)));
+                    }
+                }
+            });
+
+        std::vector<std::vector<int>> indices(lists);
+        for (size_t m = 0; m < lists; m++) {
+            size_t kept = std::min((size_t)k, nearest[m].size());
+            std::partial_sort(nearest[m].begin(), nearest[m].begin() + kept, nearest[m].end());
+            for (size_t j = 0; j < kept; j++) indices[m].push_back(nearest[m][j].second);
+        }
+
+        return indices;
+    }
+
+    misc::array<double> ShardedFeatureSet::features(size_t i) const {
+        size_t n = this->m_shards.size();
+        misc::array<double> features(0);
+
+        this->exchange([&](size_t shard, Serializer& s) {
+                if (i % n != shard) return false;
+                s << (uint32_t)features_request << (uint32_t)(i / n);
+                return true;
+            }, [&](size_t shard, Serializer& s) {
+                if (i % n == shard) s >> features;
+            });
+
+        return features;
+    }
+
+    size_t ShardedFeatureSet::memory_usage() const {
+        size_t bytes = sizeof(*this) + this->m_classes.capacity() * sizeof(std::string) +
+            this->m_shards.size() * (sizeof(Shard) + 2 * BufferedStream::block_size);
+        for (const std::string& class_name : this->m_classes) bytes += accounting::heap_usage(class_name);
+        return bytes;
+    }
+
+    std::string ShardedFeatureSet::get_nearest_class(int k, const dubdpoint* p, size_t metric) const {
+        std::vector<int> indices = this->get_k_nearest_indices(k, p, metric);
+        return this->metric_vote(indices, k, metric);
+    }
+
+    std::string ShardedFeatureSet::get_nearest_class(int k, size_t i, size_t metric) const {
+        CartDataPoint<double> p(this->features(i));
+        return this->get_nearest_class(k, &p, metric);
+    }
+
+    std::vector<std::vector<int>> ShardedFeatureSet::get_k_nearest_indices(int k, const dubdpoint* p) const {
+        return this->query(k, p, distances::num_metrics, -1);
+    }
+
+    std::vector<std::vector<int>> ShardedFeatureSet::get_k_nearest_indices(int k, size_t i) const {
+        CartDataPoint<double> p(this->features(i));
+        return this->query(k, &p, distances::num_metrics, i);
+    }
+
+    std::vector<int> ShardedFeatureSet::get_k_nearest_indices(int k, const dubdpoint* p, size_t metric) const {
+        return this->query(k, p, metric, -1)[0];
+    }
+
+    std::vector<int> ShardedFeatureSet::rerank(int k, const dubdpoint* p, const std::vector<int>& candidates,
+            size_t metric) const {
+        std::vector<double> distances = this->distances(p, candidates, metric);
+        std::vector<std::pair<double, int>> ranked;
+        for (size_t j = 0; j < candidates.size(); j++) ranked.push_back(std::make_pair(distances[j], candidates[j]));
+
+        size_t kept = std::min((size_t)k, ranked.size());
+        std::partial_sort(ranked.begin(), ranked.begin() + kept, ranked.end());
+
+        std::vector<int> indices;
+        for (size_t j = 0; j < kept; j++) indices.push_back(ranked[j].second);
+        return indices;
+    }
+
+    std::vector<int> ShardedFeatureSet::rerank(int k, size_t i, const std::vector<int>& candidates, size_t metric) const {
+        CartDataPoint<double> p(this->features(i));
+        return this->rerank(k, &p, candidates, metric);
+    }
+
+    std::vector<double> ShardedFeatureSet::distances(const dubdpoint* p, const std::vector<int>& indices,
+            size_t metric) const {
+        size_t n = this->m_shards.size();
+        std::vector<double> result(indices.size());
+
+        this->exchange([&](size_t shard, Serializer& s) {
+                std::vector<uint32_t> local;
+                for (int i : indices) if ((size_t)i % n == shard) local.push_back(i / n);
+                if (local.empty()) return false;
+
+                s << (uint32_t)distances_request << (uint32_t)metric << p->data() << (uint32_t)local.size();
+                for (uint32_t i : local) s << i;
+                return true;
+            }, [&](size_t shard, Serializer& s) {
+                for (size_t j = 0; j < indices.size(); j++) {
+                    if ((size_t)indices[j] % n == shard) s >> result[j];
+                }
+            });
+
+        return result;
+    }
+
+    std::string ShardedFeatureSet::vote(const std::vector<int>& indices, int k) const {
+        return vote_classes(std::min(k, (int)indices.size()), [this, &indices](size_t j) {
+                return this->m_classes[indices[j]];
+            });
+    }
+}
@@ -0,0 +1,171 @@
+#include "sparse-feature-set.h"
+#include <algorithm>
+#include <queue>
+
+namespace {
+    /**
+     * A neighbor of a query, ordered by distance only (as DataSet::select_k_nearest orders them).
+     */
+    struct Neighbor {
+        int index;
+        double distance;
+
+        bool operator<(const Neighbor& other) const { return this->distance < other.distance; }
+    };
+
+    knn::SparseVector sparsify(const dubdpoint* p) {
+        const misc::array<double>& data = p->data();
+        return knn::SparseVector::from_dense(data.data(), data.length());
+    }
+} // anonymous
+
+namespace knn {
+    SparseFeatureSet::SparseFeatureSet(SparseDataSet* data_set) : m_data_set(data_set) {
+        this->m_norms.reserve(data_set->size());
+        for (size_t i = 0; i < data_set->size(); i++) this->m_norms.push_back(norm(data_set->row(i)));
+    }
+
+    misc::array<double> SparseFeatureSet::features(size_t i) const {
+        SparseRow x = this->m_data_set->row(i);
+        misc::array<double> features(this->dims());
+        for (size_t j = 0; j < this->dims(); j++) features[j] = 0;
+        for (size_t j = 0; j < x.nnz; j++) features[x.indices[j]] = x.values[j];
+        return features;
+    }
+
+    double SparseFeatureSet::distance(const SparseRow& q, double norm, size_t i, size_t metric) const {
+        SparseRow x = this->m_data_set->row(i);
+
+        if (metric == distances::cosine_metric || metric == distances::inner_product_metric) {
+            return distances::from_dot(metric, distances::sparse_dot_kernel(q.indices, q.values, q.nnz, x.indices,
+                        x.values, x.nnz), norm, this->m_norms[i]);
+        }
+        return distances::sparse_metric_kernel<double>(metric)(q.indices, q.values, q.nnz, x.indices, x.values, x.nnz);
+    }
+
+    template <typename D>
+    std::vector<std::vector<int>> SparseFeatureSet::select_k_nearest(int k, D distances, size_t num_metrics,
+            int exclude) const {
+        static metrics::Histogram& scan_time = metrics::registry().histogram("knn_query_scan_ns");
+        metrics::Timer timer{scan_time};
+        perf::Scope counted{perf::scan_scope};
+        tracing::Span span{"select_k_nearest", "knn"};
+
+        /* One bounded max-heap per metric, whose top is the farthest of the current k nearest */
+        std::vector<std::priority_queue<Neighbor>> nearest(num_metrics);
+        std::vector<double> point_distances(num_metrics);
+
+        for (size_t i = 0; i < this->size(); i++) {
+            if (i % cancellation::check_interval == 0) cancellation::check();
+            if ((int)i == exclude) continue;
+
+            distances(i, point_distances.data());
+
+            for (size_t m = 0; m < num_metrics; m++) {
+                if ((int)nearest[m].size() < k) nearest[m].push(Neighbor{(int)i, point_distances[m]});
+                else if (point_distances[m] < nearest[m].top().distance) {
+                    nearest[m].pop();
+                    nearest[m].push(Neighbor{(int)i, point_distances[m]});
+                }
+            }
+        }
+
+        std::vector<std::vector<int>> indices(num_metrics);
+        for (size_t m = 0; m < num_metrics; m++) {
+            indices[m].resize(nearest[m].size());
+            for (size_t j = indices[m].size(); j > 0; j--) {
+                indices[m][j - 1] = nearest[m].top().index;
+                nearest[m].pop();
+            }
+        }
+
+        return indices;
+    }
+
+    std::vector<int> SparseFeatureSet::nearest_indices(int k, const SparseRow& q, double norm, size_t metric) const {
+        return this->select_k_nearest(k, [this, &q, norm, metric](size_t i, double* out) {
+                out[0] = this->distance(q, norm, i, metric);
+            }, 1)[0];
+    }
+
+    std::vector<std::vector<int>> SparseFeatureSet::all_nearest_indices(int k, const SparseRow& q, double norm,
+            int exclude) const {
+        return this->select_k_nearest(k, [this, &q, norm](size_t i, double* out) {
+                SparseRow x = this->m_data_set->row(i);
+                distances::sparse_all_kernel(q.indices, q.values, q.nnz, x.indices, x.values, x.nnz, norm,
+                        this->m_norms[i], out);
+            }, distances::num_metrics, exclude);
+    }
+
+    std::vector<int> SparseFeatureSet::rank(int k, const SparseRow& q, double norm, const std::vector<int>& candidates,
+            size_t metric) const {
+        tracing::Span span{"rerank", "knn"};
+        std::vector<std::pair<double, int>> ranked;
+        for (int i : candidates) ranked.push_back(std::make_pair(this->distance(q, norm, i, metric), i));
+
+        size_t kept = std::min((size_t)k, ranked.size());
+        std::partial_sort(ranked.begin(), ranked.begin() + kept, ranked.end());
+
+        std::vector<int> indices;
+        for (size_t j = 0; j < kept; j++) indices.push_back(ranked[j].second);
+        return indices;
+    }
+
+    std::string SparseFeatureSet::vote(const std::vector<int>& indices, int k) const {
+        tracing::Span span{"vote", "knn"};
+        return vote_classes(std::min(k, (int)indices.size()), [this, &indices](size_t j) {
+                return this->m_data_set->class_type(indices[j]);
+            });
+    }
+
+    std::string SparseFeatureSet::get_nearest_class(int k, const SparseVector& p, size_t metric) const {
+        SparseRow q = row(p);
+        return this->vote(this->nearest_indices(k, q, norm(q), metric), k);
+    }
+
+    std::string SparseFeatureSet::get_nearest_class(int k, const dubdpoint* p, size_t metric) const {
+        return this->get_nearest_class(k, sparsify(p), metric);
+    }
+
+    std::string SparseFeatureSet::get_nearest_class(int k, size_t i, size_t metric) const {
+        return this->vote(this->nearest_indices(k, this->m_data_set->row(i), this->m_norms[i], metric), k);
+    }
+
+    std::vector<std::vector<int>> SparseFeatureSet::get_k_nearest_indices(int k, const dubdpoint* p) const {
+        SparseVector v = sparsify(p);
+        SparseRow q = row(v);
+        return this->all_nearest_indices(k, q, norm(q), -1);
+    }
+
+    std::vector<std::vector<int>> SparseFeatureSet::get_k_nearest_indices(int k, size_t i) const {
+        return this->all_nearest_indices(k, this->m_data_set->row(i), this->m_norms[i], i);
+    }
+
+    std::vector<int> SparseFeatureSet::get_k_nearest_indices(int k, const dubdpoint* p, size_t metric) const {
+        SparseVector v = sparsify(p);
+        SparseRow q = row(v);
+        return this->nearest_indices(k, q, norm(q), metric);
+    }
+
+    std::vector<int> SparseFeatureSet::rerank(int k, const dubdpoint* p, const std::vector<int>& candidates,
+            size_t metric) const {
+        SparseVector v = sparsify(p);
+        SparseRow q = row(v);
+        return this->rank(k, q, norm(q), candidates, metric);
+    }
+
+    std::vector<int> SparseFeatureSet::rerank(int k, size_t i, const std::vector<int>& candidates, size_t metric) const {
+        return this->rank(k, this->m_data_set->row(i), this->m_norms[i], candidates, metric);
+    }
+
+    std::vector<double> SparseFeatureSet::distances(const dubdpoint* p, const std::vector<int>& indices,
+            size_t metric) const {
+        SparseVector v = sparsify(p);
+        SparseRow q = row(v);
+        double norm = SparseFeatureSet::norm(q);
+
+        std::vector<double> result;
+        for (int i : indices) result.push_back(this->distance(q, norm, i, metric));
+        return result;
+    }
+}
@@ -0,0 +1,89 @@
+#include "watchdog.h"
+
+#include <ios>
+#include <string>
+#include <vector>
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+namespace cancellation {
+    Watchdog::Watchdog() : m_next_id(0) {
+        if (pipe2(this->m_wake, O_CLOEXEC | O_NONBLOCK) < 0) {
+            throw std::ios_base::failure("error encountered while creating the watchdog's pipe, errno: " +
+                    std::to_string(errno));
+        }
+
+        this->m_thread = std::thread(&Watchdog::run, this);
+        this->m_thread.detach();
+    }
+
+    void Watchdog::watch(int fd, Token* token) {
+        {
+            std::unique_lock<std::mutex> lock{this->m_mutex};
+            this->m_watched[fd] = Watched{token, this->m_next_id++, false};
+        }
+        this->wake();
+    }
+
+    void Watchdog::unwatch(int fd, Token* token) {
+        {
+            std::unique_lock<std::mutex> lock{this->m_mutex};
+            auto entry = this->m_watched.find(fd);
+            if (entry != this->m_watched.end() && entry->second.token == token) this->m_watched.erase(entry);
+        }
+        this->wake();
+    }
+
+    void Watchdog::wake() {
+        char byte = 0;
+
+        /* If the pipe is full, the thread is bound to wake up anyway */
+        if (write(this->m_wake[1], &byte, 1) < 0) { }
+    }
+
+    void Watchdog::run() {
+        std::vector<pollfd> fds;
+        std::vector<uint64_t> ids;
+
+        while (true) {
+            /* The wake pipe comes first, followed by every connection whose peer is still there */
+            fds.assign(1, pollfd{this->m_wake[0], POLLIN, 0});
+            ids.assign(1, 0);
+            {
+                std::unique_lock<std::mutex> lock{this->m_mutex};
+                for (auto& entry : this->m_watched) {
+                    if (entry.second.fired) continue;
+                    fds.push_back(pollfd{entry.first, POLLRDHUP, 0});
+                    ids.push_back(entry.second.id);
+                }
+            }
+
+            if (poll(fds.data(), fds.size(), -1) < 0) continue;
+
+            if (fds[0].revents & POLLIN) {
+                char buffer[64];
+                while (read(this->m_wake[0], buffer, sizeof(buffer)) > 0) { }
+            }
+
+            std::unique_lock<std::mutex> lock{this->m_mutex};
+            for (size_t i = 1; i < fds.size(); i++) {
+                if (!(fds[i].revents & (POLLRDHUP | POLLHUP | POLLERR))) continue;
+
+                /* The connection may have been unwatched (and its descriptor reused) while polling */
+                auto entry = this->m_watched.find(fds[i].fd);
+                if (entry == this->m_watched.end() || entry->second.id != ids[i]) continue;
+
+                entry->second.token->cancel("connection closed by peer");
+                entry->second.fired = true;
+            }
+        }
+    }
+
+    Watchdog& watchdog() {
+        /* Never destroyed, since its thread runs until the process exits */
+        static Watchdog* instance = new Watchdog();
+        return *instance;
+    }
+}